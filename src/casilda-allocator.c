@@ -0,0 +1,242 @@
+/*
+ * Casilda udmabuf Allocator
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define _GNU_SOURCE
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/udmabuf.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/dmabuf.h>
+#include <wlr/render/drm_format_set.h>
+
+#include "casilda-allocator.h"
+
+/* Linear buffers with this stride alignment can be imported by most GPUs */
+#define CASILDA_ALLOCATOR_STRIDE_ALIGN 256
+
+/*
+ * Buffers in plain memory that are also dmabufs. Pixman renders in them
+ * through a mapping and GTK imports them as dmabuf textures, so frames get
+ * to the GPU without an upload copy, even on systems without GBM.
+ */
+typedef struct
+{
+  struct wlr_allocator base;
+  gint                 fd; /* /dev/udmabuf */
+} CasildaAllocator;
+
+typedef struct
+{
+  struct wlr_buffer            base;
+  struct wlr_dmabuf_attributes dmabuf;
+  void                        *data;
+  gsize                        size;
+} CasildaAllocatorBuffer;
+
+static void
+casilda_allocator_buffer_destroy (struct wlr_buffer *wlr_buffer)
+{
+  CasildaAllocatorBuffer *buffer = wl_container_of (wlr_buffer, buffer, base);
+
+  wlr_buffer_finish (wlr_buffer);
+  munmap (buffer->data, buffer->size);
+  wlr_dmabuf_attributes_finish (&buffer->dmabuf);
+  g_free (buffer);
+}
+
+static bool
+casilda_allocator_buffer_get_dmabuf (struct wlr_buffer            *wlr_buffer,
+                                     struct wlr_dmabuf_attributes *attribs)
+{
+  CasildaAllocatorBuffer *buffer = wl_container_of (wlr_buffer, buffer, base);
+
+  *attribs = buffer->dmabuf;
+  return true;
+}
+
+static bool
+casilda_allocator_buffer_begin_data_ptr_access (struct wlr_buffer *wlr_buffer,
+                                                G_GNUC_UNUSED uint32_t flags,
+                                                void             **data,
+                                                uint32_t          *format,
+                                                size_t            *stride)
+{
+  CasildaAllocatorBuffer *buffer = wl_container_of (wlr_buffer, buffer, base);
+
+  *data = buffer->data;
+  *format = buffer->dmabuf.format;
+  *stride = buffer->dmabuf.stride[0];
+  return true;
+}
+
+static void
+casilda_allocator_buffer_end_data_ptr_access (G_GNUC_UNUSED struct wlr_buffer *wlr_buffer)
+{
+}
+
+static const struct wlr_buffer_impl buffer_impl = {
+  .destroy = casilda_allocator_buffer_destroy,
+  .get_dmabuf = casilda_allocator_buffer_get_dmabuf,
+  .begin_data_ptr_access = casilda_allocator_buffer_begin_data_ptr_access,
+  .end_data_ptr_access = casilda_allocator_buffer_end_data_ptr_access,
+};
+
+static struct wlr_buffer *
+casilda_allocator_create_buffer (struct wlr_allocator        *wlr_allocator,
+                                 int                          width,
+                                 int                          height,
+                                 const struct wlr_drm_format *format)
+{
+  CasildaAllocator *allocator = wl_container_of (wlr_allocator, allocator, base);
+  CasildaAllocatorBuffer *buffer;
+  struct udmabuf_create create = { 0, };
+  gsize stride, size, page_size;
+  gint memfd, dmabuf_fd;
+  void *data;
+
+  /* Pixman only renders 32 bits per pixel formats for us */
+  switch (format->format)
+    {
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ABGR8888:
+    case DRM_FORMAT_XBGR8888:
+      break;
+    default:
+      g_debug ("%s unsupported format 0x%08x", __func__, format->format);
+      return NULL;
+    }
+
+  if (!wlr_drm_format_has (format, DRM_FORMAT_MOD_LINEAR) &&
+      !wlr_drm_format_has (format, DRM_FORMAT_MOD_INVALID))
+    return NULL;
+
+  page_size = sysconf (_SC_PAGESIZE);
+  stride = ((gsize) width * 4 + CASILDA_ALLOCATOR_STRIDE_ALIGN - 1) & ~(CASILDA_ALLOCATOR_STRIDE_ALIGN - 1);
+  size = (stride * height + page_size - 1) & ~(page_size - 1);
+
+  if ((memfd = memfd_create ("casilda-udmabuf", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    {
+      g_warning ("memfd_create: %s", g_strerror (errno));
+      return NULL;
+    }
+
+  /* udmabuf only takes memfds that can not shrink under it */
+  if (ftruncate (memfd, size) < 0 ||
+      fcntl (memfd, F_ADD_SEALS, F_SEAL_SHRINK) < 0)
+    {
+      g_warning ("Could not size udmabuf memfd: %s", g_strerror (errno));
+      close (memfd);
+      return NULL;
+    }
+
+  create.memfd = memfd;
+  create.flags = UDMABUF_FLAGS_CLOEXEC;
+  create.offset = 0;
+  create.size = size;
+
+  if ((dmabuf_fd = ioctl (allocator->fd, UDMABUF_CREATE, &create)) < 0)
+    {
+      g_warning ("UDMABUF_CREATE: %s", g_strerror (errno));
+      close (memfd);
+      return NULL;
+    }
+
+  data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+
+  /* The mapping and the dmabuf keep the pages alive */
+  close (memfd);
+
+  if (data == MAP_FAILED)
+    {
+      g_warning ("mmap: %s", g_strerror (errno));
+      close (dmabuf_fd);
+      return NULL;
+    }
+
+  buffer = g_new0 (CasildaAllocatorBuffer, 1);
+  wlr_buffer_init (&buffer->base, &buffer_impl, width, height);
+  buffer->data = data;
+  buffer->size = size;
+  buffer->dmabuf.width = width;
+  buffer->dmabuf.height = height;
+  buffer->dmabuf.format = format->format;
+  buffer->dmabuf.modifier = DRM_FORMAT_MOD_LINEAR;
+  buffer->dmabuf.n_planes = 1;
+  buffer->dmabuf.fd[0] = dmabuf_fd;
+  buffer->dmabuf.offset[0] = 0;
+  buffer->dmabuf.stride[0] = stride;
+
+  return &buffer->base;
+}
+
+static void
+casilda_allocator_destroy (struct wlr_allocator *wlr_allocator)
+{
+  CasildaAllocator *allocator = wl_container_of (wlr_allocator, allocator, base);
+
+  close (allocator->fd);
+  g_free (allocator);
+}
+
+static const struct wlr_allocator_interface allocator_impl = {
+  .create_buffer = casilda_allocator_create_buffer,
+  .destroy = casilda_allocator_destroy,
+};
+
+/*
+ * Allocator for pixman rendered buffers GTK can import as dmabufs, NULL if
+ * the kernel has no udmabuf support or it is not accessible.
+ */
+struct wlr_allocator *
+casilda_allocator_udmabuf_create (void)
+{
+  CasildaAllocator *allocator;
+  gint fd;
+
+  if ((fd = open ("/dev/udmabuf", O_RDWR | O_CLOEXEC)) < 0)
+    {
+      g_debug ("%s /dev/udmabuf: %s", __func__, g_strerror (errno));
+      return NULL;
+    }
+
+  allocator = g_new0 (CasildaAllocator, 1);
+  allocator->fd = fd;
+  wlr_allocator_init (&allocator->base,
+                      &allocator_impl,
+                      WLR_BUFFER_CAP_DATA_PTR | WLR_BUFFER_CAP_DMABUF);
+
+  return &allocator->base;
+}
@@ -0,0 +1,485 @@
+/*
+ * Casilda Tiled Canvas
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <drm_fourcc.h>
+#include <math.h>
+#include <wlr/interfaces/wlr_output.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/swapchain.h>
+#include <wlr/types/wlr_output.h>
+
+#include "casilda-canvas.h"
+#include "casilda-stats-private.h"
+#include "casilda-texture.h"
+
+typedef struct wlr_output_state WlrOutputState;
+G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (WlrOutputState, wlr_output_state_finish);
+
+/*
+ * Every tile is a small output of its own positioned over the scene, wlroots
+ * keeps track of the damage of each one so only the tiles that changed are
+ * rendered again. Tiles are created when they first become visible and
+ * dropped in least recently used order once over the cache size.
+ */
+typedef struct
+{
+  CasildaCanvas           *canvas;
+  struct wlr_output        output;
+  struct wlr_scene_output *scene_output;
+  gint                     col, row;
+  GdkTexture              *texture;
+  guint64                  frame; /* Last snapshot this tile was visible in */
+  GList                    link;  /* Position in the LRU queue */
+  struct wl_listener       needs_frame;
+} CasildaCanvasTile;
+
+struct _CasildaCanvas
+{
+  struct wlr_backend   *backend;
+  struct wl_display    *wl_display;
+  struct wlr_allocator *allocator;
+  struct wlr_renderer  *renderer;
+  struct wlr_scene     *scene;
+  struct wlr_output    *output; /* Drives rendering, scheduled on tile damage */
+  GdkDisplay           *display;
+  GdkGLContext         *gl_context;
+  CasildaStats         *stats;
+
+  GHashTable           *tiles;   /* Position -> CasildaCanvasTile */
+  GQueue                lru;     /* Most recently used first */
+  GPtrArray            *visible; /* Tiles in the last snapshot */
+  guint64               frame;
+  gsize                 cache_size;
+  uint32_t              render_format;
+};
+
+#define TILE_KEY(col, row) GUINT_TO_POINTER (((guint) (row) << 16) | (guint) (col))
+
+static bool
+casilda_canvas_tile_commit (G_GNUC_UNUSED struct wlr_output             *wlr_output,
+                            G_GNUC_UNUSED const struct wlr_output_state *state)
+{
+  return true;
+}
+
+static void
+casilda_canvas_tile_destroy (struct wlr_output *wlr_output)
+{
+  CasildaCanvasTile *tile = wl_container_of (wlr_output, tile, output);
+
+  g_free (tile);
+}
+
+static const struct wlr_output_impl casilda_canvas_tile_impl = {
+  .commit = casilda_canvas_tile_commit,
+  .destroy = casilda_canvas_tile_destroy,
+};
+
+static void
+on_tile_needs_frame (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCanvasTile *tile = wl_container_of (listener, tile, needs_frame);
+
+  /* Nothing drives tile frames, the output decides if a visible one changed */
+  wlr_output_schedule_frame (tile->canvas->output);
+}
+
+static CasildaCanvasTile *
+casilda_canvas_tile_new (CasildaCanvas *self,
+                         gint           col,
+                         gint           row)
+{
+  g_autofree gchar *name = g_strdup_printf ("CasildaCanvas-%d-%d", col, row);
+  CasildaCanvasTile *tile = g_new0 (CasildaCanvasTile, 1);
+  g_auto(WlrOutputState) state = {0, };
+
+  tile->canvas = self;
+  tile->col = col;
+  tile->row = row;
+  tile->link.data = tile;
+
+  wlr_output_state_init (&state);
+  wlr_output_state_set_enabled (&state, true);
+  wlr_output_state_set_custom_mode (&state,
+                                    CASILDA_CANVAS_TILE_SIZE,
+                                    CASILDA_CANVAS_TILE_SIZE,
+                                    0);
+  wlr_output_state_set_render_format (&state, self->render_format);
+
+  /* Tile outputs have no global, clients never see them */
+  wlr_output_init (&tile->output,
+                   self->backend,
+                   &casilda_canvas_tile_impl,
+                   wl_display_get_event_loop (self->wl_display),
+                   &state);
+  wlr_output_set_name (&tile->output, name);
+  wlr_output_init_render (&tile->output, self->allocator, self->renderer);
+
+  tile->needs_frame.notify = on_tile_needs_frame;
+  wl_signal_add (&tile->output.events.needs_frame, &tile->needs_frame);
+
+  tile->scene_output = wlr_scene_output_create (self->scene, &tile->output);
+  wlr_scene_output_set_position (tile->scene_output,
+                                 col * CASILDA_CANVAS_TILE_SIZE,
+                                 row * CASILDA_CANVAS_TILE_SIZE);
+
+  g_hash_table_insert (self->tiles, TILE_KEY (col, row), tile);
+  g_queue_push_head_link (&self->lru, &tile->link);
+
+  return tile;
+}
+
+static void
+casilda_canvas_tile_free (CasildaCanvasTile *tile)
+{
+  g_queue_unlink (&tile->canvas->lru, &tile->link);
+  g_clear_object (&tile->texture);
+  wl_list_remove (&tile->needs_frame.link);
+
+  wlr_scene_output_destroy (tile->scene_output);
+
+  /* Frees the tile */
+  wlr_output_destroy (&tile->output);
+}
+
+/* Output buffers owned by the tile, assuming 32 bits per pixel */
+static gsize
+casilda_canvas_tile_get_size (CasildaCanvasTile *tile)
+{
+  struct wlr_swapchain *swapchain = tile->output.swapchain;
+  gsize retval = 0;
+
+  if (!swapchain)
+    return 0;
+
+  for (gint i = 0; i < WLR_SWAPCHAIN_CAP; i++)
+    {
+      if (swapchain->slots[i].buffer)
+        retval += (gsize) swapchain->width * swapchain->height * 4;
+    }
+
+  return retval;
+}
+
+static gboolean
+casilda_canvas_tile_get_damaged (CasildaCanvasTile *tile)
+{
+  return !tile->texture ||
+         tile->output.needs_frame ||
+         pixman_region32_not_empty (&tile->scene_output->pending_commit_damage);
+}
+
+static void
+casilda_canvas_tile_render (CasildaCanvasTile *tile)
+{
+  CasildaStats *stats = tile->canvas->stats;
+  g_auto(WlrOutputState) state = {0, };
+  g_autoptr(GError) error = NULL;
+  gint64 start;
+
+  wlr_output_state_init (&state);
+
+  casilda_stats_add_damage (stats, &tile->scene_output->pending_commit_damage);
+
+  start = g_get_monotonic_time ();
+  if (!wlr_scene_output_build_state (tile->scene_output, &state, NULL))
+    return;
+  casilda_stats_add_time (stats, CASILDA_STATS_RENDER_TIME, g_get_monotonic_time () - start);
+
+  if (state.buffer)
+    {
+      GdkTexture *texture;
+
+      start = g_get_monotonic_time ();
+      if (!tile->canvas->gl_context ||
+          !(texture = casilda_texture_import_gl (tile->canvas->gl_context,
+                                                 state.buffer,
+                                                 tile->texture,
+                                                 &tile->scene_output->pending_commit_damage,
+                                                 NULL)))
+        texture = casilda_texture_import_buffer (tile->canvas->display,
+                                                 state.buffer,
+                                                 tile->texture,
+                                                 &tile->scene_output->pending_commit_damage,
+                                                 &error);
+      casilda_stats_add_time (stats, CASILDA_STATS_BLIT_TIME, g_get_monotonic_time () - start);
+
+      if (texture)
+        {
+          g_clear_object (&tile->texture);
+          tile->texture = texture;
+        }
+      else
+        g_warning ("Could not import tile %d,%d buffer: %s",
+                   tile->col, tile->row, error->message);
+    }
+
+  wlr_output_commit_state (&tile->output, &state);
+
+  /* Tiles are presented right away, ready for the next commit */
+  wlr_output_send_frame (&tile->output);
+}
+
+/* Range of tiles intersecting visible, end not included */
+static gboolean
+casilda_canvas_get_range (const graphene_rect_t *visible,
+                          gint                  *col0,
+                          gint                  *row0,
+                          gint                  *col1,
+                          gint                  *row1)
+{
+  if (visible->size.width <= 0 || visible->size.height <= 0)
+    return FALSE;
+
+  *col0 = MAX (0, floor (visible->origin.x / CASILDA_CANVAS_TILE_SIZE));
+  *row0 = MAX (0, floor (visible->origin.y / CASILDA_CANVAS_TILE_SIZE));
+  *col1 = ceil ((visible->origin.x + visible->size.width) / CASILDA_CANVAS_TILE_SIZE);
+  *row1 = ceil ((visible->origin.y + visible->size.height) / CASILDA_CANVAS_TILE_SIZE);
+
+  return *col0 < *col1 && *row0 < *row1;
+}
+
+static void
+casilda_canvas_evict (CasildaCanvas *self)
+{
+  gsize size = 0;
+  GList *l;
+
+  for (l = self->lru.head; l; l = g_list_next (l))
+    size += casilda_canvas_tile_get_size (l->data);
+
+  /* Visible tiles are always kept, even if they alone go over the limit */
+  while (size > self->cache_size && self->lru.tail)
+    {
+      CasildaCanvasTile *tile = self->lru.tail->data;
+
+      if (tile->frame == self->frame)
+        break;
+
+      size -= casilda_canvas_tile_get_size (tile);
+      g_hash_table_remove (self->tiles, TILE_KEY (tile->col, tile->row));
+    }
+}
+
+CasildaCanvas *
+casilda_canvas_new (struct wlr_backend   *backend,
+                    struct wl_display    *wl_display,
+                    struct wlr_allocator *allocator,
+                    struct wlr_renderer  *renderer,
+                    struct wlr_scene     *scene,
+                    struct wlr_output    *output,
+                    GdkDisplay           *display,
+                    CasildaStats         *stats)
+{
+  CasildaCanvas *self = g_new0 (CasildaCanvas, 1);
+
+  self->backend = backend;
+  self->wl_display = wl_display;
+  self->allocator = allocator;
+  self->renderer = renderer;
+  self->scene = scene;
+  self->output = output;
+  self->display = display;
+  self->stats = stats;
+  self->cache_size = CASILDA_CANVAS_CACHE_SIZE;
+  self->render_format = DRM_FORMAT_XRGB8888;
+
+  self->tiles = g_hash_table_new_full (g_direct_hash,
+                                       g_direct_equal,
+                                       NULL,
+                                       (GDestroyNotify) casilda_canvas_tile_free);
+  g_queue_init (&self->lru);
+  self->visible = g_ptr_array_new ();
+
+  return self;
+}
+
+void
+casilda_canvas_free (CasildaCanvas *self)
+{
+  g_ptr_array_unref (self->visible);
+  g_hash_table_destroy (self->tiles);
+  g_clear_object (&self->gl_context);
+  g_free (self);
+}
+
+/*
+ * Present GPU rendered tiles as GL textures in context, NULL to hand them to
+ * GTK as dmabufs.
+ */
+void
+casilda_canvas_set_gl_context (CasildaCanvas *self,
+                               GdkGLContext  *context)
+{
+  g_set_object (&self->gl_context, context);
+}
+
+void
+casilda_canvas_set_cache_size (CasildaCanvas *self,
+                               gsize          cache_size)
+{
+  self->cache_size = cache_size;
+  casilda_canvas_evict (self);
+}
+
+/*
+ * Tiles rendered in another format are dropped, the next snapshot renders
+ * the visible ones again.
+ */
+void
+casilda_canvas_set_render_format (CasildaCanvas *self,
+                                  uint32_t       format)
+{
+  if (self->render_format == format)
+    return;
+
+  self->render_format = format;
+  g_ptr_array_set_size (self->visible, 0);
+  g_hash_table_remove_all (self->tiles);
+}
+
+/*
+ * Whether any tile in visible, in output coordinates, needs to be rendered.
+ */
+gboolean
+casilda_canvas_get_damaged (CasildaCanvas         *self,
+                            const graphene_rect_t *visible)
+{
+  gint col0, row0, col1, row1;
+
+  if (!casilda_canvas_get_range (visible, &col0, &row0, &col1, &row1))
+    return FALSE;
+
+  for (gint row = row0; row < row1; row++)
+    {
+      for (gint col = col0; col < col1; col++)
+        {
+          CasildaCanvasTile *tile = g_hash_table_lookup (self->tiles, TILE_KEY (col, row));
+
+          if (!tile || casilda_canvas_tile_get_damaged (tile))
+            return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/*
+ * Render the damaged tiles in visible and append every visible tile as a
+ * texture node in output coordinates. Tiles scrolled into view that are
+ * still cached and not damaged are used as is.
+ */
+void
+casilda_canvas_snapshot (CasildaCanvas         *self,
+                         GtkSnapshot           *snapshot,
+                         const graphene_rect_t *visible,
+                         GskScalingFilter       filter)
+{
+  gint col0, row0, col1, row1;
+
+  self->frame++;
+  g_ptr_array_set_size (self->visible, 0);
+
+  if (!casilda_canvas_get_range (visible, &col0, &row0, &col1, &row1))
+    return;
+
+  for (gint row = row0; row < row1; row++)
+    {
+      for (gint col = col0; col < col1; col++)
+        {
+          CasildaCanvasTile *tile = g_hash_table_lookup (self->tiles, TILE_KEY (col, row));
+
+          if (tile)
+            {
+              g_queue_unlink (&self->lru, &tile->link);
+              g_queue_push_head_link (&self->lru, &tile->link);
+            }
+          else
+            tile = casilda_canvas_tile_new (self, col, row);
+
+          tile->frame = self->frame;
+          g_ptr_array_add (self->visible, tile);
+
+          if (casilda_canvas_tile_get_damaged (tile))
+            casilda_canvas_tile_render (tile);
+
+          if (!tile->texture)
+            continue;
+
+          gtk_snapshot_append_scaled_texture (snapshot,
+                                              tile->texture,
+                                              filter,
+                                              &GRAPHENE_RECT_INIT (col * CASILDA_CANVAS_TILE_SIZE,
+                                                                   row * CASILDA_CANVAS_TILE_SIZE,
+                                                                   CASILDA_CANVAS_TILE_SIZE,
+                                                                   CASILDA_CANVAS_TILE_SIZE));
+        }
+    }
+
+  casilda_canvas_evict (self);
+}
+
+/*
+ * Iterate over every buffer shown in the last snapshot, buffers spanning
+ * several tiles are visited once per tile.
+ */
+void
+casilda_canvas_for_each_buffer (CasildaCanvas                   *self,
+                                wlr_scene_buffer_iterator_func_t iterator,
+                                void                            *user_data)
+{
+  for (guint i = 0; i < self->visible->len; i++)
+    {
+      CasildaCanvasTile *tile = g_ptr_array_index (self->visible, i);
+
+      wlr_scene_output_for_each_buffer (tile->scene_output, iterator, user_data);
+    }
+}
+
+/*
+ * Drop every tile not visible in the last snapshot, returns how many were
+ * dropped.
+ */
+guint
+casilda_canvas_trim (CasildaCanvas *self)
+{
+  guint retval = 0;
+
+  while (self->lru.tail)
+    {
+      CasildaCanvasTile *tile = self->lru.tail->data;
+
+      if (tile->frame == self->frame)
+        break;
+
+      g_hash_table_remove (self->tiles, TILE_KEY (tile->col, tile->row));
+      retval++;
+    }
+
+  return retval;
+}
@@ -0,0 +1,71 @@
+/*
+ * Casilda Tiled Canvas
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_scene.h>
+
+#include "casilda-stats.h"
+
+struct wlr_allocator;
+struct wlr_backend;
+struct wlr_output;
+struct wlr_renderer;
+
+/* Canvas tiles are square, this is their size in output pixels */
+#define CASILDA_CANVAS_TILE_SIZE 512
+
+/* Default limit for the buffers of every cached tile, visible ones are always kept */
+#define CASILDA_CANVAS_CACHE_SIZE (128 * 1024 * 1024)
+
+typedef struct _CasildaCanvas CasildaCanvas;
+
+CasildaCanvas *casilda_canvas_new               (struct wlr_backend               *backend,
+                                                 struct wl_display                *wl_display,
+                                                 struct wlr_allocator             *allocator,
+                                                 struct wlr_renderer              *renderer,
+                                                 struct wlr_scene                 *scene,
+                                                 struct wlr_output                *output,
+                                                 GdkDisplay                       *display,
+                                                 CasildaStats                     *stats);
+void           casilda_canvas_free              (CasildaCanvas                    *self);
+void           casilda_canvas_set_cache_size    (CasildaCanvas                    *self,
+                                                 gsize                             cache_size);
+void           casilda_canvas_set_render_format (CasildaCanvas                    *self,
+                                                 uint32_t                          format);
+void           casilda_canvas_set_gl_context    (CasildaCanvas                    *self,
+                                                 GdkGLContext                     *context);
+gboolean       casilda_canvas_get_damaged       (CasildaCanvas                    *self,
+                                                 const graphene_rect_t            *visible);
+void           casilda_canvas_snapshot          (CasildaCanvas                    *self,
+                                                 GtkSnapshot                      *snapshot,
+                                                 const graphene_rect_t            *visible,
+                                                 GskScalingFilter                  filter);
+void           casilda_canvas_for_each_buffer   (CasildaCanvas                    *self,
+                                                 wlr_scene_buffer_iterator_func_t  iterator,
+                                                 void                             *user_data);
+guint          casilda_canvas_trim              (CasildaCanvas                    *self);
@@ -0,0 +1,62 @@
+/*
+ * Casilda Wayland Compositor Widget
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <wayland-server-core.h>
+
+#include "casilda-client.h"
+#include "casilda-stats.h"
+#include "casilda-toplevel.h"
+
+typedef struct _CasildaClientTracker CasildaClientTracker;
+
+CasildaClientTracker *casilda_client_tracker_new            (struct wl_display    *display,
+                                                             GListStore           *clients);
+void                  casilda_client_tracker_free           (CasildaClientTracker *tracker);
+gboolean              casilda_client_tracker_has_throttled  (CasildaClientTracker *tracker);
+void                  casilda_client_tracker_set_latency_threshold (CasildaClientTracker *tracker,
+                                                                    gint64                threshold);
+void                  casilda_client_tracker_presented      (CasildaClientTracker *tracker,
+                                                             gint64                time);
+void                  casilda_client_tracker_set_stats      (CasildaClientTracker *tracker,
+                                                             CasildaStats         *stats);
+
+CasildaClient        *casilda_client_from_wl_client         (struct wl_client     *wl_client);
+void                  casilda_client_set_subprocess         (CasildaClient        *client,
+                                                             GSubprocess          *subprocess);
+void                  casilda_client_toplevel_mapped        (CasildaClient        *client,
+                                                             CasildaToplevel      *toplevel);
+void                  casilda_client_toplevel_unmapped      (CasildaClient        *client,
+                                                             CasildaToplevel      *toplevel);
+gint64                casilda_client_get_frame_due          (CasildaClient        *client,
+                                                             guint                 frame,
+                                                             gint64                target);
+void                  casilda_client_frame_sent             (CasildaClient        *client,
+                                                             gint64                time,
+                                                             gint64                target);
+void                  casilda_client_input                  (CasildaClient        *client,
+                                                             struct wl_resource   *surface,
+                                                             gint64                time);
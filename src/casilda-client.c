@@ -0,0 +1,816 @@
+/*
+ * Casilda Wayland Compositor Widget
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <wayland-server-protocol.h>
+#include <wlr/types/wlr_buffer.h>
+
+#include "casilda-client-private.h"
+#include "casilda-stats-private.h"
+
+/* Usage is sampled and limits enforced every this many seconds */
+#define CASILDA_CLIENT_SAMPLE_INTERVAL 1
+
+/* Weight of the last sample in the render time average, as 1/N */
+#define CASILDA_CLIENT_RENDER_TIME_WEIGHT 8
+
+/* Input not followed by a commit within this many microseconds had no visible effect */
+#define CASILDA_CLIENT_INPUT_TIMEOUT G_USEC_PER_SEC
+
+struct _CasildaClientTracker
+{
+  struct wl_display         *display;
+  GListStore                *clients;
+  struct wl_listener         client_created;
+  struct wl_protocol_logger *logger;
+  guint                      sample_source;
+  gint64                     sample_time;
+  guint                      n_throttled;
+
+  /* Input latencies over this many microseconds are logged, 0 to disable */
+  gint64                     latency_threshold;
+
+  /* Compositor wide statistics, not owned */
+  CasildaStats              *stats;
+
+  /* Request being dispatched, closed by the next request or on idle */
+  CasildaClient             *dispatch_client;
+  gint64                     dispatch_start;
+  struct wl_event_source    *dispatch_idle;
+};
+
+struct _CasildaClient
+{
+  GObject parent;
+
+  CasildaClientTracker *tracker;
+  GSubprocess          *subprocess;
+  struct wl_client     *wl_client;
+  struct wl_listener    wl_client_destroy;
+  GListStore           *toplevels; /* Mapped CasildaToplevel handles */
+
+  /* Accounting, a limit of 0 means unlimited */
+  guint64               usage[CASILDA_CLIENT_N_RESOURCES];
+  guint64               soft_limit[CASILDA_CLIENT_N_RESOURCES];
+  guint64               hard_limit[CASILDA_CLIENT_N_RESOURCES];
+  gboolean              throttled;
+
+  /* Frame callbacks per second for every toplevel, 0 for no limit */
+  guint                 max_frame_rate;
+
+  /* Counters since the last sample */
+  guint64               commits;
+  gint64                dispatch_time;
+  guint64               late_frames;
+
+  /* Frame callback in flight, render time is measured up to the next commit */
+  gint64                frame_sent;
+  gint64                frame_target;
+  gint64                render_time;
+
+  /* When to send frame callbacks for the current frame */
+  guint                 frame;
+  gint64                frame_due;
+
+  /* Input to photon latency, from the first input not answered by a commit
+   * on the same surface to the frame that shows it
+   */
+  struct wl_resource   *input_surface;
+  gint64                input_time;
+  gint64                committed_input_time;
+  guint64               latency[CASILDA_CLIENT_LATENCY_BUCKETS];
+};
+
+enum {
+  PROP_0,
+  PROP_SUBPROCESS,
+  PROP_CONNECTED,
+  PROP_N_TOPLEVELS,
+  PROP_THROTTLED,
+  PROP_MAX_FRAME_RATE,
+
+  N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES];
+
+static const gchar *resource_names[CASILDA_CLIENT_N_RESOURCES] = {
+  "shm bytes",
+  "buffers",
+  "surfaces",
+  "commits per second",
+  "dispatch time per second",
+  "render time",
+  "late frames per second",
+};
+
+G_DEFINE_TYPE (CasildaClient, casilda_client, G_TYPE_OBJECT);
+
+
+static void
+casilda_client_set_throttled (CasildaClient *client, gboolean throttled)
+{
+  if (client->throttled == throttled)
+    return;
+
+  client->throttled = throttled;
+
+  if (throttled)
+    client->tracker->n_throttled++;
+  else
+    client->tracker->n_throttled--;
+
+  g_object_notify_by_pspec (G_OBJECT (client), properties[PROP_THROTTLED]);
+}
+
+static void
+on_wl_client_destroy (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaClient *client = wl_container_of (listener, client, wl_client_destroy);
+  CasildaClientTracker *tracker = client->tracker;
+  guint position;
+
+  wl_list_remove (&client->wl_client_destroy.link);
+  client->wl_client = NULL;
+  g_list_store_remove_all (client->toplevels);
+
+  if (tracker->dispatch_client == client)
+    tracker->dispatch_client = NULL;
+
+  casilda_client_set_throttled (client, FALSE);
+
+  g_object_notify_by_pspec (G_OBJECT (client), properties[PROP_N_TOPLEVELS]);
+  g_object_notify_by_pspec (G_OBJECT (client), properties[PROP_CONNECTED]);
+
+  /* Drop the reference held while connected */
+  if (g_list_store_find (tracker->clients, client, &position))
+    g_list_store_remove (tracker->clients, position);
+}
+
+static void
+casilda_client_init (CasildaClient *client)
+{
+  client->toplevels = g_list_store_new (CASILDA_TOPLEVEL_TYPE);
+}
+
+static void
+casilda_client_finalize (GObject *object)
+{
+  CasildaClient *client = CASILDA_CLIENT (object);
+
+  g_clear_object (&client->subprocess);
+  g_clear_object (&client->toplevels);
+
+  G_OBJECT_CLASS (casilda_client_parent_class)->finalize (object);
+}
+
+static void
+casilda_client_get_property (GObject    *object,
+                             guint       prop_id,
+                             GValue     *value,
+                             GParamSpec *pspec)
+{
+  CasildaClient *client = CASILDA_CLIENT (object);
+
+  switch (prop_id)
+    {
+    case PROP_SUBPROCESS:
+      g_value_set_object (value, client->subprocess);
+      break;
+
+    case PROP_CONNECTED:
+      g_value_set_boolean (value, client->wl_client != NULL);
+      break;
+
+    case PROP_N_TOPLEVELS:
+      g_value_set_uint (value, g_list_model_get_n_items (G_LIST_MODEL (client->toplevels)));
+      break;
+
+    case PROP_THROTTLED:
+      g_value_set_boolean (value, client->throttled);
+      break;
+
+    case PROP_MAX_FRAME_RATE:
+      g_value_set_uint (value, client->max_frame_rate);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+casilda_client_set_property (GObject      *object,
+                             guint         prop_id,
+                             const GValue *value,
+                             GParamSpec   *pspec)
+{
+  CasildaClient *client = CASILDA_CLIENT (object);
+
+  switch (prop_id)
+    {
+    case PROP_MAX_FRAME_RATE:
+      client->max_frame_rate = g_value_get_uint (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+casilda_client_class_init (CasildaClientClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = casilda_client_finalize;
+  object_class->get_property = casilda_client_get_property;
+  object_class->set_property = casilda_client_set_property;
+
+  properties[PROP_SUBPROCESS] =
+    g_param_spec_object ("subprocess", "Subprocess",
+                         "The client process",
+                         G_TYPE_SUBPROCESS,
+                         G_PARAM_READABLE);
+
+  properties[PROP_CONNECTED] =
+    g_param_spec_boolean ("connected", "Connected",
+                          "Whether the client is still connected to the compositor",
+                          FALSE,
+                          G_PARAM_READABLE);
+
+  properties[PROP_N_TOPLEVELS] =
+    g_param_spec_uint ("n-toplevels", "Number of toplevels",
+                       "Number of mapped toplevel windows of this client",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE);
+
+  properties[PROP_THROTTLED] =
+    g_param_spec_boolean ("throttled", "Throttled",
+                          "Whether the client is over a soft limit and its frame callbacks are throttled",
+                          FALSE,
+                          G_PARAM_READABLE);
+
+  properties[PROP_MAX_FRAME_RATE] =
+    g_param_spec_uint ("max-frame-rate", "Max frame rate",
+                       "Frame callbacks per second for every toplevel of this client, 0 for no limit",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+}
+
+/* Accounting */
+
+static enum wl_iterator_result
+casilda_client_count_resource (struct wl_resource *resource, void *user_data)
+{
+  CasildaClient *client = user_data;
+  const gchar *class = wl_resource_get_class (resource);
+
+  if (g_str_equal (class, wl_surface_interface.name))
+    {
+      client->usage[CASILDA_CLIENT_RESOURCE_SURFACES]++;
+    }
+  else if (g_str_equal (class, wl_buffer_interface.name))
+    {
+      struct wlr_shm_attributes attribs;
+      struct wlr_buffer *buffer;
+
+      client->usage[CASILDA_CLIENT_RESOURCE_BUFFERS]++;
+
+      if ((buffer = wlr_buffer_try_from_resource (resource)))
+        {
+          if (wlr_buffer_get_shm (buffer, &attribs))
+            client->usage[CASILDA_CLIENT_RESOURCE_SHM_BYTES] += (guint64) attribs.stride * attribs.height;
+
+          wlr_buffer_unlock (buffer);
+        }
+    }
+
+  return WL_ITERATOR_CONTINUE;
+}
+
+static void
+casilda_client_sample (CasildaClient *client, gint64 elapsed)
+{
+  guint64 *usage = client->usage;
+  gboolean throttled = FALSE;
+  pid_t pid = 0;
+
+  usage[CASILDA_CLIENT_RESOURCE_SHM_BYTES] = 0;
+  usage[CASILDA_CLIENT_RESOURCE_BUFFERS] = 0;
+  usage[CASILDA_CLIENT_RESOURCE_SURFACES] = 0;
+  wl_client_for_each_resource (client->wl_client, casilda_client_count_resource, client);
+
+  usage[CASILDA_CLIENT_RESOURCE_COMMIT_RATE] = client->commits * G_USEC_PER_SEC / elapsed;
+  usage[CASILDA_CLIENT_RESOURCE_DISPATCH_TIME] = client->dispatch_time * G_USEC_PER_SEC / elapsed;
+  usage[CASILDA_CLIENT_RESOURCE_RENDER_TIME] = client->render_time;
+  usage[CASILDA_CLIENT_RESOURCE_LATE_FRAMES] = client->late_frames * G_USEC_PER_SEC / elapsed;
+  client->commits = 0;
+  client->dispatch_time = 0;
+  client->late_frames = 0;
+
+  for (gint i = 0; i < CASILDA_CLIENT_N_RESOURCES; i++)
+    {
+      if (client->hard_limit[i] && usage[i] > client->hard_limit[i])
+        {
+          wl_client_get_credentials (client->wl_client, &pid, NULL, NULL);
+          g_warning ("Disconnecting client %d, %s %" G_GUINT64_FORMAT " over limit %" G_GUINT64_FORMAT,
+                     pid,
+                     resource_names[i],
+                     usage[i],
+                     client->hard_limit[i]);
+
+          wl_client_destroy (client->wl_client);
+          return;
+        }
+
+      if (client->soft_limit[i] && usage[i] > client->soft_limit[i])
+        throttled = TRUE;
+    }
+
+  casilda_client_set_throttled (client, throttled);
+}
+
+static gboolean
+on_tracker_sample (gpointer user_data)
+{
+  CasildaClientTracker *tracker = user_data;
+  gint64 now = g_get_monotonic_time ();
+  gint64 elapsed = MAX (now - tracker->sample_time, 1);
+  guint n = g_list_model_get_n_items (G_LIST_MODEL (tracker->clients));
+
+  tracker->sample_time = now;
+
+  /* Backwards, disconnected clients are removed from the list */
+  for (guint i = n; i > 0; i--)
+    {
+      g_autoptr(CasildaClient) client = g_list_model_get_item (G_LIST_MODEL (tracker->clients), i - 1);
+
+      casilda_client_sample (client, elapsed);
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+casilda_client_commit (CasildaClient      *client,
+                       struct wl_resource *surface,
+                       gint64              now)
+{
+  gint64 render_time;
+
+  client->commits++;
+
+  if (client->input_time && client->input_surface == surface)
+    {
+      if (now - client->input_time < CASILDA_CLIENT_INPUT_TIMEOUT &&
+          !client->committed_input_time)
+        client->committed_input_time = client->input_time;
+
+      client->input_time = 0;
+      client->input_surface = NULL;
+    }
+
+  if (!client->frame_sent)
+    return;
+
+  render_time = now - client->frame_sent;
+  client->frame_sent = 0;
+
+  /* Not rendering, the client just had nothing to show for a while */
+  if (render_time > G_USEC_PER_SEC)
+    return;
+
+  if (client->render_time)
+    client->render_time += (render_time - client->render_time) / CASILDA_CLIENT_RENDER_TIME_WEIGHT;
+  else
+    client->render_time = render_time;
+
+  if (client->frame_target && now > client->frame_target)
+    client->late_frames++;
+}
+
+static void
+casilda_client_tracker_close_dispatch (CasildaClientTracker *tracker, gint64 now)
+{
+  if (!tracker->dispatch_client)
+    return;
+
+  tracker->dispatch_client->dispatch_time += now - tracker->dispatch_start;
+
+  if (tracker->stats)
+    casilda_stats_add_dispatch_time (tracker->stats, now - tracker->dispatch_start);
+
+  tracker->dispatch_client = NULL;
+}
+
+static void
+on_tracker_dispatch_idle (void *user_data)
+{
+  CasildaClientTracker *tracker = user_data;
+
+  tracker->dispatch_idle = NULL;
+  casilda_client_tracker_close_dispatch (tracker, g_get_monotonic_time ());
+}
+
+/*
+ * Every request goes through the protocol logger right before it is
+ * dispatched, use it to count commits and time request handlers.
+ */
+static void
+casilda_client_tracker_log (void                                    *user_data,
+                            enum wl_protocol_logger_type             type,
+                            const struct wl_protocol_logger_message *message)
+{
+  CasildaClientTracker *tracker = user_data;
+  CasildaClient *client;
+  gint64 now;
+
+  if (type != WL_PROTOCOL_LOGGER_REQUEST)
+    return;
+
+  now = g_get_monotonic_time ();
+  casilda_client_tracker_close_dispatch (tracker, now);
+
+  if (!(client = casilda_client_from_wl_client (wl_resource_get_client (message->resource))))
+    return;
+
+  if (message->message_opcode == WL_SURFACE_COMMIT &&
+      g_str_equal (wl_resource_get_class (message->resource), wl_surface_interface.name))
+    casilda_client_commit (client, message->resource, now);
+
+  tracker->dispatch_client = client;
+  tracker->dispatch_start = now;
+
+  /* Close the last request once the event loop is done dispatching */
+  if (!tracker->dispatch_idle)
+    tracker->dispatch_idle = wl_event_loop_add_idle (wl_display_get_event_loop (tracker->display),
+                                                     on_tracker_dispatch_idle,
+                                                     tracker);
+}
+
+static void
+on_tracker_client_created (struct wl_listener *listener, void *data)
+{
+  CasildaClientTracker *tracker = wl_container_of (listener, tracker, client_created);
+  g_autoptr(CasildaClient) client = g_object_new (CASILDA_CLIENT_TYPE, NULL);
+  struct wl_client *wl_client = data;
+
+  client->tracker = tracker;
+  client->wl_client = wl_client;
+  client->wl_client_destroy.notify = on_wl_client_destroy;
+  wl_client_add_destroy_listener (wl_client, &client->wl_client_destroy);
+
+  /* The list keeps the handle alive for as long as the connection */
+  g_list_store_append (tracker->clients, client);
+
+  if (!tracker->sample_source)
+    {
+      tracker->sample_time = g_get_monotonic_time ();
+      tracker->sample_source = g_timeout_add_seconds (CASILDA_CLIENT_SAMPLE_INTERVAL,
+                                                      on_tracker_sample,
+                                                      tracker);
+    }
+}
+
+/* Private API */
+
+CasildaClientTracker *
+casilda_client_tracker_new (struct wl_display *display, GListStore *clients)
+{
+  CasildaClientTracker *tracker = g_new0 (CasildaClientTracker, 1);
+
+  tracker->display = display;
+  tracker->clients = g_object_ref (clients);
+
+  tracker->client_created.notify = on_tracker_client_created;
+  wl_display_add_client_created_listener (display, &tracker->client_created);
+
+  tracker->logger = wl_display_add_protocol_logger (display, casilda_client_tracker_log, tracker);
+
+  return tracker;
+}
+
+void
+casilda_client_tracker_free (CasildaClientTracker *tracker)
+{
+  guint n = g_list_model_get_n_items (G_LIST_MODEL (tracker->clients));
+
+  /* Detach clients still connected, the display is going away anyways */
+  for (guint i = 0; i < n; i++)
+    {
+      g_autoptr(CasildaClient) client = g_list_model_get_item (G_LIST_MODEL (tracker->clients), i);
+
+      wl_list_remove (&client->wl_client_destroy.link);
+      client->wl_client = NULL;
+    }
+
+  g_list_store_remove_all (tracker->clients);
+
+  wl_list_remove (&tracker->client_created.link);
+  wl_protocol_logger_destroy (tracker->logger);
+  g_clear_pointer (&tracker->dispatch_idle, wl_event_source_remove);
+  g_clear_handle_id (&tracker->sample_source, g_source_remove);
+  g_object_unref (tracker->clients);
+  g_free (tracker);
+}
+
+gboolean
+casilda_client_tracker_has_throttled (CasildaClientTracker *tracker)
+{
+  return tracker->n_throttled > 0;
+}
+
+void
+casilda_client_tracker_set_latency_threshold (CasildaClientTracker *tracker,
+                                              gint64                threshold)
+{
+  tracker->latency_threshold = threshold;
+}
+
+void
+casilda_client_tracker_set_stats (CasildaClientTracker *tracker,
+                                  CasildaStats         *stats)
+{
+  tracker->stats = stats;
+}
+
+static void
+casilda_client_record_latency (CasildaClient *client, gint64 latency)
+{
+  gint64 ms = latency / 1000;
+  guint bucket = 0;
+  pid_t pid = 0;
+
+  while (ms && bucket < CASILDA_CLIENT_LATENCY_BUCKETS - 1)
+    {
+      ms >>= 1;
+      bucket++;
+    }
+
+  client->latency[bucket]++;
+
+  if (!client->tracker->latency_threshold || latency < client->tracker->latency_threshold)
+    return;
+
+  wl_client_get_credentials (client->wl_client, &pid, NULL, NULL);
+  g_message ("Client %d input latency %.1f ms", pid, latency / 1000.0);
+}
+
+/*
+ * A frame was presented at time, every commit answering an input so far is
+ * in it.
+ */
+void
+casilda_client_tracker_presented (CasildaClientTracker *tracker,
+                                  gint64                time)
+{
+  guint n = g_list_model_get_n_items (G_LIST_MODEL (tracker->clients));
+
+  for (guint i = 0; i < n; i++)
+    {
+      g_autoptr(CasildaClient) client = g_list_model_get_item (G_LIST_MODEL (tracker->clients), i);
+
+      if (!client->committed_input_time)
+        continue;
+
+      casilda_client_record_latency (client, time - client->committed_input_time);
+      client->committed_input_time = 0;
+    }
+}
+
+CasildaClient *
+casilda_client_from_wl_client (struct wl_client *wl_client)
+{
+  struct wl_listener *listener;
+  CasildaClient *client;
+
+  if (!wl_client)
+    return NULL;
+
+  if (!(listener = wl_client_get_destroy_listener (wl_client, on_wl_client_destroy)))
+    return NULL;
+
+  return wl_container_of (listener, client, wl_client_destroy);
+}
+
+void
+casilda_client_set_subprocess (CasildaClient *client, GSubprocess *subprocess)
+{
+  g_set_object (&client->subprocess, subprocess);
+  g_object_notify_by_pspec (G_OBJECT (client), properties[PROP_SUBPROCESS]);
+}
+
+void
+casilda_client_toplevel_mapped (CasildaClient *client, CasildaToplevel *toplevel)
+{
+  g_list_store_append (client->toplevels, toplevel);
+  g_object_notify_by_pspec (G_OBJECT (client), properties[PROP_N_TOPLEVELS]);
+}
+
+void
+casilda_client_toplevel_unmapped (CasildaClient *client, CasildaToplevel *toplevel)
+{
+  guint position;
+
+  if (!g_list_store_find (client->toplevels, toplevel, &position))
+    return;
+
+  g_list_store_remove (client->toplevels, position);
+  g_object_notify_by_pspec (G_OBJECT (client), properties[PROP_N_TOPLEVELS]);
+}
+
+/*
+ * Time to send the client frame callbacks so it commits by target, computed
+ * once per frame so every surface of the client gets them at once.
+ */
+gint64
+casilda_client_get_frame_due (CasildaClient *client,
+                              guint          frame,
+                              gint64         target)
+{
+  if (client->frame != frame)
+    {
+      client->frame = frame;
+      client->frame_due = target - client->render_time;
+    }
+
+  return client->frame_due;
+}
+
+/*
+ * A frame callback was sent at time, the client should commit before target
+ * or 0 if there is none.
+ */
+void
+casilda_client_frame_sent (CasildaClient *client,
+                           gint64         time,
+                           gint64         target)
+{
+  /* Measure from the first callback */
+  if (client->frame_sent)
+    return;
+
+  client->frame_sent = time;
+  client->frame_target = target;
+}
+
+/*
+ * The client got input on surface at time, only the first input the client
+ * has not answered yet is measured.
+ */
+void
+casilda_client_input (CasildaClient      *client,
+                      struct wl_resource *surface,
+                      gint64              time)
+{
+  if (client->input_time && time - client->input_time < CASILDA_CLIENT_INPUT_TIMEOUT)
+    return;
+
+  client->input_surface = surface;
+  client->input_time = time;
+}
+
+/* Public API */
+
+GSubprocess *
+casilda_client_get_subprocess (CasildaClient *client)
+{
+  g_return_val_if_fail (CASILDA_IS_CLIENT (client), NULL);
+
+  return client->subprocess;
+}
+
+gboolean
+casilda_client_get_connected (CasildaClient *client)
+{
+  g_return_val_if_fail (CASILDA_IS_CLIENT (client), FALSE);
+
+  return client->wl_client != NULL;
+}
+
+guint
+casilda_client_get_n_toplevels (CasildaClient *client)
+{
+  g_return_val_if_fail (CASILDA_IS_CLIENT (client), 0);
+
+  return g_list_model_get_n_items (G_LIST_MODEL (client->toplevels));
+}
+
+/*
+ * Mapped toplevels of the client, in mapping order.
+ */
+GListModel *
+casilda_client_get_toplevels (CasildaClient *client)
+{
+  g_return_val_if_fail (CASILDA_IS_CLIENT (client), NULL);
+
+  return G_LIST_MODEL (client->toplevels);
+}
+
+gboolean
+casilda_client_get_throttled (CasildaClient *client)
+{
+  g_return_val_if_fail (CASILDA_IS_CLIENT (client), FALSE);
+
+  return client->throttled;
+}
+
+/*
+ * Usage as of the last sample, rates are averaged over the sample interval.
+ */
+guint64
+casilda_client_get_usage (CasildaClient         *client,
+                          CasildaClientResource  resource)
+{
+  g_return_val_if_fail (CASILDA_IS_CLIENT (client), 0);
+  g_return_val_if_fail (resource < CASILDA_CLIENT_N_RESOURCES, 0);
+
+  return client->usage[resource];
+}
+
+/*
+ * Going over the soft limit throttles the client frame callbacks, going over
+ * the hard limit disconnects it. Use 0 for no limit.
+ */
+void
+casilda_client_set_limits (CasildaClient         *client,
+                           CasildaClientResource  resource,
+                           guint64                soft,
+                           guint64                hard)
+{
+  g_return_if_fail (CASILDA_IS_CLIENT (client));
+  g_return_if_fail (resource < CASILDA_CLIENT_N_RESOURCES);
+
+  client->soft_limit[resource] = soft;
+  client->hard_limit[resource] = hard;
+}
+
+/*
+ * Returns CASILDA_CLIENT_LATENCY_BUCKETS counters of input to photon
+ * latencies, see CASILDA_CLIENT_LATENCY_BUCKETS for the bucket ranges.
+ */
+const guint64 *
+casilda_client_get_latency_histogram (CasildaClient *client)
+{
+  g_return_val_if_fail (CASILDA_IS_CLIENT (client), NULL);
+
+  return client->latency;
+}
+
+void
+casilda_client_reset_latency_histogram (CasildaClient *client)
+{
+  g_return_if_fail (CASILDA_IS_CLIENT (client));
+
+  memset (client->latency, 0, sizeof (client->latency));
+}
+
+guint
+casilda_client_get_max_frame_rate (CasildaClient *client)
+{
+  g_return_val_if_fail (CASILDA_IS_CLIENT (client), 0);
+
+  return client->max_frame_rate;
+}
+
+/*
+ * Cap the frame callbacks of every toplevel of the client on top of the
+ * compositor policy, use 0 for no limit.
+ */
+void
+casilda_client_set_max_frame_rate (CasildaClient *client,
+                                   guint          frame_rate)
+{
+  g_return_if_fail (CASILDA_IS_CLIENT (client));
+
+  g_object_set (client, "max-frame-rate", frame_rate, NULL);
+}
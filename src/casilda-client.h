@@ -0,0 +1,69 @@
+/*
+ * Casilda Wayland Compositor Widget
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+typedef enum
+{
+  CASILDA_CLIENT_RESOURCE_SHM_BYTES,     /* Bytes of shared memory buffers */
+  CASILDA_CLIENT_RESOURCE_BUFFERS,       /* Live wl_buffer objects */
+  CASILDA_CLIENT_RESOURCE_SURFACES,      /* Live wl_surface objects */
+  CASILDA_CLIENT_RESOURCE_COMMIT_RATE,   /* Surface commits per second */
+  CASILDA_CLIENT_RESOURCE_DISPATCH_TIME, /* Microseconds per second spent in requests */
+  CASILDA_CLIENT_RESOURCE_RENDER_TIME,   /* Average microseconds from frame callback to commit */
+  CASILDA_CLIENT_RESOURCE_LATE_FRAMES,   /* Commits per second that missed their frame */
+
+  CASILDA_CLIENT_N_RESOURCES
+} CasildaClientResource;
+
+/* Bucket 0 counts latencies under 1ms, bucket N from 2^(N-1) to 2^N ms and
+ * the last one everything longer.
+ */
+#define CASILDA_CLIENT_LATENCY_BUCKETS 12
+
+#define CASILDA_CLIENT_TYPE (casilda_client_get_type ())
+G_DECLARE_FINAL_TYPE (CasildaClient, casilda_client, CASILDA, CLIENT, GObject)
+
+GSubprocess *casilda_client_get_subprocess  (CasildaClient         *client);
+gboolean     casilda_client_get_connected   (CasildaClient         *client);
+guint        casilda_client_get_n_toplevels (CasildaClient         *client);
+GListModel  *casilda_client_get_toplevels   (CasildaClient         *client);
+gboolean     casilda_client_get_throttled   (CasildaClient         *client);
+
+guint64      casilda_client_get_usage       (CasildaClient         *client,
+                                             CasildaClientResource  resource);
+void         casilda_client_set_limits      (CasildaClient         *client,
+                                             CasildaClientResource  resource,
+                                             guint64                soft,
+                                             guint64                hard);
+
+const guint64 *casilda_client_get_latency_histogram   (CasildaClient *client);
+void           casilda_client_reset_latency_histogram (CasildaClient *client);
+
+guint        casilda_client_get_max_frame_rate (CasildaClient *client);
+void         casilda_client_set_max_frame_rate (CasildaClient *client,
+                                                guint          frame_rate);
@@ -0,0 +1,634 @@
+/*
+ * Casilda Clipboard Integration
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define _GNU_SOURCE
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+#include <gio/gfiledescriptorbased.h>
+#include <gio/gunixinputstream.h>
+#include <gio/gunixoutputstream.h>
+
+#include <wlr/types/wlr_data_device.h>
+#include <wlr/types/wlr_seat.h>
+
+#include "casilda-clipboard.h"
+
+/* Max bytes moved per splice() call, data never goes through user space */
+#define CASILDA_CLIPBOARD_CHUNK_SIZE (64 * 1024)
+
+struct _CasildaClipboard
+{
+  struct wl_display *display;
+  struct wlr_seat   *seat;
+  GdkClipboard      *clipboard;
+  gulong             changed_id;
+
+  /* Host clipboard offered to clients */
+  struct _CasildaClipboardSource *source;
+};
+
+/* wlr_data_source backed by the GTK clipboard */
+typedef struct _CasildaClipboardSource
+{
+  struct wlr_data_source base;
+  CasildaClipboard      *clipboard;
+} CasildaClipboardSource;
+
+/* GdkContentProvider backed by a client data source */
+#define CASILDA_TYPE_CLIPBOARD_PROVIDER (casilda_clipboard_provider_get_type ())
+G_DECLARE_FINAL_TYPE (CasildaClipboardProvider, casilda_clipboard_provider, CASILDA, CLIPBOARD_PROVIDER, GdkContentProvider)
+
+struct _CasildaClipboardProvider
+{
+  GdkContentProvider      parent;
+
+  CasildaClipboard       *clipboard;
+  struct wlr_data_source *source;
+  struct wl_listener      source_destroy;
+};
+
+G_DEFINE_TYPE (CasildaClipboardProvider, casilda_clipboard_provider, GDK_TYPE_CONTENT_PROVIDER);
+
+/* Stream splicing */
+
+typedef struct
+{
+  GInputStream             *input;
+  GOutputStream            *output;
+  GOutputStreamSpliceFlags  flags;
+} CasildaClipboardSplice;
+
+static void
+casilda_clipboard_splice_free (CasildaClipboardSplice *splice)
+{
+  g_object_unref (splice->input);
+  g_object_unref (splice->output);
+  g_free (splice);
+}
+
+/* Wait for fd to be ready, returns FALSE if cancelled in the meantime */
+static gboolean
+casilda_clipboard_wait_fd (gint           fd,
+                           GIOCondition   condition,
+                           GCancellable  *cancellable,
+                           GError       **error)
+{
+  GPollFD poll_fds[2] = { { fd, condition, 0 }, };
+  gint n_fds = 1;
+
+  if (g_cancellable_make_pollfd (cancellable, &poll_fds[1]))
+    n_fds++;
+
+  while (g_poll (poll_fds, n_fds, -1) < 0 && errno == EINTR)
+    ;
+
+  if (n_fds > 1)
+    g_cancellable_release_fd (cancellable);
+
+  return !g_cancellable_set_error_if_cancelled (cancellable, error);
+}
+
+static gint
+casilda_clipboard_set_nonblocking (gint fd)
+{
+  gint flags = fcntl (fd, F_GETFL);
+
+  if (flags >= 0 && !(flags & O_NONBLOCK))
+    fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+
+  return flags;
+}
+
+static void
+casilda_clipboard_restore_flags (gint fd, gint flags)
+{
+  if (flags >= 0 && !(flags & O_NONBLOCK))
+    fcntl (fd, F_SETFL, flags);
+}
+
+static gboolean
+casilda_clipboard_splice_loop (gint           in_fd,
+                               gint           out_fd,
+                               GCancellable  *cancellable,
+                               GError       **error)
+{
+  while (TRUE)
+    {
+      gssize n;
+
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+
+      n = splice (in_fd, NULL, out_fd, NULL,
+                  CASILDA_CLIPBOARD_CHUNK_SIZE,
+                  SPLICE_F_MOVE | SPLICE_F_MORE);
+
+      if (n > 0)
+        continue;
+
+      if (n == 0)
+        return TRUE;
+
+      if (errno == EINTR)
+        continue;
+
+      if (errno == EAGAIN)
+        {
+          if (!casilda_clipboard_wait_fd (in_fd, G_IO_IN | G_IO_HUP, cancellable, error) ||
+              !casilda_clipboard_wait_fd (out_fd, G_IO_OUT, cancellable, error))
+            return FALSE;
+          continue;
+        }
+
+      g_set_error (error,
+                   G_IO_ERROR,
+                   g_io_error_from_errno (errno),
+                   "splice: %s",
+                   g_strerror (errno));
+      return FALSE;
+    }
+}
+
+/*
+ * Both ends are switched to non blocking for the duration of the copy so the
+ * thread only ever sleeps in poll(), where the cancellable can wake it up.
+ */
+static gboolean
+casilda_clipboard_splice_fds (gint           in_fd,
+                              gint           out_fd,
+                              GCancellable  *cancellable,
+                              GError       **error)
+{
+  gint in_flags = casilda_clipboard_set_nonblocking (in_fd);
+  gint out_flags = casilda_clipboard_set_nonblocking (out_fd);
+  gboolean retval;
+
+  retval = casilda_clipboard_splice_loop (in_fd, out_fd, cancellable, error);
+
+  casilda_clipboard_restore_flags (in_fd, in_flags);
+  casilda_clipboard_restore_flags (out_fd, out_flags);
+
+  return retval;
+}
+
+static void
+casilda_clipboard_splice_thread (GTask        *task,
+                                 gpointer      source_object G_GNUC_UNUSED,
+                                 gpointer      task_data,
+                                 GCancellable *cancellable)
+{
+  CasildaClipboardSplice *splice = task_data;
+  GError *error = NULL;
+  gboolean retval;
+
+  retval = casilda_clipboard_splice_fds (g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (splice->input)),
+                                         g_file_descriptor_based_get_fd (G_FILE_DESCRIPTOR_BASED (splice->output)),
+                                         cancellable,
+                                         &error);
+
+  /* Not a pipe on either end, fallback to a regular copy */
+  if (!retval && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT))
+    {
+      g_clear_error (&error);
+      retval = g_output_stream_splice (splice->output,
+                                       splice->input,
+                                       splice->flags,
+                                       cancellable,
+                                       &error) >= 0;
+      splice->flags = 0;
+    }
+
+  if (splice->flags & G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE)
+    g_input_stream_close (splice->input, NULL, NULL);
+
+  if (splice->flags & G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET)
+    g_output_stream_close (splice->output, NULL, NULL);
+
+  if (retval)
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+on_output_stream_splice (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  GError *error = NULL;
+
+  if (g_output_stream_splice_finish (G_OUTPUT_STREAM (source_object), result, &error) < 0)
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/*
+ * Copy input into output without ever holding the whole payload in memory.
+ * Pipes are moved with splice() in a worker thread, anything else is
+ * streamed in chunks in the main loop.
+ */
+static void
+casilda_clipboard_splice_async (GInputStream             *input,
+                                GOutputStream            *output,
+                                GOutputStreamSpliceFlags  flags,
+                                gint                      io_priority,
+                                GCancellable             *cancellable,
+                                GAsyncReadyCallback       callback,
+                                gpointer                  user_data)
+{
+  GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+
+  g_task_set_source_tag (task, casilda_clipboard_splice_async);
+  g_task_set_priority (task, io_priority);
+
+  if (G_IS_FILE_DESCRIPTOR_BASED (input) && G_IS_FILE_DESCRIPTOR_BASED (output))
+    {
+      CasildaClipboardSplice *splice = g_new0 (CasildaClipboardSplice, 1);
+
+      splice->input = g_object_ref (input);
+      splice->output = g_object_ref (output);
+      splice->flags = flags;
+
+      g_task_set_task_data (task, splice, (GDestroyNotify) casilda_clipboard_splice_free);
+      g_task_run_in_thread (task, casilda_clipboard_splice_thread);
+      g_object_unref (task);
+      return;
+    }
+
+  g_output_stream_splice_async (output,
+                                input,
+                                flags,
+                                io_priority,
+                                cancellable,
+                                on_output_stream_splice,
+                                task);
+}
+
+static gboolean
+casilda_clipboard_splice_finish (GAsyncResult  *result,
+                                 GError       **error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Client to host */
+
+static void
+on_provider_source_destroy (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaClipboardProvider *self = wl_container_of (listener, self, source_destroy);
+
+  wl_list_remove (&self->source_destroy.link);
+  wl_list_init (&self->source_destroy.link);
+  self->source = NULL;
+}
+
+static CasildaClipboardProvider *
+casilda_clipboard_provider_new (CasildaClipboard       *clipboard,
+                                struct wlr_data_source *source)
+{
+  CasildaClipboardProvider *self = g_object_new (CASILDA_TYPE_CLIPBOARD_PROVIDER, NULL);
+
+  self->clipboard = clipboard;
+  self->source = source;
+  self->source_destroy.notify = on_provider_source_destroy;
+  wl_signal_add (&source->events.destroy, &self->source_destroy);
+
+  return self;
+}
+
+static GdkContentFormats *
+casilda_clipboard_provider_ref_formats (GdkContentProvider *provider)
+{
+  CasildaClipboardProvider *self = CASILDA_CLIPBOARD_PROVIDER (provider);
+  GdkContentFormatsBuilder *builder = gdk_content_formats_builder_new ();
+  char **mime_type;
+
+  if (self->source)
+    {
+      wl_array_for_each (mime_type, &self->source->mime_types)
+        gdk_content_formats_builder_add_mime_type (builder, *mime_type);
+    }
+
+  return gdk_content_formats_builder_free_to_formats (builder);
+}
+
+static void
+on_provider_splice (G_GNUC_UNUSED GObject *source_object,
+                    GAsyncResult          *result,
+                    gpointer               user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  GError *error = NULL;
+
+  if (casilda_clipboard_splice_finish (result, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+casilda_clipboard_provider_write_mime_type_async (GdkContentProvider  *provider,
+                                                  const char          *mime_type,
+                                                  GOutputStream       *stream,
+                                                  int                  io_priority,
+                                                  GCancellable        *cancellable,
+                                                  GAsyncReadyCallback  callback,
+                                                  gpointer             user_data)
+{
+  CasildaClipboardProvider *self = CASILDA_CLIPBOARD_PROVIDER (provider);
+  g_autoptr(GInputStream) input = NULL;
+  GError *error = NULL;
+  GTask *task;
+  gint fds[2];
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, casilda_clipboard_provider_write_mime_type_async);
+
+  if (!self->source)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                               "Clipboard owner is gone");
+      g_object_unref (task);
+      return;
+    }
+
+  if (!g_unix_open_pipe (fds, FD_CLOEXEC, &error))
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  /* The client writes into the pipe, ownership of the write end is transferred */
+  wlr_data_source_send (self->source, mime_type, fds[1]);
+
+  input = g_unix_input_stream_new (fds[0], TRUE);
+  casilda_clipboard_splice_async (input,
+                                  stream,
+                                  G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE,
+                                  io_priority,
+                                  cancellable,
+                                  on_provider_splice,
+                                  task);
+}
+
+static gboolean
+casilda_clipboard_provider_write_mime_type_finish (G_GNUC_UNUSED GdkContentProvider *provider,
+                                                   GAsyncResult                     *result,
+                                                   GError                          **error)
+{
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+casilda_clipboard_provider_finalize (GObject *object)
+{
+  CasildaClipboardProvider *self = CASILDA_CLIPBOARD_PROVIDER (object);
+
+  if (self->source)
+    wl_list_remove (&self->source_destroy.link);
+
+  G_OBJECT_CLASS (casilda_clipboard_provider_parent_class)->finalize (object);
+}
+
+static void
+casilda_clipboard_provider_init (G_GNUC_UNUSED CasildaClipboardProvider *self)
+{
+}
+
+static void
+casilda_clipboard_provider_class_init (CasildaClipboardProviderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GdkContentProviderClass *provider_class = GDK_CONTENT_PROVIDER_CLASS (klass);
+
+  object_class->finalize = casilda_clipboard_provider_finalize;
+
+  provider_class->ref_formats = casilda_clipboard_provider_ref_formats;
+  provider_class->write_mime_type_async = casilda_clipboard_provider_write_mime_type_async;
+  provider_class->write_mime_type_finish = casilda_clipboard_provider_write_mime_type_finish;
+}
+
+/*
+ * Whether the host clipboard holds a selection from this bridge, other
+ * compositors in the same process have their own providers.
+ */
+static gboolean
+casilda_clipboard_owns_content (CasildaClipboard *self)
+{
+  GdkContentProvider *content = gdk_clipboard_get_content (self->clipboard);
+
+  return CASILDA_IS_CLIPBOARD_PROVIDER (content) &&
+         CASILDA_CLIPBOARD_PROVIDER (content)->clipboard == self;
+}
+
+/* Host to client */
+
+static void
+on_source_splice (G_GNUC_UNUSED GObject *source_object,
+                  GAsyncResult          *result,
+                  G_GNUC_UNUSED gpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+
+  if (!casilda_clipboard_splice_finish (result, &error))
+    g_debug ("Error sending clipboard data to client: %s", error->message);
+}
+
+static void
+on_clipboard_read (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  g_autoptr(GOutputStream) output = user_data;
+  g_autoptr(GInputStream) input = NULL;
+  g_autoptr(GError) error = NULL;
+
+  input = gdk_clipboard_read_finish (GDK_CLIPBOARD (source_object), result, NULL, &error);
+
+  if (!input)
+    {
+      g_debug ("Error reading clipboard: %s", error->message);
+      return;
+    }
+
+  casilda_clipboard_splice_async (input,
+                                  output,
+                                  G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                  G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                  G_PRIORITY_DEFAULT,
+                                  NULL,
+                                  on_source_splice,
+                                  NULL);
+}
+
+static void
+casilda_clipboard_source_send (struct wlr_data_source *wlr_source,
+                               const char             *mime_type,
+                               int32_t                 fd)
+{
+  CasildaClipboardSource *source = wl_container_of (wlr_source, source, base);
+
+  if (!source->clipboard)
+    {
+      close (fd);
+      return;
+    }
+
+  /* The output stream takes ownership of the fd */
+  gdk_clipboard_read_async (source->clipboard->clipboard,
+                            (const char *[]) { mime_type, NULL },
+                            G_PRIORITY_DEFAULT,
+                            NULL,
+                            on_clipboard_read,
+                            g_unix_output_stream_new (fd, TRUE));
+}
+
+static void
+casilda_clipboard_source_destroy (struct wlr_data_source *wlr_source)
+{
+  CasildaClipboardSource *source = wl_container_of (wlr_source, source, base);
+
+  if (source->clipboard && source->clipboard->source == source)
+    source->clipboard->source = NULL;
+
+  g_free (source);
+}
+
+static const struct wlr_data_source_impl casilda_clipboard_source_impl = {
+  .send = casilda_clipboard_source_send,
+  .destroy = casilda_clipboard_source_destroy,
+};
+
+static void
+on_clipboard_changed (GdkClipboard     *clipboard,
+                      CasildaClipboard *self)
+{
+  CasildaClipboardSource *source;
+  const char * const *mime_types;
+  gsize n_mime_types;
+
+  /* Selection owned by one of our clients */
+  if (casilda_clipboard_owns_content (self))
+    return;
+
+  mime_types = gdk_content_formats_get_mime_types (gdk_clipboard_get_formats (clipboard),
+                                                   &n_mime_types);
+
+  if (!n_mime_types)
+    {
+      if (self->source)
+        wlr_seat_set_selection (self->seat, NULL, wl_display_next_serial (self->display));
+      return;
+    }
+
+  source = g_new0 (CasildaClipboardSource, 1);
+  source->clipboard = self;
+  wlr_data_source_init (&source->base, &casilda_clipboard_source_impl);
+
+  /* Mime types are freed by wlr_data_source_destroy() */
+  for (gsize i = 0; i < n_mime_types; i++)
+    {
+      char **mime_type = wl_array_add (&source->base.mime_types, sizeof (char *));
+
+      if (mime_type)
+        *mime_type = g_strdup (mime_types[i]);
+    }
+
+  /* This destroys the previous source if any */
+  wlr_seat_set_selection (self->seat, &source->base, wl_display_next_serial (self->display));
+  self->source = source;
+}
+
+/* Public API */
+
+CasildaClipboard *
+casilda_clipboard_new (struct wl_display *display,
+                       struct wlr_seat   *seat,
+                       GdkClipboard      *clipboard)
+{
+  CasildaClipboard *self = g_new0 (CasildaClipboard, 1);
+
+  self->display = display;
+  self->seat = seat;
+  self->clipboard = g_object_ref (clipboard);
+  self->changed_id = g_signal_connect (clipboard, "changed",
+                                       G_CALLBACK (on_clipboard_changed),
+                                       self);
+
+  /* Offer whatever is already in the host clipboard */
+  on_clipboard_changed (clipboard, self);
+
+  return self;
+}
+
+void
+casilda_clipboard_free (CasildaClipboard *self)
+{
+  if (self == NULL)
+    return;
+
+  g_clear_signal_handler (&self->changed_id, self->clipboard);
+
+  /* Do not leave a dangling client source in the host clipboard */
+  if (casilda_clipboard_owns_content (self))
+    gdk_clipboard_set_content (self->clipboard, NULL);
+
+  if (self->source)
+    self->source->clipboard = NULL;
+
+  g_object_unref (self->clipboard);
+  g_free (self);
+}
+
+void
+casilda_clipboard_set_selection (CasildaClipboard       *self,
+                                 struct wlr_data_source *source,
+                                 uint32_t                serial)
+{
+  g_autoptr(CasildaClipboardProvider) provider = NULL;
+
+  wlr_seat_set_selection (self->seat, source, serial);
+
+  if (!source)
+    {
+      if (casilda_clipboard_owns_content (self))
+        gdk_clipboard_set_content (self->clipboard, NULL);
+      return;
+    }
+
+  /* Data is only transferred when someone in the host actually pastes */
+  provider = casilda_clipboard_provider_new (self, source);
+  gdk_clipboard_set_content (self->clipboard, GDK_CONTENT_PROVIDER (provider));
+}
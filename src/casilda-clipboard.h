@@ -0,0 +1,42 @@
+/*
+ * Casilda Clipboard Integration
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+#include <wayland-server-core.h>
+
+struct wlr_seat;
+struct wlr_data_source;
+
+typedef struct _CasildaClipboard CasildaClipboard;
+
+CasildaClipboard *casilda_clipboard_new           (struct wl_display      *display,
+                                                   struct wlr_seat        *seat,
+                                                   GdkClipboard           *clipboard);
+void              casilda_clipboard_free          (CasildaClipboard       *self);
+void              casilda_clipboard_set_selection (CasildaClipboard       *self,
+                                                   struct wlr_data_source *source,
+                                                   uint32_t                serial);
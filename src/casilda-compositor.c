@@ -27,17 +27,28 @@
 #define WLR_USE_UNSTABLE 1
 #define G_LOG_DOMAIN "Casilda"
 
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <linux/input-event-codes.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include <wayland-server-core.h>
+#include <xf86drm.h>
 #include <wlr/backend.h>
 #include <wlr/backend/interface.h>
+#include <wlr/config.h>
 #include <wlr/interfaces/wlr_keyboard.h>
 #include <wlr/interfaces/wlr_output.h>
 #include <wlr/interfaces/wlr_pointer.h>
 #include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
 #include <wlr/render/pixman.h>
+#include <wlr/render/swapchain.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_keyboard.h>
@@ -49,10 +60,19 @@
 #include <wlr/types/wlr_subcompositor.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/types/wlr_xdg_activation_v1.h>
+#include <wlr/types/wlr_xdg_decoration_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
 #include "xdg-shell-protocol.h"
 #include <xkbcommon/xkbcommon.h>
 
+#if WLR_HAS_GLES2_RENDERER
+#include <wlr/render/gles2.h>
+#endif
+
+#if WLR_HAS_VULKAN_RENDERER
+#include <wlr/render/vulkan.h>
+#endif
+
 #include <gtk/gtk.h>
 #include <glib/gstdio.h>
 
@@ -60,6 +80,10 @@
 #include <gdk/wayland/gdkwayland.h>
 #endif
 
+#ifdef HAVE_XWAYLAND
+#include <wlr/xwayland.h>
+#endif
+
 #if defined(GDK_WINDOWING_X11) && defined(HAVE_X11_XCB)
 #include <gdk/x11/gdkx.h>
 #include <X11/Xlib-xcb.h>
@@ -67,8 +91,37 @@
 #endif
 
 #include "casilda-compositor.h"
+#include "casilda-allocator.h"
+#include "casilda-canvas.h"
+#include "casilda-client-private.h"
+#include "casilda-clipboard.h"
+#include "casilda-frame-ring-private.h"
+#include "casilda-keymap-cache.h"
+#include "casilda-stats-private.h"
+#include "casilda-texture.h"
+#include "casilda-toplevel-private.h"
+#include "casilda-trace.h"
 #include "casilda-wayland-source.h"
 
+/* Throttled clients get a frame callback every this many frames */
+#define CASILDA_CLIENT_THROTTLE_FRAMES 4
+
+/* Default microseconds before the next frame client commits should land */
+#define CASILDA_FRAME_MARGIN 2000
+
+/* Default frame callbacks per second for toplevels nobody can see */
+#define CASILDA_OCCLUDED_FRAME_RATE 1
+
+/* Output buffers are allocated in multiples of this size */
+#define CASILDA_OUTPUT_SIZE_BUCKET 256
+
+/* Time without allocation changes after which the size is considered settled */
+#define CASILDA_RESIZE_SETTLE_MS 200
+
+/* Server side decoration title bar height and border width */
+#define CASILDA_DECORATION_TITLE_HEIGHT 24
+#define CASILDA_DECORATION_BORDER 4
+
 /* Auto free helpers */
 typedef struct wlr_texture      WlrTexture;
 typedef struct wlr_output_state WlrOutputState;
@@ -89,6 +142,13 @@ typedef struct
 {
   GtkWidget *widget;
 
+  /* Deferred initialization */
+  guint     init_source;
+  gboolean  initialized;
+  gboolean  ready;
+  GList    *ready_tasks;
+  GdkRGBA   bg_color;
+
   /* wayland main loop integration */
   GSource *wl_source;
 
@@ -105,15 +165,82 @@ typedef struct
   guint                           defered_present_event_source;
   struct wlr_output_event_present defered_present_event;
 
+  /* Output size state */
+  gint                            width, height;               /* Widget allocation */
+  gint                            output_width, output_height; /* Output mode */
+  gboolean                        output_size_pending;
+  guint                           resize_settle_source;
+
+  /* Last rendered output buffer */
+  GdkTexture                     *output_texture;
+  gboolean                        output_damaged;
+  uint32_t                        output_format;
+  GdkGLContext                   *gl_context; /* GPU renderers present GL textures */
+
+  /* View transform, output to widget coordinates */
+  gdouble                         zoom;
+  gdouble                         pan_x, pan_y;
+  GskScalingFilter                scaling_filter;
+
+  /* Virtual canvas larger than the widget, rendered in tiles */
+  CasildaCanvas                  *canvas;
+  gint                            canvas_width, canvas_height;
+  guint64                         tile_cache_size;
+
+  /* GtkScrollable */
+  GtkAdjustment                  *hadjustment, *vadjustment;
+  GtkScrollablePolicy             hscroll_policy, vscroll_policy;
+
   /* Wayland display */
   struct wl_display *wl_display;
 
   /* wlroots objects */
-  struct wlr_renderer     *renderer;
-  struct wlr_allocator    *allocator;
-  struct wlr_scene        *scene;
-  struct wlr_scene_output *scene_output;
-  struct wlr_scene_rect   *bg;
+  CasildaCompositorRenderer  renderer_type;
+  gint                       drm_fd;
+  struct wlr_renderer       *renderer;
+  struct wlr_allocator      *allocator;
+  struct wlr_compositor     *compositor;
+  struct wlr_scene          *scene;
+  struct wlr_scene_output   *scene_output;
+  struct wlr_scene_rect     *bg;
+
+  /* Subsurfaces presented with GtkGraphicsOffload */
+  GList *offloads;
+
+  /* Memory pressure */
+  GMemoryMonitor       *memory_monitor;
+  guint                 n_suspended;
+
+  /* Connected clients and their resource accounting */
+  GListStore           *clients;
+  CasildaClientTracker *client_tracker;
+  guint                 n_frames;
+
+  /* Performance statistics */
+  CasildaStats         *stats;
+
+  /* Frame callback scheduling */
+  guint                 frame_margin;
+  gint64                frame_deadline;
+  gint64                frame_done_pass;
+  guint                 frame_done_source;
+  gint64                throttle_due; /* Next frame throttled clients get callbacks */
+  gint64                frame_painted;
+
+  /* Frame callbacks per second by toplevel state, 0 for no limit */
+  guint                 focused_frame_rate;
+  guint                 unfocused_frame_rate;
+  guint                 occluded_frame_rate;
+
+  /* Input latencies over this many milliseconds are logged, 0 to disable */
+  guint                 latency_log_threshold;
+
+  /* Protocol trace recording */
+  gchar                *trace_file;
+  CasildaTrace         *trace;
+
+  /* Rendered frames exported to other processes */
+  CasildaFrameRing     *frame_ring;
 
   /* Custom wlr objects */
   struct wlr_keyboard keyboard;
@@ -130,11 +257,16 @@ typedef struct
   struct wl_listener    new_xdg_toplevel;
   struct wl_listener    new_xdg_popup;
   GList                *toplevels;
+  GListStore           *toplevel_model; /* Mapped CasildaToplevel handles */
 
   /* XDG activation */
   struct wlr_xdg_activation_v1 *xdg_activation;
   struct wl_listener            request_activate;
 
+  /* XDG decoration */
+  struct wlr_xdg_decoration_manager_v1 *decoration_manager;
+  struct wl_listener                    new_toplevel_decoration;
+
   GHashTable                   *toplevel_state;
 
   /* Toplevel resize state */
@@ -147,6 +279,7 @@ typedef struct
 
   /* Virtual Seat */
   struct wlr_seat   *seat;
+  GCancellable      *keymap_cancellable;
   struct wl_listener request_cursor;
   struct wl_listener request_set_selection;
 
@@ -159,9 +292,23 @@ typedef struct
   GdkTexture        *cursor_gdk_texture;
   GdkCursor         *cursor_gdk_cursor;
 
+  /* Selection <-> GdkClipboard bridge */
+  CasildaClipboard  *clipboard;
+
+  /* Xwayland, started on the first X11 connection */
+  gboolean                    xwayland_enabled;
+  guint                       xwayland_idle_timeout;
+#ifdef HAVE_XWAYLAND
+  struct wlr_xwayland_server *xwayland_server;
+  struct wlr_xwayland        *xwayland;
+  struct wl_listener          xwayland_ready;
+  struct wl_listener          xwayland_new_surface;
+#endif
+
   /* GObject properties */
   gchar       *socket;
   gboolean     owns_socket;
+  gint         listen_fd;
 } CasildaCompositorPrivate;
 
 
@@ -177,22 +324,54 @@ typedef struct
   gint     x, y, width, height;
 } CasildaCompositorToplevelState;
 
+/* Position to apply once the client commits the configure with this serial */
+typedef struct
+{
+  uint32_t serial;
+  gint     x, y;
+} CasildaCompositorToplevelConfigure;
+
 
 struct CasildaCompositorToplevel
 {
   CasildaCompositorPrivate      *priv;
   struct wlr_xdg_toplevel       *xdg_toplevel;
   struct wlr_scene_tree         *scene_tree;
+  CasildaToplevel               *handle;
 
   CasildaCompositorToplevelState old_state;
 
   /* This points to priv->toplevel_state[app_id] */
   CasildaCompositorToplevelState *state;
 
+  /* Interactive resize, only one configure is in flight at a time */
+  uint32_t                        resize_serial;
+  gboolean                        resize_pending;
+  struct wlr_box                  resize_box;
+  GArray                         *configures;
+
+  /* Suspended under memory pressure while not visible */
+  gboolean                        suspended;
+
+  /* Frame callback rate cap, the due time is computed once per frame */
+  guint                           frame;
+  gint64                          frame_due;
+  gint64                          frame_last;
+  gint64                          frame_seen; /* Last pass that found it in view */
+
+  /* Server side decoration, drawn below the surface tree */
+  struct wlr_xdg_toplevel_decoration_v1 *decoration;
+  struct wlr_scene_tree                 *decoration_tree;
+  struct wlr_scene_rect                 *decoration_frame;
+  struct wlr_scene_rect                 *decoration_title;
+  struct wl_listener                     decoration_request_mode;
+  struct wl_listener                     decoration_destroy;
+
   /* Events */
   struct wl_listener map;
   struct wl_listener unmap;
   struct wl_listener commit;
+  struct wl_listener ack_configure;
   struct wl_listener destroy;
   struct wl_listener request_move;
   struct wl_listener request_resize;
@@ -208,272 +387,1639 @@ typedef struct
   struct wl_listener    destroy;
 } CasildaCompositorPopup;
 
+#ifdef HAVE_XWAYLAND
+typedef struct
+{
+  CasildaCompositorPrivate    *priv;
+  struct wlr_xwayland_surface *xsurface;
+  struct wlr_scene_tree       *scene_tree;
+
+  /* Events */
+  struct wl_listener associate;
+  struct wl_listener dissociate;
+  struct wl_listener map;
+  struct wl_listener unmap;
+  struct wl_listener request_configure;
+  struct wl_listener set_geometry;
+  struct wl_listener destroy;
+} CasildaCompositorXSurface;
+#endif
+
+/* A subsurface promoted to an output layer and presented as its own texture */
+typedef struct
+{
+  CasildaCompositorPrivate *priv;
+  struct wlr_scene_buffer  *scene_buffer;
+  struct wlr_output_layer  *layer;
+  struct wlr_box            box;
+
+  GtkWidget                *offload;
+  GtkWidget                *picture;
+  GdkTexture               *texture;
+  gboolean                  dirty;
+  gboolean                  seen;
+
+  struct wl_listener        node_destroy;
+  struct wl_listener        surface_commit;
+} CasildaCompositorOffload;
+
 enum {
   PROP_0,
   PROP_SOCKET,
   PROP_BG_COLOR,
-
-  N_PROPERTIES
+  PROP_XWAYLAND,
+  PROP_XWAYLAND_IDLE_TIMEOUT,
+  PROP_X11_DISPLAY,
+  PROP_READY,
+  PROP_ZOOM,
+  PROP_PAN_X,
+  PROP_PAN_Y,
+  PROP_SCALING_FILTER,
+  PROP_CANVAS_WIDTH,
+  PROP_CANVAS_HEIGHT,
+  PROP_TILE_CACHE_SIZE,
+  PROP_FRAME_MARGIN,
+  PROP_FOCUSED_FRAME_RATE,
+  PROP_UNFOCUSED_FRAME_RATE,
+  PROP_OCCLUDED_FRAME_RATE,
+  PROP_LATENCY_LOG_THRESHOLD,
+  PROP_TRACE_FILE,
+  PROP_OUTPUT_FORMAT,
+  PROP_RENDERER,
+
+  N_PROPERTIES,
+
+  /* GtkScrollable */
+  PROP_HADJUSTMENT = N_PROPERTIES,
+  PROP_VADJUSTMENT,
+  PROP_HSCROLL_POLICY,
+  PROP_VSCROLL_POLICY,
 };
 
 static GParamSpec *properties[N_PROPERTIES];
 
-G_DEFINE_TYPE_WITH_PRIVATE (CasildaCompositor, casilda_compositor, GTK_TYPE_WIDGET);
+G_DEFINE_ENUM_TYPE (CasildaCompositorRenderer, casilda_compositor_renderer,
+                    G_DEFINE_ENUM_VALUE (CASILDA_COMPOSITOR_RENDERER_PIXMAN, "pixman"),
+                    G_DEFINE_ENUM_VALUE (CASILDA_COMPOSITOR_RENDERER_GLES2, "gles2"),
+                    G_DEFINE_ENUM_VALUE (CASILDA_COMPOSITOR_RENDERER_VULKAN, "vulkan"));
+
+G_DEFINE_TYPE_WITH_CODE (CasildaCompositor, casilda_compositor, GTK_TYPE_WIDGET,
+                         G_ADD_PRIVATE (CasildaCompositor)
+                         G_IMPLEMENT_INTERFACE (GTK_TYPE_SCROLLABLE, NULL));
 #define GET_PRIVATE(d) ((CasildaCompositorPrivate *) casilda_compositor_get_instance_private ((CasildaCompositor *) d))
 
 
 static void casilda_compositor_wlr_init (CasildaCompositorPrivate *priv);
+static gchar *casilda_compositor_get_socket (void);
+static gint casilda_compositor_listen (const gchar *path);
+static void casilda_compositor_trace_start (CasildaCompositorPrivate *priv);
 static void casilda_compositor_set_bg_color (CasildaCompositor *compositor,
                                              GdkRGBA           *bg);
+static gboolean casilda_compositor_resize_settled (gpointer user_data);
+static void casilda_compositor_input (struct wlr_surface *surface, gint64 time);
+#ifdef HAVE_XWAYLAND
+static void casilda_compositor_xwayland_finish (CasildaCompositorPrivate *priv);
+#endif
+
+/* Output layers offload */
 
-static cairo_format_t
-_cairo_format_from_pixman_format (pixman_format_code_t pixman_format)
+static CasildaCompositorOffload *
+casilda_compositor_offload_find (CasildaCompositorPrivate *priv,
+                                 struct wlr_scene_node    *node)
 {
-  switch (pixman_format)
+  for (GList *l = priv->offloads; l; l = g_list_next (l))
     {
-    case PIXMAN_rgba_float:
-      return CAIRO_FORMAT_RGBA128F;
+      CasildaCompositorOffload *offload = l->data;
 
-    case PIXMAN_rgb_float:
-      return CAIRO_FORMAT_RGB96F;
+      if (&offload->scene_buffer->node == node)
+        return offload;
+    }
 
-    case PIXMAN_a8r8g8b8:
-      return CAIRO_FORMAT_ARGB32;
+  return NULL;
+}
 
-    case PIXMAN_x2r10g10b10:
-      return CAIRO_FORMAT_RGB30;
+static void
+casilda_compositor_offload_free (CasildaCompositorOffload *offload)
+{
+  CasildaCompositorPrivate *priv = offload->priv;
 
-    case PIXMAN_x8r8g8b8:
-      return CAIRO_FORMAT_RGB24;
+  priv->offloads = g_list_remove (priv->offloads, offload);
 
-    case PIXMAN_a8:
-      return CAIRO_FORMAT_A8;
+  wl_list_remove (&offload->node_destroy.link);
+  wl_list_remove (&offload->surface_commit.link);
 
-    case PIXMAN_a1:
-      return CAIRO_FORMAT_A1;
+  /* Let the scene composite this buffer again */
+  if (offload->scene_buffer)
+    wlr_scene_node_set_enabled (&offload->scene_buffer->node, true);
 
-    case PIXMAN_r5g6b5:
-      return CAIRO_FORMAT_RGB16_565;
+  wlr_output_layer_destroy (offload->layer);
 
-    default:
-      return CAIRO_FORMAT_INVALID;
-    }
+  g_clear_pointer (&offload->offload, gtk_widget_unparent);
+  g_clear_object (&offload->texture);
 
-  return CAIRO_FORMAT_INVALID;
+  g_free (offload);
 }
 
 static void
-casilda_compositor_draw (GtkDrawingArea   *area G_GNUC_UNUSED,
-                         cairo_t          *cr,
-                         G_GNUC_UNUSED int width,
-                         G_GNUC_UNUSED int height,
-                         gpointer          user_data)
+on_offload_node_destroy (struct wl_listener *listener, G_GNUC_UNUSED void *data)
 {
-  CasildaCompositorPrivate *priv = GET_PRIVATE (user_data);
-  struct wlr_scene_output *scene_output = priv->scene_output;
+  CasildaCompositorOffload *offload = wl_container_of (listener, offload, node_destroy);
 
-  g_autoptr(WlrTexture) texture = NULL;
-  g_autoptr(cairo_surface_t) surface = NULL;
-  pixman_image_t *image = NULL;
-  cairo_format_t format;
-  struct timespec now;
-  g_auto(WlrOutputState) state = {0, };
+  offload->scene_buffer = NULL;
+  casilda_compositor_offload_free (offload);
+}
 
-  wlr_output_state_init (&state);
+static void
+on_offload_surface_commit (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorOffload *offload = wl_container_of (listener, offload, surface_commit);
 
-  if (!wlr_scene_output_build_state (scene_output, &state, NULL))
-    return;
+  /* The node is disabled in the scene so its commits do not add damage */
+  offload->dirty = TRUE;
+  wlr_output_schedule_frame (&offload->priv->output);
+}
 
-  if (!(texture = wlr_texture_from_buffer (priv->renderer, state.buffer)))
-    return;
+static CasildaCompositorOffload *
+casilda_compositor_offload_new (CasildaCompositorPrivate *priv,
+                                struct wlr_scene_buffer  *scene_buffer,
+                                struct wlr_surface       *surface)
+{
+  CasildaCompositorOffload *offload = g_new0 (CasildaCompositorOffload, 1);
 
-  if (!(image = wlr_pixman_texture_get_image (texture)))
-    return;
+  offload->priv = priv;
+  offload->scene_buffer = scene_buffer;
+  offload->dirty = TRUE;
 
-  format = _cairo_format_from_pixman_format (pixman_image_get_format (image));
+  offload->layer = wlr_output_layer_create (&priv->output);
+  offload->layer->data = offload;
 
-  if (format == CAIRO_FORMAT_INVALID)
-    return;
+  offload->picture = gtk_picture_new ();
+  gtk_picture_set_content_fit (GTK_PICTURE (offload->picture), GTK_CONTENT_FIT_FILL);
+  offload->offload = gtk_graphics_offload_new (offload->picture);
 
-  surface = cairo_image_surface_create_for_data ((gpointer) pixman_image_get_data (image),
-                                                 format,
-                                                 pixman_image_get_width (image),
-                                                 pixman_image_get_height (image),
-                                                 pixman_image_get_stride (image));
+  /* Input is still handled by the compositor */
+  gtk_widget_set_can_target (offload->offload, FALSE);
+  gtk_widget_set_parent (offload->offload, gtk_widget_get_parent (priv->widget));
 
-  /* Use buffer as source and blit */
-  cairo_set_source_surface (cr, surface, 0, 0);
-  cairo_paint (cr);
+  offload->node_destroy.notify = on_offload_node_destroy;
+  wl_signal_add (&scene_buffer->node.events.destroy, &offload->node_destroy);
+  offload->surface_commit.notify = on_offload_surface_commit;
+  wl_signal_add (&surface->events.commit, &offload->surface_commit);
 
-  /* TODO: try using a dmabuf
-   * https://docs.gtk.org/gdk4/method.DmabufTextureBuilder.set_update_region.html
-   */
+  priv->offloads = g_list_prepend (priv->offloads, offload);
 
-  wlr_output_commit_state (scene_output->output, &state);
+  return offload;
+}
 
-  clock_gettime (CLOCK_MONOTONIC, &now);
-  wlr_scene_output_send_frame_done (scene_output, &now);
+static gboolean
+casilda_compositor_offload_import (CasildaCompositorOffload *offload,
+                                   struct wlr_buffer        *buffer)
+{
+  g_autoptr(GError) error = NULL;
+  GdkTexture *texture;
+
+  if (offload->texture && !offload->dirty)
+    return TRUE;
+
+  if (!(texture = casilda_texture_import_dmabuf (gtk_widget_get_display (offload->priv->widget),
+                                                 buffer,
+                                                 NULL,
+                                                 NULL,
+                                                 &error)))
+    {
+      g_debug ("%s could not import dmabuf: %s", __func__, error->message);
+      return FALSE;
+    }
+
+  g_set_object (&offload->texture, texture);
+  g_object_unref (texture);
+  offload->dirty = FALSE;
+
+  return TRUE;
+}
+
+static gboolean
+casilda_compositor_offload_is_candidate (struct wlr_scene_buffer *scene_buffer,
+                                         struct wlr_box          *box)
+{
+  struct wlr_scene_surface *scene_surface;
+  struct wlr_buffer *buffer = scene_buffer->buffer;
+  struct wlr_dmabuf_attributes attribs;
+
+  if (!buffer || !(scene_surface = wlr_scene_surface_try_from_buffer (scene_buffer)))
+    return FALSE;
+
+  /* Only subsurfaces are offloaded, toplevels and popups are always composited */
+  if (!wlr_subsurface_try_from_wlr_surface (scene_surface->surface))
+    return FALSE;
+
+  if (!wlr_buffer_get_dmabuf (buffer, &attribs))
+    return FALSE;
+
+  /* GTK has to be able to show the buffer as is */
+  if (scene_buffer->transform != WL_OUTPUT_TRANSFORM_NORMAL ||
+      scene_buffer->opacity < 1.0f ||
+      !wlr_fbox_empty (&scene_buffer->src_box) ||
+      box->width != buffer->width ||
+      box->height != buffer->height)
+    return FALSE;
+
+  /* And it has to be opaque since there is nothing to blend with */
+  return pixman_region32_contains_rectangle (&scene_buffer->opaque_region,
+                                             &(pixman_box32_t) { 0, 0, buffer->width, buffer->height }) == PIXMAN_REGION_IN;
 }
 
+typedef struct
+{
+  struct wlr_scene_node *node;
+  struct wlr_box         box;
+} CasildaCompositorOffloadEntry;
+
 static void
-on_casilda_compositor_output_frame (struct wl_listener *listener,
-                                    G_GNUC_UNUSED void *data)
+casilda_compositor_offload_collect (CasildaCompositorPrivate *priv,
+                                    struct wlr_scene_node    *node,
+                                    gint                      lx,
+                                    gint                      ly,
+                                    GArray                   *entries)
 {
-  CasildaCompositorPrivate *priv = wl_container_of (listener, priv, on_frame);
-  struct wlr_scene_output *scene_output = priv->scene_output;
+  CasildaCompositorOffloadEntry entry = { node, { 0, } };
 
-  if (!scene_output->output->needs_frame && !pixman_region32_not_empty (
-        &scene_output->pending_commit_damage))
+  /* Offloaded nodes are disabled in the scene but still visible */
+  if (!node->enabled && !casilda_compositor_offload_find (priv, node))
+    return;
+
+  lx += node->x;
+  ly += node->y;
+
+  if (node->type == WLR_SCENE_NODE_TREE)
     {
-      if (priv->frame_clock_updating)
-        {
-          gdk_frame_clock_end_updating (priv->frame_clock);
-          priv->frame_clock_updating = FALSE;
-        }
+      struct wlr_scene_tree *tree = wlr_scene_tree_from_node (node);
+      struct wlr_scene_node *child;
+
+      wl_list_for_each (child, &tree->children, link)
+        casilda_compositor_offload_collect (priv, child, lx, ly, entries);
+
       return;
     }
 
-  if (!priv->frame_clock_updating)
+  entry.box.x = lx;
+  entry.box.y = ly;
+
+  if (node->type == WLR_SCENE_NODE_RECT)
     {
-      priv->frame_clock_updating = TRUE;
-      gdk_frame_clock_begin_updating (priv->frame_clock);
+      struct wlr_scene_rect *rect = wlr_scene_rect_from_node (node);
+
+      entry.box.width = rect->width;
+      entry.box.height = rect->height;
     }
+  else if (node->type == WLR_SCENE_NODE_BUFFER)
+    {
+      struct wlr_scene_buffer *scene_buffer = wlr_scene_buffer_from_node (node);
 
-  gtk_widget_queue_draw (priv->widget);
+      entry.box.width = scene_buffer->dst_width;
+      entry.box.height = scene_buffer->dst_height;
+
+      if (scene_buffer->buffer && !entry.box.width && !entry.box.height)
+        {
+          entry.box.width = scene_buffer->buffer->width;
+          entry.box.height = scene_buffer->buffer->height;
+        }
+    }
+
+  g_array_append_val (entries, entry);
 }
 
 static void
-casilda_compositor_size_allocate (GtkWidget *widget, int w, int h, int b)
+casilda_compositor_offload_update (CasildaCompositorPrivate *priv)
 {
-  CasildaCompositorPrivate *priv = GET_PRIVATE (widget);
-  struct wlr_output_state state;
+  g_autoptr(GArray) entries = g_array_new (FALSE, FALSE, sizeof (CasildaCompositorOffloadEntry));
+  g_autoptr(GArray) layers = NULL;
+  g_auto(WlrOutputState) state = {0, };
+  gboolean allocate = FALSE;
+  GList *l;
 
-  GTK_WIDGET_CLASS (casilda_compositor_parent_class)->size_allocate (widget, w, h, b);
-  gtk_widget_allocate (priv->widget, w, h, b, NULL);
+  casilda_compositor_offload_collect (priv, &priv->scene->tree.node, 0, 0, entries);
 
-  /* Update background rectangle size */
-  wlr_scene_rect_set_size (priv->bg, w, h);
+  for (l = priv->offloads; l; l = g_list_next (l))
+    ((CasildaCompositorOffload *) l->data)->seen = FALSE;
 
-  wlr_output_state_init (&state);
-  wlr_output_state_set_enabled (&state, true);
-  wlr_output_state_set_custom_mode (&state, w, h, 0);
-  wlr_output_commit_state (&priv->output, &state);
-  wlr_output_state_finish (&state);
-}
+  /* Entries are in rendering order, a candidate can not have anything on top */
+  for (guint i = 0; i < entries->len; i++)
+    {
+      CasildaCompositorOffloadEntry *entry = &g_array_index (entries, CasildaCompositorOffloadEntry, i);
+      struct wlr_scene_buffer *scene_buffer;
+      CasildaCompositorOffload *offload;
+      gboolean covered = FALSE;
 
-static void
-casilda_compositor_measure (GtkWidget      *widget,
-                            GtkOrientation  orientation,
-                            int             for_size,
-                            int            *minimum,
-                            int            *natural,
-                            int            *minimum_baseline,
-                            int            *natural_baseline)
-{
-  CasildaCompositorPrivate *priv = GET_PRIVATE (widget);
+      if (entry->node->type != WLR_SCENE_NODE_BUFFER)
+        continue;
 
-  gtk_widget_measure (priv->widget, orientation, for_size, minimum, natural,
-                      minimum_baseline, natural_baseline);
-}
+      scene_buffer = wlr_scene_buffer_from_node (entry->node);
 
-static void
-casilda_composite_cursor_handler_remove (CasildaCompositorPrivate *priv)
-{
-  if (priv->on_cursor_surface_commit.link.next)
+      if (!casilda_compositor_offload_is_candidate (scene_buffer, &entry->box))
+        continue;
+
+      for (guint j = i + 1; j < entries->len && !covered; j++)
+        {
+          struct wlr_box intersection;
+
+          covered = wlr_box_intersection (&intersection,
+                                          &entry->box,
+                                          &g_array_index (entries, CasildaCompositorOffloadEntry, j).box);
+        }
+
+      if (covered)
+        continue;
+
+      if (!(offload = casilda_compositor_offload_find (priv, entry->node)))
+        offload = casilda_compositor_offload_new (priv,
+                                                  scene_buffer,
+                                                  wlr_scene_surface_try_from_buffer (scene_buffer)->surface);
+      offload->seen = TRUE;
+
+      if (!wlr_box_equal (&offload->box, &entry->box))
+        {
+          offload->box = entry->box;
+          allocate = TRUE;
+        }
+    }
+
+  /* Drop offloads that are not candidates anymore */
+  for (l = priv->offloads; l;)
     {
-      wl_list_remove (&priv->on_cursor_surface_commit.link);
-      memset (&priv->on_cursor_surface_commit, 0, sizeof (struct wl_listener));
+      CasildaCompositorOffload *offload = l->data;
+
+      l = g_list_next (l);
+
+      if (!offload->seen)
+        casilda_compositor_offload_free (offload);
+    }
+
+  if (!priv->offloads)
+    return;
+
+  /* Let the output decide which layers it can actually present */
+  layers = g_array_new (FALSE, TRUE, sizeof (struct wlr_output_layer_state));
+  for (l = priv->offloads; l; l = g_list_next (l))
+    {
+      CasildaCompositorOffload *offload = l->data;
+      struct wlr_output_layer_state layer_state = {
+        .layer = offload->layer,
+        .buffer = offload->scene_buffer->buffer,
+        .src_box = { 0, 0, offload->box.width, offload->box.height },
+        .dst_box = offload->box,
+      };
+
+      g_array_append_val (layers, layer_state);
+    }
+
+  wlr_output_state_init (&state);
+  wlr_output_state_set_layers (&state,
+                               (struct wlr_output_layer_state *) layers->data,
+                               layers->len);
+  wlr_output_test_state (&priv->output, &state);
+
+  for (guint i = 0; i < layers->len; i++)
+    {
+      struct wlr_output_layer_state *layer_state =
+        &g_array_index (layers, struct wlr_output_layer_state, i);
+      CasildaCompositorOffload *offload = layer_state->layer->data;
+
+      if (!layer_state->accepted)
+        {
+          /* Fallback to regular compositing */
+          casilda_compositor_offload_free (offload);
+          allocate = TRUE;
+          continue;
+        }
+
+      if (offload->scene_buffer->node.enabled)
+        wlr_scene_node_set_enabled (&offload->scene_buffer->node, false);
+
+      gtk_picture_set_paintable (GTK_PICTURE (offload->picture), GDK_PAINTABLE (offload->texture));
     }
+
+  if (allocate)
+    gtk_widget_queue_allocate (gtk_widget_get_parent (priv->widget));
 }
 
-static void
-casilda_composite_reset_cursor (CasildaCompositorPrivate *priv)
+typedef struct
 {
-  if (priv->widget)
-    gtk_widget_set_cursor (priv->widget, NULL);
+  CasildaCompositorPrivate *priv;
+  struct timespec          *now;
+  gint64                    time;     /* Now, in monotonic microseconds */
+  gint64                    next_due; /* Earliest frame callback left for later */
+  gboolean                  occluded; /* Going through toplevels out of view */
+} CasildaCompositorFrameDone;
 
-  g_clear_object (&priv->cursor_gdk_cursor);
-  g_clear_object (&priv->cursor_gdk_texture);
-  g_clear_object (&priv->cursor_gdk_pixbuf);
+static CasildaCompositorToplevel *
+casilda_compositor_toplevel_from_node (struct wlr_scene_node *node)
+{
+  struct wlr_scene_tree *parent = node->parent;
 
-  casilda_composite_cursor_handler_remove (priv);
+  /* Only toplevel trees have data set */
+  while (parent && !parent->node.data)
+    parent = parent->node.parent;
+
+  return parent ? parent->node.data : NULL;
 }
 
-static void
-casilda_compositor_reset_pointer_mode (CasildaCompositorPrivate *priv)
+static gboolean casilda_compositor_toplevel_is_visible (CasildaCompositorToplevel *toplevel);
+
+static guint
+casilda_compositor_min_frame_rate (guint a, guint b)
 {
-  priv->pointer_mode = CASILDA_POINTER_MODE_FOWARD;
-  priv->grabbed_toplevel = NULL;
-}
+  if (!a || !b)
+    return MAX (a, b);
 
+  return MIN (a, b);
+}
 
-static CasildaCompositorToplevel *
-casilda_compositor_get_toplevel_at_pointer (CasildaCompositorPrivate *priv,
-                                            struct wlr_surface      **surface,
-                                            double                   *sx,
-                                            double                   *sy)
+/* Frame callbacks per second for the toplevel current state, 0 for no limit */
+static guint
+casilda_compositor_toplevel_get_frame_rate (CasildaCompositorToplevel *toplevel,
+                                            gboolean                   occluded)
 {
-  struct wlr_scene_node *node;
-  struct wlr_scene_buffer *scene_buffer;
-  struct wlr_scene_surface *scene_surface;
-  struct wlr_scene_tree *parent;
+  CasildaCompositorPrivate *priv = toplevel->priv;
+  CasildaClient *client = casilda_toplevel_get_client (toplevel->handle);
+  guint frame_rate;
 
-  if (surface)
-    *surface = NULL;
+  if (occluded || !casilda_compositor_toplevel_is_visible (toplevel))
+    frame_rate = priv->occluded_frame_rate;
+  else if (priv->seat->keyboard_state.focused_surface == toplevel->xdg_toplevel->base->surface)
+    frame_rate = priv->focused_frame_rate;
+  else
+    frame_rate = priv->unfocused_frame_rate;
 
-  node = wlr_scene_node_at (&priv->scene->tree.node,
-                            priv->pointer_x,
-                            priv->pointer_y,
-                            sx,
-                            sy);
+  frame_rate = casilda_compositor_min_frame_rate (frame_rate,
+                                                  casilda_toplevel_get_max_frame_rate (toplevel->handle));
 
-  if (!node || node->type != WLR_SCENE_NODE_BUFFER)
-    return NULL;
+  if (client)
+    frame_rate = casilda_compositor_min_frame_rate (frame_rate,
+                                                    casilda_client_get_max_frame_rate (client));
 
-  if (!(scene_buffer = wlr_scene_buffer_from_node (node)))
-    return NULL;
+  return frame_rate;
+}
 
-  if (!(scene_surface = wlr_scene_surface_try_from_buffer (scene_buffer)))
-    return NULL;
+/*
+ * Push due back to keep the toplevel under its frame rate, computed once per
+ * frame so all its surfaces get their callbacks together.
+ */
+static gint64
+casilda_compositor_toplevel_get_frame_due (CasildaCompositorToplevel *toplevel,
+                                           gint64                     due,
+                                           gboolean                   occluded)
+{
+  guint frame_rate;
 
-  if (surface)
-    *surface = scene_surface->surface;
+  if (toplevel->frame == toplevel->priv->n_frames)
+    return toplevel->frame_due;
 
-  parent = node->parent;
-  while (parent && !parent->node.data)
-    parent = parent->node.parent;
+  toplevel->frame = toplevel->priv->n_frames;
+  toplevel->frame_due = due;
 
-  return parent ? parent->node.data : NULL;
+  if ((frame_rate = casilda_compositor_toplevel_get_frame_rate (toplevel, occluded)))
+    toplevel->frame_due = MAX (due, toplevel->frame_last + G_USEC_PER_SEC / frame_rate);
+
+  return toplevel->frame_due;
 }
 
 static void
-casilda_compositor_toplevel_configure (CasildaCompositorToplevel *toplevel,
-                                       gint                       x,
-                                       gint                       y,
-                                       gint                       width,
-                                       gint                       height)
+casilda_compositor_buffer_frame_done (struct wlr_scene_buffer *buffer,
+                                      G_GNUC_UNUSED int        sx,
+                                      G_GNUC_UNUSED int        sy,
+                                      void                    *user_data)
 {
-  wlr_scene_node_set_position (&toplevel->scene_tree->node, x, y);
+  CasildaCompositorFrameDone *frame_done = user_data;
+  CasildaCompositorPrivate *priv = frame_done->priv;
+  struct wlr_scene_surface *scene_surface = wlr_scene_surface_try_from_buffer (buffer);
+  CasildaCompositorToplevel *toplevel;
+  CasildaClient *client;
+  gboolean waiting;
+  gint64 due = G_MININT64;
 
-  if (width && height)
+  if (!scene_surface ||
+      !(client = casilda_client_from_wl_client (wl_resource_get_client (scene_surface->surface->resource))))
     {
-      toplevel->xdg_toplevel->scheduled.width = width;
-      toplevel->xdg_toplevel->scheduled.height = height;
-      wlr_xdg_surface_schedule_configure (toplevel->xdg_toplevel->base);
+      wlr_scene_buffer_send_frame_done (buffer, frame_done->now);
+      return;
     }
-}
 
-static void
-casilda_compositor_toplevel_save_position (CasildaCompositorToplevel *toplevel)
-{
-  CasildaCompositorToplevelState *state = toplevel->state;
+  if (priv->frame_deadline)
+    due = casilda_client_get_frame_due (client,
+                                        priv->n_frames,
+                                        priv->frame_deadline - priv->frame_margin);
 
-  if (!state)
-    return;
+  /* Clients over a soft limit only get some of the frame callbacks */
+  if (casilda_client_get_throttled (client))
+    due = MAX (due, priv->throttle_due);
 
-  /* Get position from scene node */
-  state->x = toplevel->scene_tree->node.x;
-  state->y = toplevel->scene_tree->node.y;
+  if ((toplevel = casilda_compositor_toplevel_from_node (&buffer->node)))
+    {
+      if (!frame_done->occluded)
+        toplevel->frame_seen = frame_done->time;
+
+      due = casilda_compositor_toplevel_get_frame_due (toplevel, due, frame_done->occluded);
+    }
+  else if (!buffer->primary_output)
+    return; /* Fully occluded */
+
+  if (due > frame_done->time)
+    {
+      frame_done->next_due = MIN (frame_done->next_due, due);
+      return;
+    }
+
+  /* Already sent in an earlier pass */
+  if (priv->frame_done_pass && due <= priv->frame_done_pass)
+    return;
+
+  /* Render time and rate are only measured when the client is waiting for it */
+  waiting = !wl_list_empty (&scene_surface->surface->current.frame_callback_list);
+
+  if (waiting)
+    {
+      casilda_client_frame_sent (client, frame_done->time, priv->frame_deadline);
+      casilda_stats_add_time (priv->stats,
+                              CASILDA_STATS_FRAME_CALLBACK_LATENCY,
+                              frame_done->time - priv->frame_painted);
+    }
+
+  if (waiting && toplevel)
+    toplevel->frame_last = frame_done->time;
+
+  wlr_scene_buffer_send_frame_done (buffer, frame_done->now);
+}
+
+static gboolean
+casilda_compositor_has_canvas (CasildaCompositorPrivate *priv)
+{
+  return priv->canvas && priv->canvas_width > 0 && priv->canvas_height > 0;
+}
+
+/* Part of the canvas shown in the widget, in output coordinates */
+static void
+casilda_compositor_get_visible (CasildaCompositorPrivate *priv,
+                                graphene_rect_t          *visible)
+{
+  graphene_rect_t view = GRAPHENE_RECT_INIT (-priv->pan_x / priv->zoom,
+                                             -priv->pan_y / priv->zoom,
+                                             priv->width / priv->zoom,
+                                             priv->height / priv->zoom);
+
+  if (!graphene_rect_intersection (&view,
+                                   &GRAPHENE_RECT_INIT (0, 0, priv->canvas_width, priv->canvas_height),
+                                   visible))
+    graphene_rect_init (visible, 0, 0, 0, 0);
+}
+
+static void casilda_compositor_send_frame_done (CasildaCompositorPrivate *priv);
+
+/*
+ * Render the damaged parts of the output and keep the buffer as a texture,
+ * GTK scales and positions it at snapshot time.
+ */
+static void
+casilda_compositor_output_render (CasildaCompositorPrivate *priv)
+{
+  struct wlr_scene_output *scene_output = priv->scene_output;
+  g_autoptr(GError) error = NULL;
+  g_auto(WlrOutputState) state = {0, };
+  gint64 start;
+
+  priv->output_damaged = FALSE;
+
+  wlr_output_state_init (&state);
+
+  casilda_stats_add_damage (priv->stats, &scene_output->pending_commit_damage);
+
+  start = g_get_monotonic_time ();
+  if (!wlr_scene_output_build_state (scene_output, &state, NULL))
+    {
+      casilda_stats_add_frame (priv->stats, FALSE);
+      return;
+    }
+  casilda_stats_add_time (priv->stats, CASILDA_STATS_RENDER_TIME, g_get_monotonic_time () - start);
+  casilda_stats_add_frame (priv->stats, state.buffer != NULL);
+
+  if (state.buffer)
+    {
+      GdkTexture *texture;
+
+      start = g_get_monotonic_time ();
+      if (!priv->gl_context ||
+          !(texture = casilda_texture_import_gl (priv->gl_context,
+                                                 state.buffer,
+                                                 priv->output_texture,
+                                                 &scene_output->pending_commit_damage,
+                                                 NULL)))
+        texture = casilda_texture_import_buffer (gtk_widget_get_display (priv->widget),
+                                                 state.buffer,
+                                                 priv->output_texture,
+                                                 &scene_output->pending_commit_damage,
+                                                 &error);
+      casilda_stats_add_time (priv->stats, CASILDA_STATS_BLIT_TIME, g_get_monotonic_time () - start);
+
+      if (texture)
+        {
+          g_clear_object (&priv->output_texture);
+          priv->output_texture = texture;
+        }
+      else
+        g_warning ("Could not import output buffer: %s", error->message);
+
+      if (priv->frame_ring)
+        casilda_frame_ring_push (priv->frame_ring,
+                                 priv->renderer,
+                                 state.buffer,
+                                 &scene_output->pending_commit_damage);
+    }
+
+  wlr_output_commit_state (scene_output->output, &state);
+
+  casilda_compositor_send_frame_done (priv);
+}
+
+/* Next GTK frame clock cycle, 0 if unknown */
+static gint64
+casilda_compositor_get_frame_deadline (CasildaCompositorPrivate *priv)
+{
+  gint64 frame_time, refresh_interval = 0;
+
+  if (!priv->frame_clock)
+    return 0;
+
+  frame_time = gdk_frame_clock_get_frame_time (priv->frame_clock);
+  gdk_frame_clock_get_refresh_info (priv->frame_clock, frame_time, &refresh_interval, NULL);
+
+  return refresh_interval ? frame_time + refresh_interval : 0;
+}
+
+static gboolean on_frame_done_timeout (gpointer user_data);
+
+/*
+ * Throttled clients get callbacks every CASILDA_CLIENT_THROTTLE_FRAMES
+ * frames. The next one is estimated from the refresh interval, so they still
+ * get it if nothing else is rendered in the meantime.
+ */
+static gint64
+casilda_compositor_get_throttle_due (CasildaCompositorPrivate *priv)
+{
+  guint frames_left = (CASILDA_CLIENT_THROTTLE_FRAMES - priv->n_frames % CASILDA_CLIENT_THROTTLE_FRAMES) %
+                      CASILDA_CLIENT_THROTTLE_FRAMES;
+  gint64 now = g_get_monotonic_time ();
+  gint64 refresh_interval = 0;
+
+  if (!frames_left)
+    return now;
+
+  if (priv->frame_clock)
+    gdk_frame_clock_get_refresh_info (priv->frame_clock,
+                                      gdk_frame_clock_get_frame_time (priv->frame_clock),
+                                      &refresh_interval,
+                                      NULL);
+
+  if (!refresh_interval)
+    refresh_interval = G_USEC_PER_SEC / 60;
+
+  return now + frames_left * refresh_interval;
+}
+
+static void
+casilda_compositor_frame_done_pass (CasildaCompositorPrivate *priv)
+{
+  struct timespec now;
+  CasildaCompositorFrameDone frame_done = { priv, &now, g_get_monotonic_time (), G_MAXINT64 };
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  /* Only clients shown in a visible tile get a frame callback */
+  if (casilda_compositor_has_canvas (priv))
+    casilda_canvas_for_each_buffer (priv->canvas,
+                                    casilda_compositor_buffer_frame_done,
+                                    &frame_done);
+  else
+    wlr_scene_output_for_each_buffer (priv->scene_output,
+                                      casilda_compositor_buffer_frame_done,
+                                      &frame_done);
+
+  /* Offloaded buffers are disabled in the scene */
+  for (GList *l = priv->offloads; l; l = g_list_next (l))
+    {
+      CasildaCompositorOffload *offload = l->data;
+
+      casilda_compositor_buffer_frame_done (offload->scene_buffer, 0, 0, &frame_done);
+    }
+
+  /* Toplevels out of view are not in the output, they get the occluded rate */
+  frame_done.occluded = TRUE;
+  for (GList *l = priv->toplevels; l; l = g_list_next (l))
+    {
+      CasildaCompositorToplevel *toplevel = l->data;
+
+      if (toplevel->frame_seen != frame_done.time)
+        wlr_scene_node_for_each_buffer (&toplevel->scene_tree->node,
+                                        casilda_compositor_buffer_frame_done,
+                                        &frame_done);
+    }
+
+  priv->frame_done_pass = frame_done.time;
+
+  if (frame_done.next_due < G_MAXINT64)
+    priv->frame_done_source = g_timeout_add_full (G_PRIORITY_HIGH,
+                                                  (frame_done.next_due - frame_done.time + 999) / 1000,
+                                                  on_frame_done_timeout,
+                                                  priv,
+                                                  NULL);
+}
+
+static gboolean
+on_frame_done_timeout (gpointer user_data)
+{
+  CasildaCompositorPrivate *priv = user_data;
+
+  priv->frame_done_source = 0;
+  casilda_compositor_frame_done_pass (priv);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Frame callbacks are not sent right after painting, each client gets them
+ * its average render time plus frame-margin before the next frame clock
+ * cycle, so the commit lands just in time and shows the latest input.
+ */
+static void
+casilda_compositor_send_frame_done (CasildaCompositorPrivate *priv)
+{
+  gint64 presentation_time = 0;
+
+  /* Commits made so far are in this frame */
+  if (priv->frame_clock)
+    gdk_frame_clock_get_refresh_info (priv->frame_clock,
+                                      gdk_frame_clock_get_frame_time (priv->frame_clock),
+                                      NULL,
+                                      &presentation_time);
+
+  casilda_client_tracker_presented (priv->client_tracker,
+                                    presentation_time ? presentation_time : g_get_monotonic_time ());
+
+  priv->n_frames++;
+  priv->frame_painted = g_get_monotonic_time ();
+  priv->frame_deadline = casilda_compositor_get_frame_deadline (priv);
+  priv->throttle_due = casilda_compositor_get_throttle_due (priv);
+  priv->frame_done_pass = 0;
+
+  /* Anything still waiting is sent now or rescheduled for this frame */
+  g_clear_handle_id (&priv->frame_done_source, g_source_remove);
+  casilda_compositor_frame_done_pass (priv);
+}
+
+/* Memory pressure */
+
+static void
+casilda_compositor_buffer_is_visible (struct wlr_scene_buffer *buffer,
+                                      G_GNUC_UNUSED int        sx,
+                                      G_GNUC_UNUSED int        sy,
+                                      void                    *user_data)
+{
+  gboolean *visible = user_data;
+
+  if (buffer->primary_output)
+    *visible = TRUE;
+}
+
+static gboolean
+casilda_compositor_toplevel_is_visible (CasildaCompositorToplevel *toplevel)
+{
+  gboolean visible = FALSE;
+
+  wlr_scene_node_for_each_buffer (&toplevel->scene_tree->node,
+                                  casilda_compositor_buffer_is_visible,
+                                  &visible);
+  return visible;
+}
+
+static void
+casilda_compositor_toplevel_set_suspended (CasildaCompositorToplevel *toplevel,
+                                           gboolean                   suspended)
+{
+  if (toplevel->suspended == suspended)
+    return;
+
+  toplevel->suspended = suspended;
+
+  if (suspended)
+    toplevel->priv->n_suspended++;
+  else
+    toplevel->priv->n_suspended--;
+
+  wlr_xdg_toplevel_set_suspended (toplevel->xdg_toplevel, suspended);
+}
+
+static void
+casilda_compositor_resume_visible (CasildaCompositorPrivate *priv)
+{
+  if (!priv->n_suspended)
+    return;
+
+  for (GList *l = priv->toplevels; l; l = g_list_next (l))
+    {
+      CasildaCompositorToplevel *toplevel = l->data;
+
+      if (toplevel->suspended && casilda_compositor_toplevel_is_visible (toplevel))
+        casilda_compositor_toplevel_set_suspended (toplevel, FALSE);
+    }
+}
+
+static void
+casilda_compositor_trim_caches (CasildaCompositorPrivate *priv)
+{
+  guint n_offloads = 0, n_textures = 0, n_keymaps, n_tiles;
+
+  /* Offloaded textures are imported again on the next frame */
+  for (GList *l = priv->offloads; l; l = g_list_next (l))
+    {
+      CasildaCompositorOffload *offload = l->data;
+
+      if (!offload->texture)
+        continue;
+
+      g_clear_object (&offload->texture);
+      gtk_picture_set_paintable (GTK_PICTURE (offload->picture), NULL);
+      offload->dirty = TRUE;
+      n_offloads++;
+    }
+
+  if (n_offloads)
+    wlr_output_schedule_frame (&priv->output);
+
+  for (GList *l = priv->toplevels; l; l = g_list_next (l))
+    {
+      CasildaCompositorToplevel *toplevel = l->data;
+      n_textures += casilda_toplevel_trim (toplevel->handle);
+    }
+
+  /* The whole output is rendered again on the next snapshot */
+  if (priv->output_texture)
+    {
+      g_clear_object (&priv->output_texture);
+      wlr_output_update_needs_frame (&priv->output);
+      gtk_widget_queue_draw (priv->widget);
+      n_textures++;
+    }
+
+  n_keymaps = casilda_keymap_cache_trim ();
+
+  /* Hidden tiles are rendered again when scrolled into view */
+  n_tiles = casilda_canvas_trim (priv->canvas);
+
+  g_debug ("Memory pressure: dropped %u offload and %u other textures, %u cached keymaps and %u canvas tiles",
+           n_offloads, n_textures, n_keymaps, n_tiles);
+}
+
+/*
+ * Destroy the output swapchain along with its idle buffers, wlroots creates
+ * a new one for the next frame and only allocates the buffers it needs.
+ */
+static void
+casilda_compositor_trim_swapchain (CasildaCompositorPrivate *priv)
+{
+  if (!priv->output.swapchain)
+    return;
+
+  g_clear_pointer (&priv->output.swapchain, wlr_swapchain_destroy);
+
+  /* New swapchain buffers have no contents */
+  wlr_output_update_needs_frame (&priv->output);
+
+  g_debug ("Memory pressure: released the output swapchain");
+}
+
+static void
+casilda_compositor_trim_toplevel_state (CasildaCompositorPrivate *priv)
+{
+  g_autoptr(GHashTable) in_use = g_hash_table_new (g_str_hash, g_str_equal);
+  struct wlr_xdg_client *xdg_client;
+  struct wlr_xdg_surface *xdg_surface;
+  GHashTableIter iter;
+  const gchar *app_id;
+  guint n_states = 0;
+
+  /* Any live toplevel, mapped or not, might point to its app state */
+  wl_list_for_each (xdg_client, &priv->xdg_shell->clients, link)
+    {
+      wl_list_for_each (xdg_surface, &xdg_client->surfaces, link)
+        {
+          if (xdg_surface->role == WLR_XDG_SURFACE_ROLE_TOPLEVEL &&
+              xdg_surface->toplevel &&
+              xdg_surface->toplevel->app_id)
+            g_hash_table_add (in_use, xdg_surface->toplevel->app_id);
+        }
+    }
+
+  g_hash_table_iter_init (&iter, priv->toplevel_state);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &app_id, NULL))
+    {
+      if (g_hash_table_contains (in_use, app_id))
+        continue;
+
+      g_hash_table_iter_remove (&iter);
+      n_states++;
+    }
+
+  g_debug ("Memory pressure: released %u saved window states", n_states);
+}
+
+static void
+casilda_compositor_suspend_hidden (CasildaCompositorPrivate *priv)
+{
+  guint n_toplevels = 0;
+
+  for (GList *l = priv->toplevels; l; l = g_list_next (l))
+    {
+      CasildaCompositorToplevel *toplevel = l->data;
+
+      if (toplevel->suspended || casilda_compositor_toplevel_is_visible (toplevel))
+        continue;
+
+      casilda_compositor_toplevel_set_suspended (toplevel, TRUE);
+      n_toplevels++;
+    }
+
+  g_debug ("Memory pressure: suspended %u hidden toplevels", n_toplevels);
+}
+
+/*
+ * Each warning level adds a stage, the most drastic ones only run when the
+ * system is about to start killing processes.
+ */
+static void
+on_low_memory_warning (G_GNUC_UNUSED GMemoryMonitor *monitor,
+                       GMemoryMonitorWarningLevel    level,
+                       CasildaCompositorPrivate     *priv)
+{
+  if (!priv->initialized)
+    return;
+
+  g_debug ("Memory pressure: warning level %d", level);
+
+  casilda_compositor_trim_caches (priv);
+  casilda_compositor_trim_swapchain (priv);
+
+  if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_MEDIUM)
+    casilda_compositor_trim_toplevel_state (priv);
+
+  if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_CRITICAL)
+    casilda_compositor_suspend_hidden (priv);
+}
+
+static void
+on_casilda_compositor_output_frame (struct wl_listener *listener,
+                                    G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorPrivate *priv = wl_container_of (listener, priv, on_frame);
+  struct wlr_scene_output *scene_output = priv->scene_output;
+  gint64 start = g_get_monotonic_time ();
+  gboolean damaged;
+
+  /* Suspended toplevels uncovered since the last frame */
+  casilda_compositor_resume_visible (priv);
+
+  if (casilda_compositor_has_canvas (priv))
+    {
+      graphene_rect_t visible;
+
+      casilda_compositor_get_visible (priv, &visible);
+      damaged = casilda_canvas_get_damaged (priv->canvas, &visible);
+    }
+  else
+    damaged = scene_output->output->needs_frame ||
+              pixman_region32_not_empty (&scene_output->pending_commit_damage);
+
+  if (!damaged)
+    {
+      if (priv->frame_clock_updating)
+        {
+          gdk_frame_clock_end_updating (priv->frame_clock);
+          priv->frame_clock_updating = FALSE;
+        }
+      return;
+    }
+
+  if (!priv->frame_clock_updating)
+    {
+      priv->frame_clock_updating = TRUE;
+      gdk_frame_clock_begin_updating (priv->frame_clock);
+    }
+
+  /* Decide which subsurfaces skip compositing before layout and snapshot */
+  casilda_compositor_offload_update (priv);
+
+  casilda_stats_add_time (priv->stats, CASILDA_STATS_BUILD_TIME, g_get_monotonic_time () - start);
+
+  priv->output_damaged = TRUE;
+  gtk_widget_queue_draw (priv->widget);
+}
+
+static gint
+casilda_compositor_output_bucket (gint size)
+{
+  return MAX (1, (size + CASILDA_OUTPUT_SIZE_BUCKET - 1) / CASILDA_OUTPUT_SIZE_BUCKET) *
+         CASILDA_OUTPUT_SIZE_BUCKET;
+}
+
+static void
+casilda_compositor_output_set_size (CasildaCompositorPrivate *priv,
+                                    gint                      width,
+                                    gint                      height)
+{
+  g_auto(WlrOutputState) state = {0, };
+
+  if (priv->output_width == width && priv->output_height == height)
+    return;
+
+  g_debug ("%s %dx%d", __func__, width, height);
+
+  priv->output_width = width;
+  priv->output_height = height;
+
+  wlr_output_state_init (&state);
+  wlr_output_state_set_enabled (&state, true);
+  wlr_output_state_set_custom_mode (&state, width, height, 0);
+  wlr_output_state_set_render_format (&state, priv->output_format);
+  wlr_output_commit_state (&priv->output, &state);
+}
+
+/*
+ * Render straight into the layout GTK uploads as is, DRM_FORMAT_ARGB8888 is
+ * GDK_MEMORY_B8G8R8A8_PREMULTIPLIED in memory. With an opaque background
+ * nothing shows through, so the X variant lets GTK skip blending.
+ */
+static uint32_t
+casilda_compositor_output_pick_format (CasildaCompositorPrivate *priv)
+{
+  const struct wlr_drm_format_set *formats = wlr_renderer_get_render_formats (priv->renderer);
+
+  if (priv->bg_color.alpha >= 1.0 && wlr_drm_format_set_get (formats, DRM_FORMAT_XRGB8888))
+    return DRM_FORMAT_XRGB8888;
+
+  if (wlr_drm_format_set_get (formats, DRM_FORMAT_ARGB8888))
+    return DRM_FORMAT_ARGB8888;
+
+  /* wlroots default */
+  return DRM_FORMAT_XRGB8888;
+}
+
+static void
+casilda_compositor_output_update_format (CasildaCompositorPrivate *priv)
+{
+  g_auto(WlrOutputState) state = {0, };
+  uint32_t format = casilda_compositor_output_pick_format (priv);
+
+  if (priv->output_format == format)
+    return;
+
+  g_debug ("%s %.4s", __func__, (gchar *) &format);
+
+  priv->output_format = format;
+  casilda_canvas_set_render_format (priv->canvas, format);
+
+  /* A disabled output gets the format once it is sized */
+  if (priv->output.enabled)
+    {
+      wlr_output_state_init (&state);
+      wlr_output_state_set_render_format (&state, format);
+      wlr_output_commit_state (&priv->output, &state);
+
+      /* New swapchain buffers have no contents */
+      wlr_output_update_needs_frame (&priv->output);
+      g_clear_object (&priv->output_texture);
+      gtk_widget_queue_draw (priv->widget);
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (gtk_widget_get_parent (priv->widget)), properties[PROP_OUTPUT_FORMAT]);
+}
+
+static void
+casilda_compositor_output_update_size (CasildaCompositorPrivate *priv)
+{
+  priv->output_size_pending = FALSE;
+
+  /* Only grow while resizing, the output shrinks once the size settles */
+  if (priv->width <= priv->output_width && priv->height <= priv->output_height)
+    return;
+
+  casilda_compositor_output_set_size (priv,
+                                      casilda_compositor_output_bucket (MAX (priv->width, priv->output_width)),
+                                      casilda_compositor_output_bucket (MAX (priv->height, priv->output_height)));
+}
+
+static void
+casilda_compositor_update_bg (CasildaCompositorPrivate *priv)
+{
+  if (casilda_compositor_has_canvas (priv))
+    wlr_scene_rect_set_size (priv->bg, priv->canvas_width, priv->canvas_height);
+  else
+    wlr_scene_rect_set_size (priv->bg, priv->width, priv->height);
+}
+
+static void
+casilda_compositor_adjustment_configure (GtkAdjustment *adjustment,
+                                         gdouble        size,
+                                         gdouble        page_size,
+                                         gdouble        pan)
+{
+  if (!adjustment)
+    return;
+
+  size = MAX (size, page_size);
+  gtk_adjustment_configure (adjustment,
+                            CLAMP (-pan, 0, size - page_size),
+                            0,
+                            size,
+                            page_size * 0.1,
+                            page_size * 0.9,
+                            page_size);
+}
+
+/* Scrolling pans the view over the canvas, without one there is nothing to scroll */
+static void
+casilda_compositor_update_adjustments (CasildaCompositorPrivate *priv)
+{
+  gboolean canvas = priv->canvas_width > 0 && priv->canvas_height > 0;
+
+  casilda_compositor_adjustment_configure (priv->hadjustment,
+                                           (canvas ? priv->canvas_width : priv->width) * priv->zoom,
+                                           priv->width,
+                                           priv->pan_x);
+  casilda_compositor_adjustment_configure (priv->vadjustment,
+                                           (canvas ? priv->canvas_height : priv->height) * priv->zoom,
+                                           priv->height,
+                                           priv->pan_y);
+}
+
+static void
+casilda_compositor_size_allocate (GtkWidget *widget, int w, int h, int b)
+{
+  CasildaCompositorPrivate *priv = GET_PRIVATE (widget);
+
+  GTK_WIDGET_CLASS (casilda_compositor_parent_class)->size_allocate (widget, w, h, b);
+  gtk_widget_allocate (priv->widget, w, h, b, NULL);
+
+  /* Offloaded subsurfaces are stacked on top of the composited output */
+  for (GList *l = priv->offloads; l; l = g_list_next (l))
+    {
+      CasildaCompositorOffload *offload = l->data;
+
+      gtk_widget_measure (offload->offload, GTK_ORIENTATION_HORIZONTAL, -1,
+                          NULL, NULL, NULL, NULL);
+      gtk_widget_size_allocate (offload->offload,
+                                &(GtkAllocation) {
+                                  offload->box.x,
+                                  offload->box.y,
+                                  offload->box.width,
+                                  offload->box.height
+                                },
+                                -1);
+    }
+
+  if (priv->width == w && priv->height == h)
+    return;
+
+  priv->width = w;
+  priv->height = h;
+
+  casilda_compositor_update_adjustments (priv);
+
+  /* Size is applied once initialized */
+  if (!priv->initialized)
+    return;
+
+  /* Update background rectangle size */
+  casilda_compositor_update_bg (priv);
+
+  /* Coalesce mode changes to one per frame */
+  if (priv->frame_clock)
+    {
+      priv->output_size_pending = TRUE;
+      gdk_frame_clock_request_phase (priv->frame_clock, GDK_FRAME_CLOCK_PHASE_UPDATE);
+    }
+  else
+    casilda_compositor_output_update_size (priv);
+
+  g_clear_handle_id (&priv->resize_settle_source, g_source_remove);
+  priv->resize_settle_source = g_timeout_add (CASILDA_RESIZE_SETTLE_MS,
+                                              casilda_compositor_resize_settled,
+                                              priv);
+}
+
+static void
+casilda_compositor_snapshot (GtkWidget *widget, GtkSnapshot *snapshot)
+{
+  CasildaCompositorPrivate *priv = GET_PRIVATE (widget);
+  gint width = gtk_widget_get_width (widget);
+  gint height = gtk_widget_get_height (widget);
+
+  gtk_snapshot_append_color (snapshot, &priv->bg_color, &GRAPHENE_RECT_INIT (0, 0, width, height));
+
+  /* Nothing to show until the compositor is initialized */
+  if (!priv->scene_output)
+    return;
+
+  if (!casilda_compositor_has_canvas (priv) &&
+      (priv->output_damaged || !priv->output_texture))
+    casilda_compositor_output_render (priv);
+
+  /* Zoom and pan are a transform node, clients never render again for it */
+  gtk_snapshot_push_clip (snapshot, &GRAPHENE_RECT_INIT (0, 0, width, height));
+  gtk_snapshot_save (snapshot);
+  gtk_snapshot_translate (snapshot, &GRAPHENE_POINT_INIT (priv->pan_x, priv->pan_y));
+  gtk_snapshot_scale (snapshot, priv->zoom, priv->zoom);
+
+  if (casilda_compositor_has_canvas (priv))
+    {
+      graphene_rect_t visible;
+
+      casilda_compositor_get_visible (priv, &visible);
+
+      gtk_snapshot_push_clip (snapshot, &visible);
+      casilda_canvas_snapshot (priv->canvas, snapshot, &visible, priv->scaling_filter);
+      gtk_snapshot_pop (snapshot);
+
+      if (priv->output_damaged)
+        {
+          priv->output_damaged = FALSE;
+          casilda_stats_add_frame (priv->stats, TRUE);
+          casilda_compositor_send_frame_done (priv);
+        }
+    }
+  else if (priv->output_texture)
+    {
+      /* The output is allocated in size buckets, only its logical size is shown */
+      gtk_snapshot_push_clip (snapshot, &GRAPHENE_RECT_INIT (0, 0, priv->width, priv->height));
+      gtk_snapshot_append_scaled_texture (snapshot,
+                                          priv->output_texture,
+                                          priv->scaling_filter,
+                                          &GRAPHENE_RECT_INIT (0, 0,
+                                                               gdk_texture_get_width (priv->output_texture),
+                                                               gdk_texture_get_height (priv->output_texture)));
+      gtk_snapshot_pop (snapshot);
+    }
+
+  /* Offloaded subsurfaces are stacked on top of the composited output */
+  for (GList *l = priv->offloads; l; l = g_list_next (l))
+    {
+      CasildaCompositorOffload *offload = l->data;
+      gtk_widget_snapshot_child (widget, offload->offload, snapshot);
+    }
+
+  gtk_snapshot_restore (snapshot);
+  gtk_snapshot_pop (snapshot);
+}
+
+static void
+casilda_compositor_set_view (CasildaCompositorPrivate *priv,
+                             gdouble                   zoom,
+                             gdouble                   pan_x,
+                             gdouble                   pan_y)
+{
+  priv->zoom = zoom;
+  priv->pan_x = pan_x;
+  priv->pan_y = pan_y;
+
+  /* Might clamp the pan to the canvas, calling back with the new values */
+  casilda_compositor_update_adjustments (priv);
+
+  if (priv->widget)
+    gtk_widget_queue_draw (gtk_widget_get_parent (priv->widget));
+}
+
+static void
+on_adjustment_value_changed (GtkAdjustment            *adjustment,
+                             CasildaCompositorPrivate *priv)
+{
+  GObject *object = G_OBJECT (gtk_widget_get_parent (priv->widget));
+  gdouble value = gtk_adjustment_get_value (adjustment);
+
+  if (adjustment == priv->hadjustment)
+    {
+      casilda_compositor_set_view (priv, priv->zoom, -value, priv->pan_y);
+      g_object_notify_by_pspec (object, properties[PROP_PAN_X]);
+    }
+  else
+    {
+      casilda_compositor_set_view (priv, priv->zoom, priv->pan_x, -value);
+      g_object_notify_by_pspec (object, properties[PROP_PAN_Y]);
+    }
+}
+
+static void
+casilda_compositor_set_adjustment (CasildaCompositorPrivate  *priv,
+                                   GtkAdjustment            **adjustment,
+                                   GtkAdjustment             *value)
+{
+  if (*adjustment == value)
+    return;
+
+  if (*adjustment)
+    {
+      g_signal_handlers_disconnect_by_func (*adjustment, on_adjustment_value_changed, priv);
+      g_clear_object (adjustment);
+    }
+
+  if (value)
+    {
+      *adjustment = g_object_ref_sink (value);
+      g_signal_connect (value,
+                        "value-changed",
+                        G_CALLBACK (on_adjustment_value_changed),
+                        priv);
+    }
+
+  casilda_compositor_update_adjustments (priv);
+}
+
+static void
+casilda_compositor_set_canvas_size (CasildaCompositorPrivate *priv,
+                                    gint                      width,
+                                    gint                      height)
+{
+  priv->canvas_width = width;
+  priv->canvas_height = height;
+
+  /* The output texture is only used without a canvas */
+  g_clear_object (&priv->output_texture);
+  priv->output_damaged = TRUE;
+
+  if (priv->initialized)
+    casilda_compositor_update_bg (priv);
+
+  casilda_compositor_update_adjustments (priv);
+
+  if (priv->widget)
+    gtk_widget_queue_draw (gtk_widget_get_parent (priv->widget));
+}
+
+/* Widget to output coordinates */
+static void
+casilda_compositor_view_to_output (CasildaCompositorPrivate *priv,
+                                   gdouble                   x,
+                                   gdouble                   y,
+                                   gdouble                  *ox,
+                                   gdouble                  *oy)
+{
+  *ox = (x - priv->pan_x) / priv->zoom;
+  *oy = (y - priv->pan_y) / priv->zoom;
+}
+
+static void
+casilda_compositor_measure (GtkWidget      *widget,
+                            GtkOrientation  orientation,
+                            int             for_size,
+                            int            *minimum,
+                            int            *natural,
+                            int            *minimum_baseline,
+                            int            *natural_baseline)
+{
+  CasildaCompositorPrivate *priv = GET_PRIVATE (widget);
+
+  gtk_widget_measure (priv->widget, orientation, for_size, minimum, natural,
+                      minimum_baseline, natural_baseline);
+}
+
+static void
+casilda_composite_cursor_handler_remove (CasildaCompositorPrivate *priv)
+{
+  if (priv->on_cursor_surface_commit.link.next)
+    {
+      wl_list_remove (&priv->on_cursor_surface_commit.link);
+      memset (&priv->on_cursor_surface_commit, 0, sizeof (struct wl_listener));
+    }
+}
+
+static void
+casilda_composite_reset_cursor (CasildaCompositorPrivate *priv)
+{
+  if (priv->widget)
+    gtk_widget_set_cursor (priv->widget, NULL);
+
+  g_clear_object (&priv->cursor_gdk_cursor);
+  g_clear_object (&priv->cursor_gdk_texture);
+  g_clear_object (&priv->cursor_gdk_pixbuf);
+
+  casilda_composite_cursor_handler_remove (priv);
+}
+
+static void
+casilda_compositor_reset_pointer_mode (CasildaCompositorPrivate *priv)
+{
+  priv->pointer_mode = CASILDA_POINTER_MODE_FOWARD;
+  priv->grabbed_toplevel = NULL;
+}
+
+static void
+casilda_compositor_toplevel_begin_move (CasildaCompositorToplevel *toplevel)
+{
+  CasildaCompositorPrivate *priv = toplevel->priv;
+
+  priv->grabbed_toplevel = toplevel;
+  priv->pointer_mode = CASILDA_POINTER_MODE_MOVE;
+  priv->grab_x = priv->pointer_x - toplevel->scene_tree->node.x;
+  priv->grab_y = priv->pointer_y - toplevel->scene_tree->node.y;
+}
+
+static void
+casilda_compositor_toplevel_begin_resize (CasildaCompositorToplevel *toplevel,
+                                          uint32_t                   edges)
+{
+  CasildaCompositorPrivate *priv = toplevel->priv;
+  struct wlr_scene_tree *scene_tree = toplevel->scene_tree;
+  struct wlr_box box;
+  double border_x, border_y;
+
+  priv->grabbed_toplevel = toplevel;
+  priv->pointer_mode = CASILDA_POINTER_MODE_RESIZE;
+  priv->resize_edges = edges;
+
+  wlr_xdg_surface_get_geometry (toplevel->xdg_toplevel->base, &box);
+
+  border_x = scene_tree->node.x + box.x +
+             ((edges & WLR_EDGE_RIGHT) ? box.width : 0);
+  border_y = scene_tree->node.y + box.y +
+             ((edges & WLR_EDGE_BOTTOM) ? box.height : 0);
+  priv->grab_x = priv->pointer_x - border_x;
+  priv->grab_y = priv->pointer_y - border_y;
+
+  priv->grab_box = box;
+  priv->grab_box.x += scene_tree->node.x;
+  priv->grab_box.y += scene_tree->node.y;
+}
+
+
+static CasildaCompositorToplevel *
+casilda_compositor_get_toplevel_at_pointer (CasildaCompositorPrivate *priv,
+                                            struct wlr_surface      **surface,
+                                            double                   *sx,
+                                            double                   *sy)
+{
+  struct wlr_scene_node *node;
+  struct wlr_scene_buffer *scene_buffer;
+  struct wlr_scene_surface *scene_surface;
+
+  if (surface)
+    *surface = NULL;
+
+  node = wlr_scene_node_at (&priv->scene->tree.node,
+                            priv->pointer_x,
+                            priv->pointer_y,
+                            sx,
+                            sy);
+
+  /* Offloaded buffers are disabled in the scene but nothing is on top of them */
+  for (GList *l = priv->offloads; l; l = g_list_next (l))
+    {
+      CasildaCompositorOffload *offload = l->data;
+
+      if (wlr_box_contains_point (&offload->box, priv->pointer_x, priv->pointer_y))
+        {
+          node = &offload->scene_buffer->node;
+          *sx = priv->pointer_x - offload->box.x;
+          *sy = priv->pointer_y - offload->box.y;
+          break;
+        }
+    }
+
+  if (!node || node->type != WLR_SCENE_NODE_BUFFER)
+    return NULL;
+
+  if (!(scene_buffer = wlr_scene_buffer_from_node (node)))
+    return NULL;
+
+  if (!(scene_surface = wlr_scene_surface_try_from_buffer (scene_buffer)))
+    return NULL;
+
+  if (surface)
+    *surface = scene_surface->surface;
+
+  return casilda_compositor_toplevel_from_node (node);
+}
+
+/*
+ * Toplevel whose server side decoration is under the pointer, edges is set
+ * to the border edges under it or 0 for the title bar.
+ */
+static CasildaCompositorToplevel *
+casilda_compositor_get_decoration_at_pointer (CasildaCompositorPrivate *priv,
+                                              uint32_t                 *edges)
+{
+  CasildaCompositorToplevel *toplevel;
+  struct wlr_scene_node *node;
+  struct wlr_box box;
+  double sx, sy, x, y;
+
+  node = wlr_scene_node_at (&priv->scene->tree.node,
+                            priv->pointer_x,
+                            priv->pointer_y,
+                            &sx,
+                            &sy);
+
+  if (!node || node->type != WLR_SCENE_NODE_RECT)
+    return NULL;
+
+  if (!(toplevel = casilda_compositor_toplevel_from_node (node)) || !toplevel->decoration_tree)
+    return NULL;
+
+  *edges = 0;
+
+  if (node == &toplevel->decoration_title->node)
+    return toplevel;
+
+  if (node != &toplevel->decoration_frame->node)
+    return NULL;
+
+  /* Pointer relative to the window geometry */
+  wlr_xdg_surface_get_geometry (toplevel->xdg_toplevel->base, &box);
+  x = priv->pointer_x - toplevel->scene_tree->node.x - box.x;
+  y = priv->pointer_y - toplevel->scene_tree->node.y - box.y;
+
+  if (x < 0)
+    *edges |= WLR_EDGE_LEFT;
+  else if (x >= box.width)
+    *edges |= WLR_EDGE_RIGHT;
+
+  if (y < -CASILDA_DECORATION_TITLE_HEIGHT)
+    *edges |= WLR_EDGE_TOP;
+  else if (y >= box.height)
+    *edges |= WLR_EDGE_BOTTOM;
+
+  return toplevel;
+}
+
+static void
+casilda_compositor_toplevel_configure (CasildaCompositorToplevel *toplevel,
+                                       gint                       x,
+                                       gint                       y,
+                                       gint                       width,
+                                       gint                       height)
+{
+  wlr_scene_node_set_position (&toplevel->scene_tree->node, x, y);
+
+  if (width && height)
+    {
+      toplevel->xdg_toplevel->scheduled.width = width;
+      toplevel->xdg_toplevel->scheduled.height = height;
+      wlr_xdg_surface_schedule_configure (toplevel->xdg_toplevel->base);
+    }
+}
+
+static gboolean
+casilda_compositor_toplevel_is_decorated (CasildaCompositorToplevel *toplevel)
+{
+  return toplevel->decoration &&
+         toplevel->decoration->scheduled_mode == WLR_XDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE;
+}
+
+/*
+ * Size the window to fill the output, leaving room for the server side
+ * title bar and border so they are not drawn outside of it.
+ */
+static void
+casilda_compositor_toplevel_configure_fill (CasildaCompositorToplevel *toplevel,
+                                            gint                       width,
+                                            gint                       height)
+{
+  CasildaCompositorToplevelConfigure configure = { 0, };
+
+  if (casilda_compositor_toplevel_is_decorated (toplevel))
+    {
+      configure.x = CASILDA_DECORATION_BORDER;
+      configure.y = CASILDA_DECORATION_TITLE_HEIGHT + CASILDA_DECORATION_BORDER;
+
+      /* Zero lets the client pick its own size */
+      if (width)
+        width = MAX (width - CASILDA_DECORATION_BORDER * 2, 1);
+      if (height)
+        height = MAX (height - CASILDA_DECORATION_TITLE_HEIGHT - CASILDA_DECORATION_BORDER * 2, 1);
+    }
+
+  configure.serial = wlr_xdg_toplevel_set_size (toplevel->xdg_toplevel, width, height);
+
+  /* The position is applied when the client commits the new size */
+  g_array_append_val (toplevel->configures, configure);
+}
+
+static void
+casilda_compositor_toplevel_save_position (CasildaCompositorToplevel *toplevel)
+{
+  CasildaCompositorToplevelState *state = toplevel->state;
+
+  if (!state)
+    return;
+
+  /* Get position from scene node */
+  state->x = toplevel->scene_tree->node.x;
+  state->y = toplevel->scene_tree->node.y;
 
   g_debug ("%s %s %dx%d %dx%d maximized=%d fullscreen=%d",
            __func__,
@@ -555,10 +2101,9 @@ casilda_compositor_toplevel_toggle_maximize_fullscreen (CasildaCompositorTopleve
       toplevel->old_state.width = xdg_toplevel->current.width;
       toplevel->old_state.height = xdg_toplevel->current.height;
 
-      casilda_compositor_toplevel_configure (toplevel,
-                                             0, 0,
-                                             gtk_widget_get_width (widget),
-                                             gtk_widget_get_height (widget));
+      casilda_compositor_toplevel_configure_fill (toplevel,
+                                                  gtk_widget_get_width (widget),
+                                                  gtk_widget_get_height (widget));
     }
   else
     {
@@ -570,12 +2115,58 @@ casilda_compositor_toplevel_toggle_maximize_fullscreen (CasildaCompositorTopleve
     }
 }
 
+static gboolean
+casilda_compositor_resize_settled (gpointer user_data)
+{
+  CasildaCompositorPrivate *priv = user_data;
+
+  priv->resize_settle_source = 0;
+
+  /* Release the extra buffer space once the widget stops changing size */
+  casilda_compositor_output_set_size (priv,
+                                      casilda_compositor_output_bucket (priv->width),
+                                      casilda_compositor_output_bucket (priv->height));
+
+  for (GList *l = priv->toplevels; l; l = g_list_next (l))
+    {
+      CasildaCompositorToplevel *toplevel = l->data;
+      struct wlr_xdg_toplevel *xdg_toplevel = toplevel->xdg_toplevel;
+
+      if (!xdg_toplevel->scheduled.maximized && !xdg_toplevel->scheduled.fullscreen)
+        continue;
+
+      casilda_compositor_toplevel_configure_fill (toplevel, priv->width, priv->height);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+casilda_compositor_toplevel_send_resize (CasildaCompositorToplevel *toplevel)
+{
+  CasildaCompositorToplevelConfigure configure;
+  struct wlr_box *box = &toplevel->resize_box;
+
+  configure.serial = wlr_xdg_toplevel_set_size (toplevel->xdg_toplevel,
+                                                box->width,
+                                                box->height);
+  configure.x = box->x;
+  configure.y = box->y;
+
+  /* The position is applied when the client commits the new size */
+  g_array_append_val (toplevel->configures, configure);
+
+  toplevel->resize_serial = configure.serial;
+  toplevel->resize_pending = FALSE;
+
+  casilda_compositor_toplevel_save_size (toplevel, box->width, box->height);
+}
+
 static void
 casilda_compositor_handle_pointer_resize_toplevel (CasildaCompositorPrivate *priv)
 {
   CasildaCompositorToplevel *toplevel = priv->grabbed_toplevel;
   struct wlr_xdg_toplevel *xdg_toplevel = toplevel->xdg_toplevel;
-  struct wlr_box box;
   gint border_x = priv->pointer_x - priv->grab_x;
   gint border_y = priv->pointer_y - priv->grab_y;
   gint new_left = priv->grab_box.x;
@@ -633,19 +2224,13 @@ casilda_compositor_handle_pointer_resize_toplevel (CasildaCompositorPrivate *pri
       new_height = min_height;
     }
 
-  wlr_xdg_surface_get_geometry (toplevel->xdg_toplevel->base, &box);
-
-  wlr_xdg_toplevel_set_size (toplevel->xdg_toplevel, new_width, new_height);
-
-  /* FIXME: we probably need to wait for the new size to be in effect
-   * before setting the position
-   */
-  wlr_scene_node_set_position (&toplevel->scene_tree->node,
-                               new_left - box.x,
-                               new_top - box.y);
+  toplevel->resize_box = (struct wlr_box) { new_left, new_top, new_width, new_height };
 
-  casilda_compositor_toplevel_save_position (toplevel);
-  casilda_compositor_toplevel_save_size (toplevel, new_width, new_height);
+  /* Do not flood the client, the newest size is sent once it acks */
+  if (toplevel->resize_serial)
+    toplevel->resize_pending = TRUE;
+  else
+    casilda_compositor_toplevel_send_resize (toplevel);
 }
 
 static void
@@ -693,8 +2278,7 @@ on_motion_controller_enter (G_GNUC_UNUSED GtkEventControllerMotion *self,
                             gdouble                                 y,
                             CasildaCompositorPrivate               *priv)
 {
-  priv->pointer_x = x;
-  priv->pointer_y = y;
+  casilda_compositor_view_to_output (priv, x, y, &priv->pointer_x, &priv->pointer_y);
   casilda_compositor_handle_pointer_motion (priv);
   wlr_seat_pointer_notify_frame (priv->seat);
 }
@@ -712,9 +2296,19 @@ on_motion_controller_motion (G_GNUC_UNUSED GtkEventControllerMotion *self,
                              gdouble                                 y,
                              CasildaCompositorPrivate               *priv)
 {
-  /* Clamp pointer to widget coordinates */
-  priv->pointer_x = CLAMP (x, 0, gtk_widget_get_width (priv->widget));
-  priv->pointer_y = CLAMP (y, 0, gtk_widget_get_height (priv->widget));
+  casilda_compositor_view_to_output (priv, x, y, &x, &y);
+
+  /* Clamp pointer to output coordinates */
+  if (casilda_compositor_has_canvas (priv))
+    {
+      priv->pointer_x = CLAMP (x, 0, priv->canvas_width);
+      priv->pointer_y = CLAMP (y, 0, priv->canvas_height);
+    }
+  else
+    {
+      priv->pointer_x = CLAMP (x, 0, gtk_widget_get_width (priv->widget));
+      priv->pointer_y = CLAMP (y, 0, gtk_widget_get_height (priv->widget));
+    }
 
   casilda_compositor_handle_pointer_motion (priv);
   wlr_seat_pointer_notify_frame (priv->seat);
@@ -727,6 +2321,7 @@ on_scroll_controller_scroll (GtkEventControllerScroll *self,
                              CasildaCompositorPrivate *priv)
 {
   uint32_t time_msec = gtk_event_controller_get_current_event_time (GTK_EVENT_CONTROLLER (self));
+  gint64 input_time = g_get_monotonic_time ();
   gint idx, idy;
 
   idx = dx * WLR_POINTER_AXIS_DISCRETE_STEP;
@@ -755,10 +2350,56 @@ on_scroll_controller_scroll (GtkEventControllerScroll *self,
     }
 
   wlr_seat_pointer_notify_frame (priv->seat);
+  casilda_compositor_input (priv->seat->pointer_state.focused_surface, input_time);
 
   return TRUE;
 }
 
+static void
+casilda_compositor_deactivate_focused (CasildaCompositorPrivate *priv)
+{
+  struct wlr_surface *focused_surface = priv->seat->keyboard_state.focused_surface;
+  struct wlr_xdg_toplevel *focused_toplevel;
+
+  if (!focused_surface)
+    return;
+
+  if ((focused_toplevel = wlr_xdg_toplevel_try_from_wlr_surface (focused_surface)))
+    wlr_xdg_toplevel_set_activated (focused_toplevel, false);
+
+#ifdef HAVE_XWAYLAND
+  struct wlr_xwayland_surface *focused_xsurface;
+
+  if ((focused_xsurface = wlr_xwayland_surface_try_from_wlr_surface (focused_surface)))
+    wlr_xwayland_surface_activate (focused_xsurface, false);
+#endif
+}
+
+static void
+casilda_compositor_toplevel_buffer_frame_done (struct wlr_scene_buffer *buffer,
+                                               G_GNUC_UNUSED int        sx,
+                                               G_GNUC_UNUSED int        sy,
+                                               void                    *user_data)
+{
+  wlr_scene_buffer_send_frame_done (buffer, user_data);
+}
+
+static void
+casilda_compositor_toplevel_frame_done (CasildaCompositorToplevel *toplevel)
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+
+  wlr_scene_node_for_each_buffer (&toplevel->scene_tree->node,
+                                  casilda_compositor_toplevel_buffer_frame_done,
+                                  &now);
+
+  /* Due time is computed again with the new state */
+  toplevel->frame = 0;
+  toplevel->frame_last = g_get_monotonic_time ();
+}
+
 static void
 casilda_compositor_focus_toplevel (CasildaCompositorToplevel *toplevel,
                                    struct wlr_surface        *surface)
@@ -769,19 +2410,15 @@ casilda_compositor_focus_toplevel (CasildaCompositorToplevel *toplevel,
   if (focused_surface == surface)
     return;
 
-  if (focused_surface)
-    {
-      struct wlr_xdg_toplevel *focused_toplevel =
-        wlr_xdg_toplevel_try_from_wlr_surface (focused_surface);
-
-      if (focused_toplevel)
-        wlr_xdg_toplevel_set_activated (focused_toplevel, false);
-    }
+  casilda_compositor_deactivate_focused (priv);
 
   /* Move it to the front */
   wlr_scene_node_raise_to_top (&toplevel->scene_tree->node);
   wlr_xdg_toplevel_set_activated (toplevel->xdg_toplevel, true);
 
+  /* Callbacks held back by an unfocused frame rate are sent right away */
+  casilda_compositor_toplevel_frame_done (toplevel);
+
   priv->toplevels = g_list_remove (priv->toplevels, toplevel);
   priv->toplevels = g_list_prepend (priv->toplevels, toplevel);
 
@@ -792,15 +2429,54 @@ casilda_compositor_focus_toplevel (CasildaCompositorToplevel *toplevel,
                                   &priv->keyboard.modifiers);
 }
 
+#ifdef HAVE_XWAYLAND
+static void
+casilda_compositor_focus_xsurface (CasildaCompositorPrivate    *priv,
+                                   struct wlr_xwayland_surface *xsurface)
+{
+  CasildaCompositorXSurface *xs = xsurface->data;
+
+  if (priv->seat->keyboard_state.focused_surface == xsurface->surface ||
+      !wlr_xwayland_or_surface_wants_focus (xsurface))
+    return;
+
+  casilda_compositor_deactivate_focused (priv);
+
+  if (xs && xs->scene_tree)
+    wlr_scene_node_raise_to_top (&xs->scene_tree->node);
+
+  wlr_xwayland_surface_activate (xsurface, true);
+
+  wlr_seat_keyboard_notify_enter (priv->seat,
+                                  xsurface->surface,
+                                  priv->keyboard.keycodes,
+                                  priv->keyboard.num_keycodes,
+                                  &priv->keyboard.modifiers);
+}
+#endif
+
+/* Input time is taken as the event arrives, before forwarding it */
+static void
+casilda_compositor_input (struct wlr_surface *surface, gint64 time)
+{
+  CasildaClient *client;
+
+  if (surface &&
+      (client = casilda_client_from_wl_client (wl_resource_get_client (surface->resource))))
+    casilda_client_input (client, surface->resource, time);
+}
+
 static void
 casilda_compositor_seat_pointer_notify (GtkGestureClick             *self,
                                         CasildaCompositorPrivate    *priv,
                                         gint                         button,
                                         enum wl_pointer_button_state state)
 {
+  gint64 input_time = g_get_monotonic_time ();
   uint32_t time_msec, wl_button;
   struct wlr_surface *surface = NULL;
   CasildaCompositorToplevel *toplevel;
+  uint32_t edges;
   double sx, sy;
 
   button = gtk_gesture_single_get_current_button (GTK_GESTURE_SINGLE (self));
@@ -827,6 +2503,7 @@ casilda_compositor_seat_pointer_notify (GtkGestureClick             *self,
 
   wlr_seat_pointer_notify_button (priv->seat, time_msec, wl_button, state);
   wlr_seat_pointer_notify_frame (priv->seat);
+  casilda_compositor_input (priv->seat->pointer_state.focused_surface, input_time);
 
   toplevel = casilda_compositor_get_toplevel_at_pointer (priv, &surface, &sx, &sy);
 
@@ -834,6 +2511,22 @@ casilda_compositor_seat_pointer_notify (GtkGestureClick             *self,
     casilda_compositor_reset_pointer_mode (priv);
   else if (toplevel)
     casilda_compositor_focus_toplevel (toplevel, surface);
+  else if ((toplevel = casilda_compositor_get_decoration_at_pointer (priv, &edges)))
+    {
+      casilda_compositor_focus_toplevel (toplevel, toplevel->xdg_toplevel->base->surface);
+
+      if (wl_button != BTN_LEFT)
+        return;
+
+      if (edges)
+        casilda_compositor_toplevel_begin_resize (toplevel, edges);
+      else
+        casilda_compositor_toplevel_begin_move (toplevel);
+    }
+#ifdef HAVE_XWAYLAND
+  else if (surface && wlr_xwayland_surface_try_from_wlr_surface (surface))
+    casilda_compositor_focus_xsurface (priv, wlr_xwayland_surface_try_from_wlr_surface (surface));
+#endif
 }
 
 static void
@@ -869,8 +2562,10 @@ casilda_compositor_seat_key_notify (GtkEventControllerKey    *self,
                                     uint32_t                  state)
 {
   uint32_t time_msec = gtk_event_controller_get_current_event_time (GTK_EVENT_CONTROLLER (self));
+  gint64 input_time = g_get_monotonic_time ();
 
   wlr_seat_keyboard_notify_key (priv->seat, time_msec, key - 8, state);
+  casilda_compositor_input (priv->seat->keyboard_state.focused_surface, input_time);
 }
 
 static gboolean
@@ -937,33 +2632,57 @@ cursor_handle_surface_commit (struct wl_listener *listener, void *data)
   struct wlr_surface *surface = data;
   WlrTexture *texture = NULL;
   pixman_image_t *image = NULL;
-  gint height, stride;
+  gint width, height, stride;
+  guint8 *pixels;
 
   if (!(texture = wlr_surface_get_texture (surface)))
     return;
 
-  if (!(image = wlr_pixman_texture_get_image (texture)))
-    return;
-
   priv->hotspot_x -= surface->current.dx;
   priv->hotspot_y -= surface->current.dy;
 
-  if (pixman_image_get_format (image) != PIXMAN_a8r8g8b8)
+  if (wlr_texture_is_pixman (texture))
     {
-      casilda_composite_reset_cursor (priv);
-      return;
-    }
+      image = wlr_pixman_texture_get_image (texture);
+
+      if (pixman_image_get_format (image) != PIXMAN_a8r8g8b8)
+        {
+          casilda_composite_reset_cursor (priv);
+          return;
+        }
 
-  height = pixman_image_get_height (image);
-  stride = pixman_image_get_stride (image);
+      width = pixman_image_get_width (image);
+      height = pixman_image_get_height (image);
+      stride = pixman_image_get_stride (image);
+      pixels = g_memdup2 (pixman_image_get_data (image), height * stride);
+    }
+  else
+    {
+      /* GPU renderers read it back in the same layout as pixman */
+      width = texture->width;
+      height = texture->height;
+      stride = width * 4;
+      pixels = g_malloc (height * stride);
+
+      if (!wlr_texture_read_pixels (texture, &(struct wlr_texture_read_pixels_options) {
+                                      .data = pixels,
+                                      .format = DRM_FORMAT_ARGB8888,
+                                      .stride = stride,
+                                    }))
+        {
+          g_free (pixels);
+          casilda_composite_reset_cursor (priv);
+          return;
+        }
+    }
 
   /* Create a GdkPixbuf with a copy of surface data */
   if(!(priv->cursor_gdk_pixbuf = gdk_pixbuf_new_from_data (
-         g_memdup2 (pixman_image_get_data (image), height * stride),
+         pixels,
          GDK_COLORSPACE_RGB,
          TRUE,
          8,
-         pixman_image_get_width (image),
+         width,
          height,
          stride,
          _on_pixbuf_destroy_notify,
@@ -1039,7 +2758,16 @@ casilda_compositor_backend_get_buffer_caps (G_GNUC_UNUSED struct wlr_backend *wl
 {
   return WLR_BUFFER_CAP_DATA_PTR |
          WLR_BUFFER_CAP_SHM |
-         0;
+         WLR_BUFFER_CAP_DMABUF;
+}
+
+static int
+casilda_compositor_backend_get_drm_fd (struct wlr_backend *wlr_backend)
+{
+  CasildaCompositorPrivate *priv = wl_container_of (wlr_backend, priv, backend);
+
+  /* Lets the allocator hand out dmabufs to GPU renderers */
+  return priv->drm_fd;
 }
 
 static bool
@@ -1049,6 +2777,26 @@ casilda_compositor_output_commit (G_GNUC_UNUSED struct wlr_output             *w
   return true;
 }
 
+static bool
+casilda_compositor_output_test (G_GNUC_UNUSED struct wlr_output             *wlr_output,
+                                const struct wlr_output_state               *state)
+{
+  if (!(state->committed & WLR_OUTPUT_STATE_LAYERS))
+    return true;
+
+  /* Accept every layer GTK can import as a texture */
+  for (size_t i = 0; i < state->layers_len; i++)
+    {
+      struct wlr_output_layer_state *layer_state = &state->layers[i];
+      CasildaCompositorOffload *offload = layer_state->layer->data;
+
+      layer_state->accepted = offload && layer_state->buffer &&
+                              casilda_compositor_offload_import (offload, layer_state->buffer);
+    }
+
+  return true;
+}
+
 static void
 casilda_compositor_output_destroy (G_GNUC_UNUSED struct wlr_output *wlr_output)
 {
@@ -1061,6 +2809,7 @@ casilda_compositor_backend_init (CasildaCompositorPrivate *priv)
   priv->backend_impl.start = casilda_compositor_backend_start;
   priv->backend_impl.destroy = casilda_compositor_backend_destroy;
   priv->backend_impl.get_buffer_caps = casilda_compositor_backend_get_buffer_caps;
+  priv->backend_impl.get_drm_fd = casilda_compositor_backend_get_drm_fd;
   wlr_backend_init (&priv->backend, &priv->backend_impl);
 }
 
@@ -1073,6 +2822,7 @@ casilda_compositor_output_init (CasildaCompositorPrivate *priv)
 
   /* Initialize custom output iface */
   priv->output_impl.commit = casilda_compositor_output_commit;
+  priv->output_impl.test = casilda_compositor_output_test;
   priv->output_impl.destroy = casilda_compositor_output_destroy;
 
   /* Actual size will be set on size_allocate() */
@@ -1146,11 +2896,61 @@ casilda_pointer_mode_init (CasildaCompositorPrivate *priv)
   gtk_widget_add_controller (priv->widget, GTK_EVENT_CONTROLLER (priv->click_gesture));
 }
 
+static void
+casilda_compositor_keyboard_set_keymap (CasildaCompositorPrivate *priv,
+                                        CasildaKeymap            *keymap)
+{
+  GdkDevice *gkeyboard;
+  gint active_layout;
+
+  casilda_keymap_apply (keymap, &priv->keyboard);
+
+  gkeyboard = gdk_seat_get_keyboard (gdk_display_get_default_seat (gtk_widget_get_display (priv->widget)));
+
+  /* Update layout if present */
+  if (gkeyboard && (active_layout = gdk_device_get_active_layout_index (gkeyboard)) > 0)
+    {
+      wlr_keyboard_notify_modifiers (&priv->keyboard,
+                                     priv->keyboard.modifiers.depressed,
+                                     priv->keyboard.modifiers.latched,
+                                     priv->keyboard.modifiers.locked,
+                                     active_layout);
+    }
+}
+
+static void
+on_keymap_cache_compile (G_GNUC_UNUSED GObject *source_object,
+                         GAsyncResult          *result,
+                         gpointer               user_data)
+{
+  g_autoptr(CasildaKeymap) keymap = NULL;
+  g_autoptr(GError) error = NULL;
+
+  if (!(keymap = casilda_keymap_cache_compile_finish (result, &error)))
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_warning ("Error compiling keymap: %s", error->message);
+      return;
+    }
+
+  casilda_compositor_keyboard_set_keymap (user_data, keymap);
+}
+
+static gchar *
+casilda_compositor_keyboard_get_keymap_key (const gchar *backend,
+                                            GdkDevice   *gkeyboard)
+{
+  g_auto(GStrv) layouts = gdk_device_get_layout_names (gkeyboard);
+  g_autofree gchar *names = layouts ? g_strjoinv (",", layouts) : NULL;
+
+  return g_strdup_printf ("%s:%s", backend, names ? names : "");
+}
+
 static void
 casilda_compositor_keyboard_init (CasildaCompositorPrivate *priv)
 {
-  struct xkb_keymap *keymap = NULL;
-  struct xkb_state *state = NULL;
+  g_autoptr(CasildaKeymap) keymap = NULL;
+  g_autofree gchar *key = NULL;
   GdkDevice *gkeyboard;
   GdkDisplay *gdisplay;
   GdkSeat *gseat;
@@ -1164,71 +2964,49 @@ casilda_compositor_keyboard_init (CasildaCompositorPrivate *priv)
 #ifdef GDK_WINDOWING_WAYLAND
   if (GDK_IS_WAYLAND_DEVICE (gkeyboard))
     {
-      keymap = gdk_wayland_device_get_xkb_keymap (gkeyboard);
+      key = casilda_compositor_keyboard_get_keymap_key ("wayland", gkeyboard);
 
-      /* TODO: add a way to get keymap state from gtk wayland backend
-       * Or even better add a way to get the layout directly
-       */
-
-      xkb_keymap_ref (keymap);
+      /* Already compiled by GDK, we only need to cache the memfd */
+      if (!(keymap = casilda_keymap_cache_lookup (key)))
+        keymap = casilda_keymap_cache_insert (key, gdk_wayland_device_get_xkb_keymap (gkeyboard));
     }
 #endif
 
 #if defined(GDK_WINDOWING_X11) && defined(HAVE_X11_XCB)
   if (GDK_IS_X11_DEVICE_XI2 (gkeyboard))
     {
-      struct xkb_context *context = xkb_context_new (XKB_CONTEXT_NO_FLAGS);
-      Display *dpy = gdk_x11_display_get_xdisplay (GDK_X11_DISPLAY (gdisplay));
-
-      keymap = xkb_x11_keymap_new_from_device (context,
-                                               XGetXCBConnection (dpy),
-                                               gdk_x11_device_get_id (gkeyboard),
-                                               XKB_KEYMAP_COMPILE_NO_FLAGS);
-      state = xkb_x11_state_new_from_device (keymap,
-                                             XGetXCBConnection (dpy),
-                                             gdk_x11_device_get_id (gkeyboard));
-      xkb_context_unref (context);
-    }
-#endif
-
-  /* Fallback to US */
-  if (keymap == NULL)
-    {
-      struct xkb_context *context = xkb_context_new (XKB_CONTEXT_NO_FLAGS);
-      keymap = xkb_keymap_new_from_names (context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
-      xkb_context_unref (context);
-    }
-
-  /* Set keymap */
-  wlr_keyboard_set_keymap (&priv->keyboard, keymap);
-
-  /* Update layout if present */
-  if (state)
-    {
-      gint active_layout = -1;
-
-      for (guint i = 0; i < xkb_keymap_num_layouts (keymap); i++)
-        {
-          if (xkb_state_layout_index_is_active (state,
-                                                i,
-                                                XKB_STATE_LAYOUT_EFFECTIVE))
-            active_layout = i;
+      key = casilda_compositor_keyboard_get_keymap_key ("x11", gkeyboard);
 
-          g_debug ("\t %i %s", i, xkb_keymap_layout_get_name (keymap, i));
-        }
-
-      if (active_layout >= 0)
+      /* Only the first compositor pays for the XCB round-trips */
+      if (!(keymap = casilda_keymap_cache_lookup (key)))
         {
-          wlr_keyboard_notify_modifiers (&priv->keyboard,
-                                         priv->keyboard.modifiers.depressed,
-                                         priv->keyboard.modifiers.latched,
-                                         priv->keyboard.modifiers.locked,
-                                         active_layout);
+          struct xkb_context *context = xkb_context_new (XKB_CONTEXT_NO_FLAGS);
+          Display *dpy = gdk_x11_display_get_xdisplay (GDK_X11_DISPLAY (gdisplay));
+          struct xkb_keymap *x11_keymap;
+
+          x11_keymap = xkb_x11_keymap_new_from_device (context,
+                                                       XGetXCBConnection (dpy),
+                                                       gdk_x11_device_get_id (gkeyboard),
+                                                       XKB_KEYMAP_COMPILE_NO_FLAGS);
+          if (x11_keymap)
+            {
+              keymap = casilda_keymap_cache_insert (key, x11_keymap);
+              xkb_keymap_unref (x11_keymap);
+            }
+
+          xkb_context_unref (context);
         }
-      xkb_state_unref (state);
     }
+#endif
 
-  xkb_keymap_unref (keymap);
+  if (keymap)
+    casilda_compositor_keyboard_set_keymap (priv, keymap);
+  else
+    /* Fallback to US, compiled off the main thread */
+    casilda_keymap_cache_compile_async ("default",
+                                        priv->keymap_cancellable,
+                                        on_keymap_cache_compile,
+                                        priv);
 
   wlr_seat_set_keyboard (priv->seat, &priv->keyboard);
 
@@ -1246,14 +3024,159 @@ casilda_compositor_keyboard_init (CasildaCompositorPrivate *priv)
 }
 
 static void
-casilda_compositor_init (CasildaCompositor *)
+on_clients_items_changed (GListModel               *clients,
+                          G_GNUC_UNUSED guint       position,
+                          G_GNUC_UNUSED guint       removed,
+                          G_GNUC_UNUSED guint       added,
+                          CasildaCompositorPrivate *priv)
+{
+  casilda_stats_set_n_clients (priv->stats, g_list_model_get_n_items (clients));
+}
+
+static void
+casilda_compositor_init (CasildaCompositor *compositor)
+{
+  CasildaCompositorPrivate *priv = GET_PRIVATE (compositor);
+
+  priv->bg_color = (GdkRGBA) { 1, 1, 1, 1 };
+  priv->zoom = 1.0;
+  priv->scaling_filter = GSK_SCALING_FILTER_LINEAR;
+  priv->tile_cache_size = CASILDA_CANVAS_CACHE_SIZE;
+  priv->frame_margin = CASILDA_FRAME_MARGIN;
+  priv->occluded_frame_rate = CASILDA_OCCLUDED_FRAME_RATE;
+  priv->drm_fd = -1;
+  priv->listen_fd = -1;
+  priv->keymap_cancellable = g_cancellable_new ();
+  priv->clients = g_list_store_new (CASILDA_CLIENT_TYPE);
+  priv->stats = casilda_stats_new ();
+  g_signal_connect (priv->clients, "items-changed", G_CALLBACK (on_clients_items_changed), priv);
+  priv->toplevel_model = g_list_store_new (CASILDA_TOPLEVEL_TYPE);
+}
+
+/*
+ * GPU renderers output dmabufs, binding them to a texture in a context
+ * shared with GTK's renderer keeps frames in GPU memory all the way.
+ * Without GL they are handed to GTK as dmabuf textures instead.
+ */
+static void
+casilda_compositor_gl_init (CasildaCompositorPrivate *priv)
+{
+  g_autoptr(GdkGLContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+
+  if (priv->renderer_type == CASILDA_COMPOSITOR_RENDERER_PIXMAN)
+    return;
+
+  if (!(context = gdk_display_create_gl_context (gtk_widget_get_display (priv->widget), &error)) ||
+      !gdk_gl_context_realize (context, &error))
+    {
+      g_debug ("%s presenting dmabuf textures: %s", __func__, error->message);
+      return;
+    }
+
+  priv->gl_context = g_steal_pointer (&context);
+  casilda_canvas_set_gl_context (priv->canvas, priv->gl_context);
+}
+
+static void
+casilda_compositor_return_ready_tasks (CasildaCompositorPrivate *priv)
+{
+  GList *tasks = g_steal_pointer (&priv->ready_tasks);
+
+  for (GList *l = tasks; l; l = g_list_next (l))
+    {
+      GTask *task = l->data;
+
+      if (g_task_return_error_if_cancelled (task))
+        continue;
+
+      if (priv->ready)
+        g_task_return_boolean (task, TRUE);
+      else
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                 "Could not listen on %s", priv->socket);
+    }
+
+  g_list_free_full (tasks, g_object_unref);
+}
+
+static void
+casilda_compositor_initialize (CasildaCompositor *compositor)
+{
+  CasildaCompositorPrivate *priv = GET_PRIVATE (compositor);
+
+  if (priv->initialized)
+    return;
+
+  priv->initialized = TRUE;
+  g_clear_handle_id (&priv->init_source, g_source_remove);
+
+  casilda_compositor_backend_init (priv);
+  casilda_compositor_wlr_init (priv);
+  casilda_compositor_output_init (priv);
+  casilda_pointer_mode_init (priv);
+
+  priv->canvas = casilda_canvas_new (&priv->backend,
+                                     priv->wl_display,
+                                     priv->allocator,
+                                     priv->renderer,
+                                     priv->scene,
+                                     &priv->output,
+                                     gtk_widget_get_display (priv->widget),
+                                     priv->stats);
+  casilda_canvas_set_cache_size (priv->canvas, priv->tile_cache_size);
+  casilda_compositor_gl_init (priv);
+  casilda_compositor_keyboard_init (priv);
+
+  priv->clipboard = casilda_clipboard_new (priv->wl_display,
+                                           priv->seat,
+                                           gtk_widget_get_clipboard (priv->widget));
+
+  priv->memory_monitor = g_memory_monitor_dup_default ();
+  g_signal_connect (priv->memory_monitor,
+                    "low-memory-warning",
+                    G_CALLBACK (on_low_memory_warning),
+                    priv);
+
+  casilda_compositor_reset_pointer_mode (priv);
+  casilda_compositor_set_bg_color (compositor, &priv->bg_color);
+
+  priv->wl_source = casilda_wayland_source_new (priv->wl_display);
+  g_source_attach (priv->wl_source, NULL);
+
+  /* Start the backend. */
+  if (!wlr_backend_start (&priv->backend))
+    /* TODO: handle error */
+    g_warning("Could not start backend");
+
+  /* Apply allocation received before initialization */
+  casilda_compositor_update_bg (priv);
+
+  if (priv->width && priv->height)
+    casilda_compositor_output_update_size (priv);
+
+  gtk_widget_queue_draw (priv->widget);
+
+  g_object_notify_by_pspec (G_OBJECT (compositor), properties[PROP_READY]);
+  casilda_compositor_return_ready_tasks (priv);
+}
+
+static gboolean
+casilda_compositor_initialize_idle (gpointer user_data)
 {
+  CasildaCompositorPrivate *priv = GET_PRIVATE (user_data);
+
+  priv->init_source = 0;
+  casilda_compositor_initialize (user_data);
+
+  return G_SOURCE_REMOVE;
 }
 
 static void
 casilda_compositor_constructed (GObject *object)
 {
   CasildaCompositorPrivate *priv = GET_PRIVATE (object);
+  const gchar *renderer;
 
   priv->widget = gtk_drawing_area_new ();
   gtk_widget_set_parent (priv->widget, GTK_WIDGET (object));
@@ -1265,25 +3188,37 @@ casilda_compositor_constructed (GObject *object)
                                                 g_free,
                                                 g_free);
 
-  casilda_compositor_backend_init (priv);
-  casilda_compositor_wlr_init (priv);
-  casilda_compositor_output_init (priv);
-  casilda_pointer_mode_init (priv);
-  casilda_compositor_keyboard_init (priv);
+  /* Let test suites pick a renderer without changing the application */
+  if ((renderer = g_getenv ("CASILDA_RENDERER")))
+    {
+      g_autoptr(GEnumClass) klass = g_type_class_ref (CASILDA_COMPOSITOR_RENDERER_TYPE);
+      GEnumValue *value = g_enum_get_value_by_nick (klass, renderer);
 
-  casilda_compositor_reset_pointer_mode (priv);
+      if (value)
+        priv->renderer_type = value->value;
+      else
+        g_warning ("Unknown renderer %s in CASILDA_RENDERER", renderer);
+    }
 
-  gtk_drawing_area_set_draw_func (GTK_DRAWING_AREA (priv->widget),
-                                  casilda_compositor_draw,
-                                  object, NULL);
+  if (!priv->socket)
+    {
+      priv->socket = casilda_compositor_get_socket ();
+      priv->owns_socket = TRUE;
+    }
 
-  priv->wl_source = casilda_wayland_source_new (priv->wl_display);
-  g_source_attach (priv->wl_source, NULL);
+  /* Bound right away so clients can be started as soon as the widget exists,
+   * their connections wait in the backlog until the display is initialized
+   */
+  if ((priv->listen_fd = casilda_compositor_listen (priv->socket)) < 0)
+    g_warning ("Error binding socket file %s: %s", priv->socket, g_strerror (errno));
 
-  /* Start the backend. */
-  if (!wlr_backend_start (&priv->backend))
-    /* TODO: handle error */
-    g_warning("Could not start backend");
+  /* Defer the heavy lifting until after pending redraws, so the widget
+   * shows up right away
+   */
+  priv->init_source = g_idle_add_full (G_PRIORITY_LOW,
+                                       casilda_compositor_initialize_idle,
+                                       object,
+                                       NULL);
 
   G_OBJECT_CLASS (casilda_compositor_parent_class)->constructed (object);
 }
@@ -1294,6 +3229,16 @@ casilda_compositor_finalize (GObject *object)
   CasildaCompositorPrivate *priv = GET_PRIVATE (object);
 
   g_clear_pointer (&priv->toplevel_state, g_hash_table_destroy);
+  g_clear_handle_id (&priv->resize_settle_source, g_source_remove);
+  g_clear_handle_id (&priv->init_source, g_source_remove);
+  g_clear_handle_id (&priv->frame_done_source, g_source_remove);
+
+  g_cancellable_cancel (priv->keymap_cancellable);
+  g_clear_object (&priv->keymap_cancellable);
+
+  /* Never handed to the display */
+  if (priv->listen_fd >= 0)
+    close (priv->listen_fd);
 
   if (priv->owns_socket)
     {
@@ -1303,16 +3248,50 @@ casilda_compositor_finalize (GObject *object)
       g_rmdir (socket_path);
     }
   g_clear_pointer (&priv->socket, g_free);
+  g_clear_pointer (&priv->trace_file, g_free);
+  g_clear_pointer (&priv->frame_ring, casilda_frame_ring_free);
 
   g_clear_object (&priv->motion_controller);
   g_clear_object (&priv->scroll_controller);
   g_clear_object (&priv->key_controller);
   g_clear_object (&priv->click_gesture);
 
+  while (priv->offloads)
+    casilda_compositor_offload_free (priv->offloads->data);
+
+  g_clear_object (&priv->output_texture);
+  g_clear_object (&priv->gl_context);
+
+  casilda_compositor_set_adjustment (priv, &priv->hadjustment, NULL);
+  casilda_compositor_set_adjustment (priv, &priv->vadjustment, NULL);
+
+  g_signal_handlers_disconnect_by_data (priv->clients, priv);
+  g_clear_object (&priv->clients);
+
   priv->widget = NULL;
   casilda_composite_reset_cursor (priv);
 
+  if (!priv->initialized)
+    {
+      g_clear_object (&priv->toplevel_model);
+      g_clear_object (&priv->stats);
+      G_OBJECT_CLASS (casilda_compositor_parent_class)->finalize (object);
+      return;
+    }
+
+  g_clear_pointer (&priv->clipboard, casilda_clipboard_free);
+
+  g_signal_handlers_disconnect_by_data (priv->memory_monitor, priv);
+  g_clear_object (&priv->memory_monitor);
+
+#ifdef HAVE_XWAYLAND
+  casilda_compositor_xwayland_finish (priv);
+#endif
+
   wl_display_destroy_clients (priv->wl_display);
+  g_clear_pointer (&priv->trace, casilda_trace_free);
+  g_clear_pointer (&priv->client_tracker, casilda_client_tracker_free);
+  g_clear_pointer (&priv->canvas, casilda_canvas_free);
 
   wlr_keyboard_finish (&priv->keyboard);
   wlr_pointer_finish (&priv->pointer);
@@ -1322,8 +3301,15 @@ casilda_compositor_finalize (GObject *object)
   wlr_backend_destroy (&priv->backend);
   wl_display_destroy (priv->wl_display);
 
+  if (priv->drm_fd >= 0)
+    close (priv->drm_fd);
+
   g_source_destroy (priv->wl_source);
 
+  /* Toplevels are unmapped along with their clients */
+  g_clear_object (&priv->toplevel_model);
+  g_clear_object (&priv->stats);
+
   G_OBJECT_CLASS (casilda_compositor_parent_class)->finalize (object);
 }
 
@@ -1344,11 +3330,100 @@ casilda_compositor_set_property (GObject      *object,
       priv->owns_socket = priv->socket != NULL;
       break;
 
+    case PROP_RENDERER:
+      priv->renderer_type = g_value_get_enum (value);
+      break;
+
     case PROP_BG_COLOR:
         casilda_compositor_set_bg_color (CASILDA_COMPOSITOR (object),
                                          g_value_get_boxed (value));
         break;
 
+    case PROP_XWAYLAND:
+      priv->xwayland_enabled = g_value_get_boolean (value);
+      break;
+
+    case PROP_XWAYLAND_IDLE_TIMEOUT:
+      priv->xwayland_idle_timeout = g_value_get_uint (value);
+      break;
+
+    case PROP_ZOOM:
+      casilda_compositor_set_view (priv, g_value_get_double (value), priv->pan_x, priv->pan_y);
+      break;
+
+    case PROP_PAN_X:
+      casilda_compositor_set_view (priv, priv->zoom, g_value_get_double (value), priv->pan_y);
+      break;
+
+    case PROP_PAN_Y:
+      casilda_compositor_set_view (priv, priv->zoom, priv->pan_x, g_value_get_double (value));
+      break;
+
+    case PROP_SCALING_FILTER:
+      priv->scaling_filter = g_value_get_enum (value);
+      if (priv->widget)
+        gtk_widget_queue_draw (gtk_widget_get_parent (priv->widget));
+      break;
+
+    case PROP_CANVAS_WIDTH:
+      casilda_compositor_set_canvas_size (priv, g_value_get_int (value), priv->canvas_height);
+      break;
+
+    case PROP_CANVAS_HEIGHT:
+      casilda_compositor_set_canvas_size (priv, priv->canvas_width, g_value_get_int (value));
+      break;
+
+    case PROP_TILE_CACHE_SIZE:
+      priv->tile_cache_size = g_value_get_uint64 (value);
+      if (priv->canvas)
+        casilda_canvas_set_cache_size (priv->canvas, priv->tile_cache_size);
+      break;
+
+    case PROP_FRAME_MARGIN:
+      priv->frame_margin = g_value_get_uint (value);
+      break;
+
+    case PROP_FOCUSED_FRAME_RATE:
+      priv->focused_frame_rate = g_value_get_uint (value);
+      break;
+
+    case PROP_UNFOCUSED_FRAME_RATE:
+      priv->unfocused_frame_rate = g_value_get_uint (value);
+      break;
+
+    case PROP_OCCLUDED_FRAME_RATE:
+      priv->occluded_frame_rate = g_value_get_uint (value);
+      break;
+
+    case PROP_LATENCY_LOG_THRESHOLD:
+      priv->latency_log_threshold = g_value_get_uint (value);
+      if (priv->client_tracker)
+        casilda_client_tracker_set_latency_threshold (priv->client_tracker,
+                                                      priv->latency_log_threshold * G_TIME_SPAN_MILLISECOND);
+      break;
+
+    case PROP_TRACE_FILE:
+      g_free (priv->trace_file);
+      priv->trace_file = g_value_dup_string (value);
+      casilda_compositor_trace_start (priv);
+      break;
+
+    case PROP_HADJUSTMENT:
+      casilda_compositor_set_adjustment (priv, &priv->hadjustment, g_value_get_object (value));
+      break;
+
+    case PROP_VADJUSTMENT:
+      casilda_compositor_set_adjustment (priv, &priv->vadjustment, g_value_get_object (value));
+      break;
+
+    case PROP_HSCROLL_POLICY:
+      priv->hscroll_policy = g_value_get_enum (value);
+      break;
+
+    case PROP_VSCROLL_POLICY:
+      priv->vscroll_policy = g_value_get_enum (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1372,6 +3447,107 @@ casilda_compositor_get_property (GObject    *object,
       g_value_set_string (value, priv->socket);
       break;
 
+    case PROP_XWAYLAND:
+      g_value_set_boolean (value, priv->xwayland_enabled);
+      break;
+
+    case PROP_XWAYLAND_IDLE_TIMEOUT:
+      g_value_set_uint (value, priv->xwayland_idle_timeout);
+      break;
+
+    case PROP_READY:
+      g_value_set_boolean (value, priv->ready);
+      break;
+
+    case PROP_ZOOM:
+      g_value_set_double (value, priv->zoom);
+      break;
+
+    case PROP_PAN_X:
+      g_value_set_double (value, priv->pan_x);
+      break;
+
+    case PROP_PAN_Y:
+      g_value_set_double (value, priv->pan_y);
+      break;
+
+    case PROP_SCALING_FILTER:
+      g_value_set_enum (value, priv->scaling_filter);
+      break;
+
+    case PROP_CANVAS_WIDTH:
+      g_value_set_int (value, priv->canvas_width);
+      break;
+
+    case PROP_CANVAS_HEIGHT:
+      g_value_set_int (value, priv->canvas_height);
+      break;
+
+    case PROP_TILE_CACHE_SIZE:
+      g_value_set_uint64 (value, priv->tile_cache_size);
+      break;
+
+    case PROP_FRAME_MARGIN:
+      g_value_set_uint (value, priv->frame_margin);
+      break;
+
+    case PROP_FOCUSED_FRAME_RATE:
+      g_value_set_uint (value, priv->focused_frame_rate);
+      break;
+
+    case PROP_UNFOCUSED_FRAME_RATE:
+      g_value_set_uint (value, priv->unfocused_frame_rate);
+      break;
+
+    case PROP_OCCLUDED_FRAME_RATE:
+      g_value_set_uint (value, priv->occluded_frame_rate);
+      break;
+
+    case PROP_LATENCY_LOG_THRESHOLD:
+      g_value_set_uint (value, priv->latency_log_threshold);
+      break;
+
+    case PROP_TRACE_FILE:
+      g_value_set_string (value, priv->trace_file);
+      break;
+
+    case PROP_OUTPUT_FORMAT:
+      {
+        GdkMemoryFormat format = GDK_MEMORY_B8G8R8A8_PREMULTIPLIED;
+
+        casilda_texture_get_memory_format (priv->output_format, &format);
+        g_value_set_enum (value, format);
+      }
+      break;
+
+    case PROP_RENDERER:
+      g_value_set_enum (value, priv->renderer_type);
+      break;
+
+    case PROP_HADJUSTMENT:
+      g_value_set_object (value, priv->hadjustment);
+      break;
+
+    case PROP_VADJUSTMENT:
+      g_value_set_object (value, priv->vadjustment);
+      break;
+
+    case PROP_HSCROLL_POLICY:
+      g_value_set_enum (value, priv->hscroll_policy);
+      break;
+
+    case PROP_VSCROLL_POLICY:
+      g_value_set_enum (value, priv->vscroll_policy);
+      break;
+
+    case PROP_X11_DISPLAY:
+#ifdef HAVE_XWAYLAND
+      g_value_set_string (value, priv->xwayland ? priv->xwayland->display_name : NULL);
+#else
+      g_value_set_string (value, NULL);
+#endif
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -1382,6 +3558,12 @@ static void
 on_casilda_compositor_frame_clock_update (G_GNUC_UNUSED GdkFrameClock *self,
                                           CasildaCompositorPrivate    *priv)
 {
+  if (!priv->initialized)
+    return;
+
+  if (priv->output_size_pending)
+    casilda_compositor_output_update_size (priv);
+
   wlr_output_send_frame (&priv->output);
 }
 
@@ -1410,6 +3592,17 @@ casilda_compositor_unrealize (GtkWidget *widget)
       priv->frame_clock_source = 0;
     }
 
+  /* Mode changes can not wait for the frame clock anymore */
+  if (priv->output_size_pending)
+    casilda_compositor_output_update_size (priv);
+
+  if (priv->frame_clock_updating)
+    {
+      gdk_frame_clock_end_updating (priv->frame_clock);
+      priv->frame_clock_updating = FALSE;
+    }
+  priv->frame_clock = NULL;
+
   GTK_WIDGET_CLASS (casilda_compositor_parent_class)->unrealize (widget);
 }
 
@@ -1426,6 +3619,7 @@ casilda_compositor_class_init (CasildaCompositorClass *klass)
 
   widget_class->measure = casilda_compositor_measure;
   widget_class->size_allocate = casilda_compositor_size_allocate;
+  widget_class->snapshot = casilda_compositor_snapshot;
   widget_class->realize = casilda_compositor_realize;
   widget_class->unrealize = casilda_compositor_unrealize;
 
@@ -1442,14 +3636,411 @@ casilda_compositor_class_init (CasildaCompositorClass *klass)
                         GDK_TYPE_RGBA,
                         G_PARAM_WRITABLE);
 
+  properties[PROP_XWAYLAND] =
+    g_param_spec_boolean ("xwayland", "Xwayland",
+                          "Whether to accept X11 clients through Xwayland",
+                          FALSE,
+                          G_PARAM_READABLE|G_PARAM_WRITABLE|G_PARAM_CONSTRUCT_ONLY);
+
+  properties[PROP_XWAYLAND_IDLE_TIMEOUT] =
+    g_param_spec_uint ("xwayland-idle-timeout", "Xwayland idle timeout",
+                       "Seconds without X11 clients before Xwayland is stopped",
+                       0, G_MAXUINT, 10,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE|G_PARAM_CONSTRUCT_ONLY);
+
+  properties[PROP_X11_DISPLAY] =
+    g_param_spec_string ("x11-display", "X11 Display",
+                         "The X11 display name to connect to this compositor",
+                         NULL,
+                         G_PARAM_READABLE);
+
+  properties[PROP_READY] =
+    g_param_spec_boolean ("ready", "Ready",
+                          "Whether the compositor is accepting client connections",
+                          FALSE,
+                          G_PARAM_READABLE);
+
+  properties[PROP_ZOOM] =
+    g_param_spec_double ("zoom", "Zoom",
+                         "View scale factor",
+                         1.0 / 64, 64.0, 1.0,
+                         G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_PAN_X] =
+    g_param_spec_double ("pan-x", "Pan X",
+                         "View horizontal offset in widget coordinates",
+                         -G_MAXDOUBLE, G_MAXDOUBLE, 0.0,
+                         G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_PAN_Y] =
+    g_param_spec_double ("pan-y", "Pan Y",
+                         "View vertical offset in widget coordinates",
+                         -G_MAXDOUBLE, G_MAXDOUBLE, 0.0,
+                         G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_SCALING_FILTER] =
+    g_param_spec_enum ("scaling-filter", "Scaling filter",
+                       "Filter used to scale the view",
+                       GSK_TYPE_SCALING_FILTER,
+                       GSK_SCALING_FILTER_LINEAR,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_CANVAS_WIDTH] =
+    g_param_spec_int ("canvas-width", "Canvas width",
+                      "Virtual output width, 0 to use the widget width",
+                      0, 65536, 0,
+                      G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_CANVAS_HEIGHT] =
+    g_param_spec_int ("canvas-height", "Canvas height",
+                      "Virtual output height, 0 to use the widget height",
+                      0, 65536, 0,
+                      G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_TILE_CACHE_SIZE] =
+    g_param_spec_uint64 ("tile-cache-size", "Tile cache size",
+                         "Bytes of canvas tiles kept around after scrolling out of view",
+                         0, G_MAXUINT64, CASILDA_CANVAS_CACHE_SIZE,
+                         G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_FRAME_MARGIN] =
+    g_param_spec_uint ("frame-margin", "Frame margin",
+                       "Microseconds before the next frame client commits should land",
+                       0, G_MAXUINT, CASILDA_FRAME_MARGIN,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_FOCUSED_FRAME_RATE] =
+    g_param_spec_uint ("focused-frame-rate", "Focused frame rate",
+                       "Frame callbacks per second for the focused toplevel, 0 for no limit",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_UNFOCUSED_FRAME_RATE] =
+    g_param_spec_uint ("unfocused-frame-rate", "Unfocused frame rate",
+                       "Frame callbacks per second for visible toplevels without focus, 0 for no limit",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_OCCLUDED_FRAME_RATE] =
+    g_param_spec_uint ("occluded-frame-rate", "Occluded frame rate",
+                       "Frame callbacks per second for toplevels nobody can see, 0 for no limit",
+                       0, G_MAXUINT, CASILDA_OCCLUDED_FRAME_RATE,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_LATENCY_LOG_THRESHOLD] =
+    g_param_spec_uint ("latency-log-threshold", "Latency log threshold",
+                       "Input to photon latencies over this many milliseconds are logged, 0 to disable",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_TRACE_FILE] =
+    g_param_spec_string ("trace-file", "Trace file",
+                         "Record client requests and buffer contents in this file, NULL to stop",
+                         NULL,
+                         G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  properties[PROP_OUTPUT_FORMAT] =
+    g_param_spec_enum ("output-format", "Output format",
+                       "Memory format of the rendered output handed to GTK",
+                       GDK_TYPE_MEMORY_FORMAT,
+                       GDK_MEMORY_B8G8R8A8_PREMULTIPLIED,
+                       G_PARAM_READABLE);
+
+  properties[PROP_RENDERER] =
+    g_param_spec_enum ("renderer", "Renderer",
+                       "The renderer used to composite clients, falls back to pixman if unavailable",
+                       CASILDA_COMPOSITOR_RENDERER_TYPE,
+                       CASILDA_COMPOSITOR_RENDERER_PIXMAN,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE|G_PARAM_CONSTRUCT_ONLY);
+
   g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+
+  g_object_class_override_property (object_class, PROP_HADJUSTMENT, "hadjustment");
+  g_object_class_override_property (object_class, PROP_VADJUSTMENT, "vadjustment");
+  g_object_class_override_property (object_class, PROP_HSCROLL_POLICY, "hscroll-policy");
+  g_object_class_override_property (object_class, PROP_VSCROLL_POLICY, "vscroll-policy");
+}
+
+
+CasildaCompositor *
+casilda_compositor_new (const gchar *socket)
+{
+  return g_object_new (CASILDA_COMPOSITOR_TYPE, "socket", socket, NULL);
+}
+
+gboolean
+casilda_compositor_get_ready (CasildaCompositor *compositor)
+{
+  g_return_val_if_fail (CASILDA_IS_COMPOSITOR (compositor), FALSE);
+
+  return GET_PRIVATE (compositor)->ready;
+}
+
+static void
+casilda_compositor_cancelled_source_free (GSource *source)
+{
+  g_source_destroy (source);
+  g_source_unref (source);
+}
+
+/* Runs in the main context, the cancellable can be triggered from any thread */
+static gboolean
+on_wait_ready_cancelled (G_GNUC_UNUSED GCancellable *cancellable,
+                         gpointer                    user_data)
+{
+  GTask *task = user_data;
+  CasildaCompositorPrivate *priv = GET_PRIVATE (g_task_get_source_object (task));
+  GList *link;
+
+  if ((link = g_list_find (priv->ready_tasks, task)))
+    {
+      priv->ready_tasks = g_list_delete_link (priv->ready_tasks, link);
+      g_task_return_error_if_cancelled (task);
+      g_object_unref (task);
+    }
+
+  return G_SOURCE_REMOVE;
+}
+
+void
+casilda_compositor_wait_ready_async (CasildaCompositor   *compositor,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  CasildaCompositorPrivate *priv;
+  GTask *task;
+
+  g_return_if_fail (CASILDA_IS_COMPOSITOR (compositor));
+
+  priv = GET_PRIVATE (compositor);
+  task = g_task_new (compositor, cancellable, callback, user_data);
+  g_task_set_source_tag (task, casilda_compositor_wait_ready_async);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      g_object_unref (task);
+      return;
+    }
+
+  if (cancellable)
+    {
+      GSource *source = g_cancellable_source_new (cancellable);
+
+      /* Destroyed along with the task, once it returned */
+      g_source_set_callback (source, G_SOURCE_FUNC (on_wait_ready_cancelled), task, NULL);
+      g_source_attach (source, g_task_get_context (task));
+      g_task_set_task_data (task, source, (GDestroyNotify) casilda_compositor_cancelled_source_free);
+    }
+
+  priv->ready_tasks = g_list_append (priv->ready_tasks, task);
+
+  if (priv->initialized)
+    {
+      casilda_compositor_return_ready_tasks (priv);
+      return;
+    }
+
+  /* Someone is waiting, do not wait for the low priority idle anymore */
+  g_clear_handle_id (&priv->init_source, g_source_remove);
+  priv->init_source = g_idle_add (casilda_compositor_initialize_idle, compositor);
+}
+
+gboolean
+casilda_compositor_wait_ready_finish (CasildaCompositor  *compositor,
+                                      GAsyncResult       *result,
+                                      GError            **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, compositor), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+on_spawn_wait_ready (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  CasildaCompositor *compositor = CASILDA_COMPOSITOR (source_object);
+  CasildaCompositorPrivate *priv = GET_PRIVATE (compositor);
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autoptr(GSubprocess) subprocess = NULL;
+  g_autoptr(GError) error = NULL;
+  const gchar * const *argv = g_task_get_task_data (task);
+  struct wl_client *wl_client;
+  CasildaClient *client;
+  gint fds[2];
+
+  if (!casilda_compositor_wait_ready_finish (compositor, result, &error))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0)
+    {
+      gint errsv = errno;
+
+      g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (errsv),
+                               "socketpair: %s", g_strerror (errsv));
+      return;
+    }
+
+  /* The compositor end, wl_client_destroy() closes it */
+  if (!(wl_client = wl_client_create (priv->wl_display, fds[0])))
+    {
+      close (fds[0]);
+      close (fds[1]);
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
+                               "Could not create Wayland client");
+      return;
+    }
+
+  /* The child connects through the inherited fd, no socket lookup needed */
+  launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_NONE);
+  g_subprocess_launcher_take_fd (launcher, fds[1], 3);
+  g_subprocess_launcher_setenv (launcher, "WAYLAND_SOCKET", "3", TRUE);
+  g_subprocess_launcher_unsetenv (launcher, "WAYLAND_DISPLAY");
+
+  if (!(subprocess = g_subprocess_launcher_spawnv (launcher, argv, &error)))
+    {
+      wl_client_destroy (wl_client);
+      g_task_return_error (task, g_steal_pointer (&error));
+      return;
+    }
+
+  g_debug ("%s %s pid %s", __func__, argv[0], g_subprocess_get_identifier (subprocess));
+
+  /* The handle was created along with the wl_client */
+  client = casilda_client_from_wl_client (wl_client);
+  casilda_client_set_subprocess (client, subprocess);
+
+  g_task_return_pointer (task, g_object_ref (client), g_object_unref);
+}
+
+/*
+ * Spawn a client connected through a socketpair passed as WAYLAND_SOCKET,
+ * the child never looks up the compositor socket.
+ */
+void
+casilda_compositor_spawn_async (CasildaCompositor   *compositor,
+                                const gchar * const *argv,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (CASILDA_IS_COMPOSITOR (compositor));
+  g_return_if_fail (argv != NULL && argv[0] != NULL);
+
+  task = g_task_new (compositor, cancellable, callback, user_data);
+  g_task_set_source_tag (task, casilda_compositor_spawn_async);
+  g_task_set_task_data (task, g_strdupv ((gchar **) argv), (GDestroyNotify) g_strfreev);
+
+  casilda_compositor_wait_ready_async (compositor, cancellable, on_spawn_wait_ready, task);
+}
+
+CasildaClient *
+casilda_compositor_spawn_finish (CasildaCompositor  *compositor,
+                                 GAsyncResult       *result,
+                                 GError            **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, compositor), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/*
+ * Every connected client, spawned or not. Items are added as soon as the
+ * client connects, so limits can be set before it does anything.
+ */
+GListModel *
+casilda_compositor_get_clients (CasildaCompositor *compositor)
+{
+  g_return_val_if_fail (CASILDA_IS_COMPOSITOR (compositor), NULL);
+
+  return G_LIST_MODEL (GET_PRIVATE (compositor)->clients);
+}
+
+/*
+ * Performance counters and histograms, they can be read from any thread.
+ */
+CasildaStats *
+casilda_compositor_get_stats (CasildaCompositor *compositor)
+{
+  g_return_val_if_fail (CASILDA_IS_COMPOSITOR (compositor), NULL);
+
+  return GET_PRIVATE (compositor)->stats;
 }
 
+/*
+ * Write every rendered output frame, starting with the next one, in a ring
+ * of n_slots frames up to max_width x max_height in shared memory, see
+ * casilda-frame-ring.h for its layout. memfd and eventfd are set to new
+ * descriptors owned by the caller, for other processes to map the ring read
+ * only and wait for frames. Consumers that fall behind miss frames, the
+ * compositor never waits for them. Any previous ring is dropped, n_slots 0
+ * just stops exporting.
+ *
+ * With a canvas set the output is rendered in tiles and no frames are
+ * written until canvas-width and canvas-height are back to 0.
+ */
+gboolean
+casilda_compositor_export_frames (CasildaCompositor  *compositor,
+                                  guint               n_slots,
+                                  guint               max_width,
+                                  guint               max_height,
+                                  gint               *memfd,
+                                  gint               *eventfd,
+                                  GError            **error)
+{
+  CasildaCompositorPrivate *priv;
+
+  g_return_val_if_fail (CASILDA_IS_COMPOSITOR (compositor), FALSE);
+  priv = GET_PRIVATE (compositor);
+
+  g_clear_pointer (&priv->frame_ring, casilda_frame_ring_free);
+
+  if (!n_slots)
+    return TRUE;
+
+  g_return_val_if_fail (memfd != NULL && eventfd != NULL, FALSE);
+
+  if (!(priv->frame_ring = casilda_frame_ring_new (n_slots, max_width, max_height, error)))
+    return FALSE;
+
+  *memfd = fcntl (casilda_frame_ring_get_memfd (priv->frame_ring), F_DUPFD_CLOEXEC, 0);
+  *eventfd = fcntl (casilda_frame_ring_get_eventfd (priv->frame_ring), F_DUPFD_CLOEXEC, 0);
+
+  if (*memfd < 0 || *eventfd < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Could not duplicate frame ring descriptors: %s", g_strerror (errno));
+      if (*memfd >= 0)
+        close (*memfd);
+      if (*eventfd >= 0)
+        close (*eventfd);
+      g_clear_pointer (&priv->frame_ring, casilda_frame_ring_free);
+      return FALSE;
+    }
+
+  return TRUE;
+}
 
-CasildaCompositor *
-casilda_compositor_new (const gchar *socket)
+/*
+ * Mapped toplevels, in mapping order.
+ */
+GListModel *
+casilda_compositor_get_toplevels (CasildaCompositor *compositor)
 {
-  return g_object_new (CASILDA_COMPOSITOR_TYPE, "socket", socket, NULL);
+  g_return_val_if_fail (CASILDA_IS_COMPOSITOR (compositor), NULL);
+
+  return G_LIST_MODEL (GET_PRIVATE (compositor)->toplevel_model);
 }
 
 /* wlroots */
@@ -1460,8 +4051,63 @@ seat_request_set_selection (struct wl_listener *listener, void *data)
   CasildaCompositorPrivate *priv = wl_container_of (listener, priv, request_set_selection);
   struct wlr_seat_request_set_selection_event *event = data;
 
-  wlr_seat_set_selection (priv->seat, event->source, event->serial);
-  /* TODO: integrate with Gtk clipboard */
+  casilda_clipboard_set_selection (priv->clipboard, event->source, event->serial);
+}
+
+/*
+ * Lay out the title bar and border around the window geometry. They are
+ * plain opaque rects, cheaper than client drawn shadows.
+ */
+static void
+casilda_compositor_toplevel_update_decoration (CasildaCompositorToplevel *toplevel)
+{
+  struct wlr_xdg_toplevel *xdg_toplevel = toplevel->xdg_toplevel;
+  gboolean enabled;
+  struct wlr_box box;
+
+  if (!toplevel->decoration_tree)
+    return;
+
+  /* Maximize and fullscreen requests are not handled, so they stay visible */
+  enabled = toplevel->decoration->current.mode == WLR_XDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE;
+  wlr_scene_node_set_enabled (&toplevel->decoration_tree->node, enabled);
+
+  if (!enabled)
+    return;
+
+  wlr_xdg_surface_get_geometry (xdg_toplevel->base, &box);
+
+  wlr_scene_node_set_position (&toplevel->decoration_frame->node,
+                               box.x - CASILDA_DECORATION_BORDER,
+                               box.y - CASILDA_DECORATION_TITLE_HEIGHT - CASILDA_DECORATION_BORDER);
+  wlr_scene_rect_set_size (toplevel->decoration_frame,
+                           box.width + CASILDA_DECORATION_BORDER * 2,
+                           box.height + CASILDA_DECORATION_TITLE_HEIGHT + CASILDA_DECORATION_BORDER * 2);
+
+  wlr_scene_node_set_position (&toplevel->decoration_title->node,
+                               box.x,
+                               box.y - CASILDA_DECORATION_TITLE_HEIGHT);
+  wlr_scene_rect_set_size (toplevel->decoration_title, box.width, CASILDA_DECORATION_TITLE_HEIGHT);
+
+  if (xdg_toplevel->current.activated)
+    {
+      wlr_scene_rect_set_color (toplevel->decoration_frame, (float[4]){ 0.12f, 0.12f, 0.12f, 1 });
+      wlr_scene_rect_set_color (toplevel->decoration_title, (float[4]){ 0.19f, 0.19f, 0.19f, 1 });
+    }
+  else
+    {
+      wlr_scene_rect_set_color (toplevel->decoration_frame, (float[4]){ 0.25f, 0.25f, 0.25f, 1 });
+      wlr_scene_rect_set_color (toplevel->decoration_title, (float[4]){ 0.32f, 0.32f, 0.32f, 1 });
+    }
+}
+
+static void
+casilda_compositor_toplevel_set_server_side (CasildaCompositorToplevel *toplevel)
+{
+  /* Configures can only be sent after the initial commit */
+  if (toplevel->decoration && toplevel->xdg_toplevel->base->initialized)
+    wlr_xdg_toplevel_decoration_v1_set_mode (toplevel->decoration,
+                                             WLR_XDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE);
 }
 
 static void
@@ -1470,8 +4116,13 @@ xdg_toplevel_map (struct wl_listener *listener, G_GNUC_UNUSED void *data)
   CasildaCompositorToplevel *toplevel = wl_container_of (listener, toplevel, map);
   struct wlr_xdg_toplevel *xdg_toplevel = toplevel->xdg_toplevel;
   CasildaCompositorToplevelState *state = toplevel->state;
+  CasildaClient *client;
 
   toplevel->priv->toplevels = g_list_prepend (toplevel->priv->toplevels, toplevel);
+  g_list_store_append (toplevel->priv->toplevel_model, toplevel->handle);
+
+  if ((client = casilda_client_from_wl_client (wl_resource_get_client (xdg_toplevel->resource))))
+    casilda_client_toplevel_mapped (client, toplevel->handle);
 
   if (state)
     {
@@ -1495,10 +4146,9 @@ xdg_toplevel_map (struct wl_listener *listener, G_GNUC_UNUSED void *data)
 
           toplevel->old_state = *state;
 
-          casilda_compositor_toplevel_configure (toplevel,
-                                                 0, 0,
-                                                 gtk_widget_get_width (widget),
-                                                 gtk_widget_get_height (widget));
+          casilda_compositor_toplevel_configure_fill (toplevel,
+                                                      gtk_widget_get_width (widget),
+                                                      gtk_widget_get_height (widget));
         }
       else
         {
@@ -1517,23 +4167,93 @@ static void
 xdg_toplevel_unmap (struct wl_listener *listener, G_GNUC_UNUSED void *data)
 {
   CasildaCompositorToplevel *toplevel = wl_container_of (listener, toplevel, unmap);
+  CasildaClient *client;
+  guint position;
 
   if (toplevel == toplevel->priv->grabbed_toplevel)
     casilda_compositor_reset_pointer_mode (toplevel->priv);
 
   toplevel->state = NULL;
 
+  casilda_compositor_toplevel_set_suspended (toplevel, FALSE);
+
+  toplevel->resize_serial = 0;
+  toplevel->resize_pending = FALSE;
+  g_array_set_size (toplevel->configures, 0);
+
   toplevel->priv->toplevels = g_list_remove (toplevel->priv->toplevels, toplevel);
+
+  if (g_list_store_find (toplevel->priv->toplevel_model, toplevel->handle, &position))
+    g_list_store_remove (toplevel->priv->toplevel_model, position);
+
+  casilda_toplevel_unmapped (toplevel->handle);
+
+  if ((client = casilda_client_from_wl_client (wl_resource_get_client (toplevel->xdg_toplevel->resource))))
+    casilda_client_toplevel_unmapped (client, toplevel->handle);
 }
 
 static void
 xdg_toplevel_commit (struct wl_listener *listener, G_GNUC_UNUSED void *data)
 {
   CasildaCompositorToplevel *toplevel = wl_container_of (listener, toplevel, commit);
+  struct wlr_xdg_surface *xdg_surface = toplevel->xdg_toplevel->base;
   GtkWidget *widget = toplevel->priv->widget;
+  uint32_t serial = xdg_surface->current.configure_serial;
+  gboolean apply = FALSE;
+  gint x = 0, y = 0;
+
+  if (xdg_surface->initial_commit)
+    {
+      /* Decoration mode first, the size depends on it */
+      casilda_compositor_toplevel_set_server_side (toplevel);
+      casilda_compositor_toplevel_configure_fill (toplevel,
+                                                  gtk_widget_get_width (widget),
+                                                  gtk_widget_get_height (widget));
+    }
+
+  /* Move the node together with the commit that has the matching size */
+  while (toplevel->configures->len)
+    {
+      CasildaCompositorToplevelConfigure *configure =
+        &g_array_index (toplevel->configures, CasildaCompositorToplevelConfigure, 0);
+
+      if ((int32_t) (serial - configure->serial) < 0)
+        break;
+
+      x = configure->x;
+      y = configure->y;
+      apply = TRUE;
+
+      g_array_remove_index (toplevel->configures, 0);
+    }
+
+  if (apply)
+    {
+      struct wlr_box box;
+
+      wlr_xdg_surface_get_geometry (xdg_surface, &box);
+      wlr_scene_node_set_position (&toplevel->scene_tree->node, x - box.x, y - box.y);
+      casilda_compositor_toplevel_save_position (toplevel);
+    }
+
+  casilda_compositor_toplevel_update_decoration (toplevel);
+  casilda_toplevel_commit (toplevel->handle);
+}
+
+static void
+xdg_toplevel_ack_configure (struct wl_listener *listener, void *data)
+{
+  CasildaCompositorToplevel *toplevel = wl_container_of (listener, toplevel, ack_configure);
+  struct wlr_xdg_surface_configure *configure = data;
+
+  if (!toplevel->resize_serial ||
+      (int32_t) (configure->serial - toplevel->resize_serial) < 0)
+    return;
 
-  if (toplevel->xdg_toplevel->base->initial_commit)
-    wlr_xdg_toplevel_set_size (toplevel->xdg_toplevel,gtk_widget_get_width (widget), gtk_widget_get_height (widget));
+  toplevel->resize_serial = 0;
+
+  if (toplevel->resize_pending)
+    casilda_compositor_toplevel_send_resize (toplevel);
 }
 
 static void
@@ -1544,12 +4264,29 @@ xdg_toplevel_destroy (struct wl_listener *listener, G_GNUC_UNUSED void *data)
   wl_list_remove (&toplevel->map.link);
   wl_list_remove (&toplevel->unmap.link);
   wl_list_remove (&toplevel->commit.link);
+  wl_list_remove (&toplevel->ack_configure.link);
   wl_list_remove (&toplevel->destroy.link);
   wl_list_remove (&toplevel->request_move.link);
   wl_list_remove (&toplevel->request_resize.link);
-  wl_list_remove (&toplevel->request_maximize.link);
-  wl_list_remove (&toplevel->request_fullscreen.link);
+  wl_list_remove (&toplevel->set_app_id.link);
+
+  /* The decoration is destroyed right after, along with the scene tree */
+  if (toplevel->decoration)
+    {
+      wl_list_remove (&toplevel->decoration_request_mode.link);
+      wl_list_remove (&toplevel->decoration_destroy.link);
+    }
 
+  /* Not connected yet */
+  if (toplevel->request_maximize.link.next)
+    wl_list_remove (&toplevel->request_maximize.link);
+  if (toplevel->request_fullscreen.link.next)
+    wl_list_remove (&toplevel->request_fullscreen.link);
+
+  casilda_toplevel_destroyed (toplevel->handle);
+  g_object_unref (toplevel->handle);
+
+  g_array_unref (toplevel->configures);
   g_free (toplevel);
 }
 
@@ -1568,46 +4305,23 @@ static void
 xdg_toplevel_request_move (struct wl_listener *listener, G_GNUC_UNUSED void *data)
 {
   CasildaCompositorToplevel *toplevel = wl_container_of (listener, toplevel, request_move);
-  CasildaCompositorPrivate *priv = toplevel->priv;
 
   if (!casilda_compositor_toplevel_has_focus (toplevel))
     return;
 
-  priv->grabbed_toplevel = toplevel;
-  priv->pointer_mode = CASILDA_POINTER_MODE_MOVE;
-  priv->grab_x = priv->pointer_x - toplevel->scene_tree->node.x;
-  priv->grab_y = priv->pointer_y - toplevel->scene_tree->node.y;
+  casilda_compositor_toplevel_begin_move (toplevel);
 }
 
 static void
 xdg_toplevel_request_resize (struct wl_listener *listener, void *data)
 {
   CasildaCompositorToplevel *toplevel = wl_container_of (listener, toplevel, request_resize);
-  CasildaCompositorPrivate *priv = toplevel->priv;
-  struct wlr_scene_tree *scene_tree = toplevel->scene_tree;
   struct wlr_xdg_toplevel_resize_event *event = data;
-  struct wlr_box box;
-  double border_x, border_y;
 
   if (!casilda_compositor_toplevel_has_focus (toplevel))
     return;
 
-  priv->grabbed_toplevel = toplevel;
-  priv->pointer_mode = CASILDA_POINTER_MODE_RESIZE;
-  priv->resize_edges = event->edges;
-
-  wlr_xdg_surface_get_geometry (toplevel->xdg_toplevel->base, &box);
-
-  border_x = scene_tree->node.x + box.x +
-             ((event->edges & WLR_EDGE_RIGHT) ? box.width : 0);
-  border_y = scene_tree->node.y + box.y +
-             ((event->edges & WLR_EDGE_BOTTOM) ? box.height : 0);
-  priv->grab_x = priv->pointer_x - border_x;
-  priv->grab_y = priv->pointer_y - border_y;
-
-  priv->grab_box = box;
-  priv->grab_box.x += scene_tree->node.x;
-  priv->grab_box.y += scene_tree->node.y;
+  casilda_compositor_toplevel_begin_resize (toplevel, event->edges);
 }
 
 static void
@@ -1669,6 +4383,58 @@ xdg_toplevel_set_app_id (struct wl_listener *listener, G_GNUC_UNUSED void *data)
            toplevel->state->height);
 }
 
+static void
+xdg_decoration_request_mode (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorToplevel *toplevel =
+    wl_container_of (listener, toplevel, decoration_request_mode);
+
+  /* Always draw them, clients then leave out their shadows */
+  casilda_compositor_toplevel_set_server_side (toplevel);
+}
+
+static void
+xdg_decoration_destroy (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorToplevel *toplevel =
+    wl_container_of (listener, toplevel, decoration_destroy);
+
+  wl_list_remove (&toplevel->decoration_request_mode.link);
+  wl_list_remove (&toplevel->decoration_destroy.link);
+
+  wlr_scene_node_destroy (&toplevel->decoration_tree->node);
+  toplevel->decoration_tree = NULL;
+  toplevel->decoration_frame = NULL;
+  toplevel->decoration_title = NULL;
+  toplevel->decoration = NULL;
+}
+
+static void
+server_new_toplevel_decoration (struct wl_listener *listener, void *data)
+{
+  struct wlr_xdg_toplevel_decoration_v1 *decoration = data;
+  struct wlr_scene_tree *scene_tree = decoration->toplevel->base->data;
+  CasildaCompositorToplevel *toplevel = scene_tree->node.data;
+
+  toplevel->decoration = decoration;
+
+  /* Below the surfaces, and hidden until the client accepts the mode */
+  toplevel->decoration_tree = wlr_scene_tree_create (scene_tree);
+  wlr_scene_node_lower_to_bottom (&toplevel->decoration_tree->node);
+  wlr_scene_node_set_enabled (&toplevel->decoration_tree->node, FALSE);
+  toplevel->decoration_frame = wlr_scene_rect_create (toplevel->decoration_tree, 0, 0,
+                                                      (float[4]){ 0, 0, 0, 1 });
+  toplevel->decoration_title = wlr_scene_rect_create (toplevel->decoration_tree, 0, 0,
+                                                      (float[4]){ 0, 0, 0, 1 });
+
+  toplevel->decoration_request_mode.notify = xdg_decoration_request_mode;
+  wl_signal_add (&decoration->events.request_mode, &toplevel->decoration_request_mode);
+  toplevel->decoration_destroy.notify = xdg_decoration_destroy;
+  wl_signal_add (&decoration->events.destroy, &toplevel->decoration_destroy);
+
+  casilda_compositor_toplevel_set_server_side (toplevel);
+}
+
 static void
 server_new_xdg_toplevel (struct wl_listener *listener, void *data)
 {
@@ -1679,26 +4445,33 @@ server_new_xdg_toplevel (struct wl_listener *listener, void *data)
   toplevel = g_new0 (CasildaCompositorToplevel, 1);
   toplevel->priv = priv;
   toplevel->xdg_toplevel = xdg_toplevel;
+  toplevel->handle = casilda_toplevel_new (xdg_toplevel, gtk_widget_get_display (priv->widget));
+  toplevel->configures = g_array_new (FALSE, FALSE, sizeof (CasildaCompositorToplevelConfigure));
   toplevel->scene_tree =
     wlr_scene_xdg_surface_create (&priv->scene->tree,
                                   xdg_toplevel->base);
   toplevel->scene_tree->node.data = toplevel;
   xdg_toplevel->base->data = toplevel->scene_tree;
 
+  /* Maximize and fullscreen requests are not handled yet, advertise nothing */
+  wlr_xdg_toplevel_set_wm_capabilities (xdg_toplevel, 0);
+
   toplevel->map.notify = xdg_toplevel_map;
   wl_signal_add (&xdg_toplevel->base->surface->events.map, &toplevel->map);
   toplevel->unmap.notify = xdg_toplevel_unmap;
   wl_signal_add (&xdg_toplevel->base->surface->events.unmap, &toplevel->unmap);
   toplevel->commit.notify = xdg_toplevel_commit;
   wl_signal_add (&xdg_toplevel->base->surface->events.commit, &toplevel->commit);
+  toplevel->ack_configure.notify = xdg_toplevel_ack_configure;
+  wl_signal_add (&xdg_toplevel->base->events.ack_configure, &toplevel->ack_configure);
 
   toplevel->destroy.notify = xdg_toplevel_destroy;
   wl_signal_add (&xdg_toplevel->events.destroy, &toplevel->destroy);
 
-  // toplevel->request_move.notify = xdg_toplevel_request_move;
-  // wl_signal_add (&xdg_toplevel->events.request_move, &toplevel->request_move);
-  // toplevel->request_resize.notify = xdg_toplevel_request_resize;
-  // wl_signal_add (&xdg_toplevel->events.request_resize, &toplevel->request_resize);
+  toplevel->request_move.notify = xdg_toplevel_request_move;
+  wl_signal_add (&xdg_toplevel->events.request_move, &toplevel->request_move);
+  toplevel->request_resize.notify = xdg_toplevel_request_resize;
+  wl_signal_add (&xdg_toplevel->events.request_resize, &toplevel->request_resize);
   // toplevel->request_maximize.notify = xdg_toplevel_request_maximize;
   // wl_signal_add (&xdg_toplevel->events.request_maximize, &toplevel->request_maximize);
   // toplevel->request_fullscreen.notify = xdg_toplevel_request_fullscreen;
@@ -1749,6 +4522,181 @@ server_new_xdg_popup (G_GNUC_UNUSED struct wl_listener *listener, void *data)
   wl_signal_add (&xdg_popup->events.destroy, &popup->destroy);
 }
 
+#ifdef HAVE_XWAYLAND
+static void
+xsurface_map (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorXSurface *xs = wl_container_of (listener, xs, map);
+  struct wlr_xwayland_surface *xsurface = xs->xsurface;
+
+  xs->scene_tree = wlr_scene_subsurface_tree_create (&xs->priv->scene->tree,
+                                                     xsurface->surface);
+  wlr_scene_node_set_position (&xs->scene_tree->node, xsurface->x, xsurface->y);
+
+  if (!xsurface->override_redirect)
+    casilda_compositor_focus_xsurface (xs->priv, xsurface);
+}
+
+static void
+xsurface_unmap (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorXSurface *xs = wl_container_of (listener, xs, unmap);
+
+  if (xs->scene_tree)
+    {
+      wlr_scene_node_destroy (&xs->scene_tree->node);
+      xs->scene_tree = NULL;
+    }
+}
+
+static void
+xsurface_associate (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorXSurface *xs = wl_container_of (listener, xs, associate);
+  struct wlr_surface *surface = xs->xsurface->surface;
+
+  xs->map.notify = xsurface_map;
+  wl_signal_add (&surface->events.map, &xs->map);
+  xs->unmap.notify = xsurface_unmap;
+  wl_signal_add (&surface->events.unmap, &xs->unmap);
+}
+
+static void
+xsurface_dissociate (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorXSurface *xs = wl_container_of (listener, xs, dissociate);
+
+  wl_list_remove (&xs->map.link);
+  wl_list_remove (&xs->unmap.link);
+  memset (&xs->map, 0, sizeof (struct wl_listener));
+  memset (&xs->unmap, 0, sizeof (struct wl_listener));
+}
+
+static void
+xsurface_request_configure (struct wl_listener *listener, void *data)
+{
+  CasildaCompositorXSurface *xs = wl_container_of (listener, xs, request_configure);
+  struct wlr_xwayland_surface_configure_event *event = data;
+
+  /* Let X11 windows place themselves */
+  wlr_xwayland_surface_configure (xs->xsurface,
+                                  event->x,
+                                  event->y,
+                                  event->width,
+                                  event->height);
+
+  if (xs->scene_tree)
+    wlr_scene_node_set_position (&xs->scene_tree->node, event->x, event->y);
+}
+
+static void
+xsurface_set_geometry (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorXSurface *xs = wl_container_of (listener, xs, set_geometry);
+
+  /* Override redirect windows move without asking */
+  if (xs->scene_tree)
+    wlr_scene_node_set_position (&xs->scene_tree->node, xs->xsurface->x, xs->xsurface->y);
+}
+
+static void
+xsurface_destroy (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorXSurface *xs = wl_container_of (listener, xs, destroy);
+
+  if (xs->map.link.next)
+    {
+      wl_list_remove (&xs->map.link);
+      wl_list_remove (&xs->unmap.link);
+    }
+
+  wl_list_remove (&xs->associate.link);
+  wl_list_remove (&xs->dissociate.link);
+  wl_list_remove (&xs->request_configure.link);
+  wl_list_remove (&xs->set_geometry.link);
+  wl_list_remove (&xs->destroy.link);
+
+  xs->xsurface->data = NULL;
+  g_free (xs);
+}
+
+static void
+server_new_xsurface (struct wl_listener *listener, void *data)
+{
+  CasildaCompositorPrivate *priv = wl_container_of (listener, priv, xwayland_new_surface);
+  struct wlr_xwayland_surface *xsurface = data;
+  CasildaCompositorXSurface *xs = g_new0 (CasildaCompositorXSurface, 1);
+
+  xs->priv = priv;
+  xs->xsurface = xsurface;
+  xsurface->data = xs;
+
+  xs->associate.notify = xsurface_associate;
+  wl_signal_add (&xsurface->events.associate, &xs->associate);
+  xs->dissociate.notify = xsurface_dissociate;
+  wl_signal_add (&xsurface->events.dissociate, &xs->dissociate);
+  xs->request_configure.notify = xsurface_request_configure;
+  wl_signal_add (&xsurface->events.request_configure, &xs->request_configure);
+  xs->set_geometry.notify = xsurface_set_geometry;
+  wl_signal_add (&xsurface->events.set_geometry, &xs->set_geometry);
+  xs->destroy.notify = xsurface_destroy;
+  wl_signal_add (&xsurface->events.destroy, &xs->destroy);
+}
+
+static void
+server_xwayland_ready (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaCompositorPrivate *priv = wl_container_of (listener, priv, xwayland_ready);
+
+  g_info ("Xwayland started on %s", priv->xwayland->display_name);
+  wlr_xwayland_set_seat (priv->xwayland, priv->seat);
+}
+
+static void
+casilda_compositor_xwayland_init (CasildaCompositorPrivate *priv)
+{
+  struct wlr_xwayland_server_options options = {
+    .lazy = true,
+    .enable_wm = true,
+    .terminate_delay = priv->xwayland_idle_timeout,
+  };
+
+  /* Only the X11 socket is bound here, the server runs on the first connection */
+  if (!(priv->xwayland_server = wlr_xwayland_server_create (priv->wl_display, &options)))
+    {
+      g_warning ("failed to create Xwayland server");
+      return;
+    }
+
+  priv->xwayland = wlr_xwayland_create_with_server (priv->wl_display,
+                                                    priv->compositor,
+                                                    priv->xwayland_server);
+  if (priv->xwayland == NULL)
+    {
+      g_warning ("failed to create Xwayland");
+      g_clear_pointer (&priv->xwayland_server, wlr_xwayland_server_destroy);
+      return;
+    }
+
+  priv->xwayland_ready.notify = server_xwayland_ready;
+  wl_signal_add (&priv->xwayland->events.ready, &priv->xwayland_ready);
+  priv->xwayland_new_surface.notify = server_new_xsurface;
+  wl_signal_add (&priv->xwayland->events.new_surface, &priv->xwayland_new_surface);
+}
+
+static void
+casilda_compositor_xwayland_finish (CasildaCompositorPrivate *priv)
+{
+  if (!priv->xwayland)
+    return;
+
+  wl_list_remove (&priv->xwayland_ready.link);
+  wl_list_remove (&priv->xwayland_new_surface.link);
+  g_clear_pointer (&priv->xwayland, wlr_xwayland_destroy);
+  g_clear_pointer (&priv->xwayland_server, wlr_xwayland_server_destroy);
+}
+#endif
+
 static void
 server_request_activate (struct wl_listener *listener, void *data)
 {
@@ -1771,6 +4719,20 @@ server_request_activate (struct wl_listener *listener, void *data)
     }
 }
 
+static void
+casilda_compositor_trace_start (CasildaCompositorPrivate *priv)
+{
+  g_autoptr(GError) error = NULL;
+
+  g_clear_pointer (&priv->trace, casilda_trace_free);
+
+  if (!priv->wl_display || !priv->trace_file)
+    return;
+
+  if (!(priv->trace = casilda_trace_new (priv->wl_display, priv->trace_file, &error)))
+    g_warning ("Error recording protocol trace: %s", error->message);
+}
+
 static gchar *
 casilda_compositor_get_socket (void)
 {
@@ -1780,12 +4742,162 @@ casilda_compositor_get_socket (void)
   return g_steal_pointer (&retval);
 }
 
+static gint
+casilda_compositor_listen (const gchar *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  gint fd;
+
+  if (g_strlcpy (addr.sun_path, path, sizeof (addr.sun_path)) >= sizeof (addr.sun_path))
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+
+  if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+
+  /* Replace a stale socket file nobody is listening on */
+  if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 && errno == ECONNREFUSED)
+    g_unlink (path);
+
+  close (fd);
+
+  if ((fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+      listen (fd, 128) < 0)
+    {
+      gint errsv = errno;
+
+      close (fd);
+      errno = errsv;
+      return -1;
+    }
+
+  return fd;
+}
+
+static gint
+casilda_compositor_open_render_node (void)
+{
+  const gchar *path = g_getenv ("WLR_RENDER_DRM_DEVICE");
+  drmDevice *devices[64];
+  gint n, fd = -1;
+
+  if (path)
+    return open (path, O_RDWR | O_CLOEXEC);
+
+  if ((n = drmGetDevices2 (0, devices, G_N_ELEMENTS (devices))) < 0)
+    return -1;
+
+  for (gint i = 0; i < n && fd < 0; i++)
+    {
+      if (devices[i]->available_nodes & (1 << DRM_NODE_RENDER))
+        fd = open (devices[i]->nodes[DRM_NODE_RENDER], O_RDWR | O_CLOEXEC);
+    }
+
+  drmFreeDevices (devices, n);
+
+  return fd;
+}
+
+static struct wlr_renderer *
+casilda_compositor_renderer_create (CasildaCompositorPrivate *priv)
+{
+  switch (priv->renderer_type)
+    {
+    case CASILDA_COMPOSITOR_RENDERER_PIXMAN:
+      return wlr_pixman_renderer_create ();
+
+    case CASILDA_COMPOSITOR_RENDERER_GLES2:
+#if WLR_HAS_GLES2_RENDERER
+      /* EGL on the render node, no window system involved */
+      return wlr_gles2_renderer_create_with_drm_fd (priv->drm_fd);
+#else
+      break;
+#endif
+
+    case CASILDA_COMPOSITOR_RENDERER_VULKAN:
+#if WLR_HAS_VULKAN_RENDERER
+      return wlr_vk_renderer_create_with_drm_fd (priv->drm_fd);
+#else
+      break;
+#endif
+    }
+
+  return NULL;
+}
+
+/* GTK has to be able to import the linear buffers pixman renders in */
+static gboolean
+casilda_compositor_display_has_linear_dmabuf (CasildaCompositorPrivate *priv)
+{
+  GdkDmabufFormats *formats = gdk_display_get_dmabuf_formats (gtk_widget_get_display (priv->widget));
+
+  /* Output formats casilda_compositor_output_pick_format() chooses from */
+  return gdk_dmabuf_formats_contains (formats, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR) &&
+         gdk_dmabuf_formats_contains (formats, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_LINEAR);
+}
+
+/*
+ * Create the requested renderer and an allocator for it, falling back to
+ * pixman if there is no render node or the driver can not handle it.
+ */
+static void
+casilda_compositor_renderer_init (CasildaCompositorPrivate *priv)
+{
+  if (priv->renderer_type != CASILDA_COMPOSITOR_RENDERER_PIXMAN)
+    {
+      g_autoptr(GEnumClass) klass = g_type_class_ref (CASILDA_COMPOSITOR_RENDERER_TYPE);
+      const gchar *nick = g_enum_get_value (klass, priv->renderer_type)->value_nick;
+
+      if ((priv->drm_fd = casilda_compositor_open_render_node ()) < 0)
+        g_message ("Could not open a DRM render node for the %s renderer", nick);
+      else if ((priv->renderer = casilda_compositor_renderer_create (priv)))
+        priv->allocator = wlr_allocator_autocreate (&priv->backend, priv->renderer);
+
+      if (priv->allocator)
+        {
+          g_debug ("%s using %s renderer", __func__, nick);
+          return;
+        }
+
+      g_message ("%s renderer not available, falling back to pixman", nick);
+
+      g_clear_pointer (&priv->renderer, wlr_renderer_destroy);
+      if (priv->drm_fd >= 0)
+        close (priv->drm_fd);
+      priv->drm_fd = -1;
+
+      priv->renderer_type = CASILDA_COMPOSITOR_RENDERER_PIXMAN;
+      g_object_notify_by_pspec (G_OBJECT (gtk_widget_get_parent (priv->widget)),
+                                properties[PROP_RENDERER]);
+    }
+
+  if (!(priv->renderer = casilda_compositor_renderer_create (priv)))
+    return;
+
+  /* Pixman renders in dmabufs GTK imports without an upload, when possible */
+  if (casilda_compositor_display_has_linear_dmabuf (priv))
+    priv->allocator = casilda_allocator_udmabuf_create ();
+
+  if (!priv->allocator)
+    priv->allocator = wlr_allocator_autocreate (&priv->backend, priv->renderer);
+}
+
 static void
 casilda_compositor_wlr_init (CasildaCompositorPrivate *priv)
 {
   priv->wl_display = wl_display_create ();
+  priv->client_tracker = casilda_client_tracker_new (priv->wl_display, priv->clients);
+  casilda_client_tracker_set_latency_threshold (priv->client_tracker,
+                                                priv->latency_log_threshold * G_TIME_SPAN_MILLISECOND);
+  casilda_client_tracker_set_stats (priv->client_tracker, priv->stats);
+  casilda_compositor_trace_start (priv);
 
-  priv->renderer = wlr_pixman_renderer_create ();
+  casilda_compositor_renderer_init (priv);
   if (priv->renderer == NULL)
     {
       g_warning ("failed to create wlr_renderer");
@@ -1794,14 +4906,13 @@ casilda_compositor_wlr_init (CasildaCompositorPrivate *priv)
 
   wlr_renderer_init_wl_display (priv->renderer, priv->wl_display);
 
-  priv->allocator = wlr_allocator_autocreate (&priv->backend, priv->renderer);
   if (priv->allocator == NULL)
     {
       g_warning ("failed to create wlr_allocator");
       return;
     }
 
-  wlr_compositor_create (priv->wl_display, 5, priv->renderer);
+  priv->compositor = wlr_compositor_create (priv->wl_display, 5, priv->renderer);
   wlr_subcompositor_create (priv->wl_display);
   wlr_data_device_manager_create (priv->wl_display);
 
@@ -1817,8 +4928,8 @@ casilda_compositor_wlr_init (CasildaCompositorPrivate *priv)
                                     (float[4]){ 1.0f, 1.f, 1.f, 1 });
   wlr_scene_node_set_position (&priv->bg->node, 0, 0);
 
-  /* Set up xdg-shell version 3 */
-  priv->xdg_shell = wlr_xdg_shell_create (priv->wl_display, 3);
+  /* Set up xdg-shell version 6, for the suspended state */
+  priv->xdg_shell = wlr_xdg_shell_create (priv->wl_display, 6);
   priv->new_xdg_toplevel.notify = server_new_xdg_toplevel;
   wl_signal_add (&priv->xdg_shell->events.new_toplevel, &priv->new_xdg_toplevel);
   priv->new_xdg_popup.notify = server_new_xdg_popup;
@@ -1829,6 +4940,12 @@ casilda_compositor_wlr_init (CasildaCompositorPrivate *priv)
   priv->request_activate.notify = server_request_activate;
   wl_signal_add (&priv->xdg_activation->events.request_activate, &priv->request_activate);
 
+  /* Set up xdg-decoration, windows get a server side title bar and border */
+  priv->decoration_manager = wlr_xdg_decoration_manager_v1_create (priv->wl_display);
+  priv->new_toplevel_decoration.notify = server_new_toplevel_decoration;
+  wl_signal_add (&priv->decoration_manager->events.new_toplevel_decoration,
+                 &priv->new_toplevel_decoration);
+
   /* Configure seat */
   priv->seat = wlr_seat_create (priv->wl_display, "seat0");
   priv->request_set_selection.notify = seat_request_set_selection;
@@ -1839,14 +4956,22 @@ casilda_compositor_wlr_init (CasildaCompositorPrivate *priv)
                              WL_SEAT_CAPABILITY_POINTER |
                              WL_SEAT_CAPABILITY_KEYBOARD);
 
-  if (!priv->socket)
+  /* The display owns the socket from now on */
+  if (priv->listen_fd < 0 || wl_display_add_socket_fd (priv->wl_display, priv->listen_fd) != 0)
+    g_warning ("Error adding socket file %s", priv->socket);
+  else
     {
-      priv->socket = casilda_compositor_get_socket ();
-      priv->owns_socket = TRUE;
+      priv->listen_fd = -1;
+      priv->ready = TRUE;
     }
 
-  if (wl_display_add_socket (priv->wl_display, priv->socket) != 0)
-    g_warning ("Error adding socket file %s", priv->socket);
+#ifdef HAVE_XWAYLAND
+  if (priv->xwayland_enabled)
+    casilda_compositor_xwayland_init (priv);
+#else
+  if (priv->xwayland_enabled)
+    g_warning ("Casilda was built without Xwayland support");
+#endif
 }
 
 static void
@@ -1858,7 +4983,16 @@ casilda_compositor_set_bg_color (CasildaCompositor *compositor,
   if (bg == NULL)
     return;
 
+  priv->bg_color = *bg;
+
+  if (!priv->bg)
+    {
+      gtk_widget_queue_draw (priv->widget);
+      return;
+    }
+
   wlr_scene_rect_set_color (priv->bg, (float[4]){ bg->red, bg->green, bg->blue, bg->alpha });
+  casilda_compositor_output_update_format (priv);
 }
 
 
@@ -27,7 +27,51 @@
 
 #include <gtk/gtk.h>
 
+#include "casilda-client.h"
+#include "casilda-stats.h"
+#include "casilda-toplevel.h"
+
+typedef enum
+{
+  CASILDA_COMPOSITOR_RENDERER_PIXMAN, /* Software rendering, always available */
+  CASILDA_COMPOSITOR_RENDERER_GLES2,  /* OpenGL ES 2 on a DRM render node */
+  CASILDA_COMPOSITOR_RENDERER_VULKAN, /* Vulkan on a DRM render node */
+} CasildaCompositorRenderer;
+
+#define CASILDA_COMPOSITOR_RENDERER_TYPE (casilda_compositor_renderer_get_type ())
+GType casilda_compositor_renderer_get_type (void);
+
 #define CASILDA_COMPOSITOR_TYPE (casilda_compositor_get_type ())
 G_DECLARE_FINAL_TYPE (CasildaCompositor, casilda_compositor, CASILDA, COMPOSITOR, GtkWidget)
 
-CasildaCompositor *casilda_compositor_new (const gchar *socket);
+CasildaCompositor *casilda_compositor_new               (const gchar          *socket);
+
+gboolean           casilda_compositor_get_ready         (CasildaCompositor    *compositor);
+void               casilda_compositor_wait_ready_async  (CasildaCompositor    *compositor,
+                                                         GCancellable         *cancellable,
+                                                         GAsyncReadyCallback   callback,
+                                                         gpointer              user_data);
+gboolean           casilda_compositor_wait_ready_finish (CasildaCompositor    *compositor,
+                                                         GAsyncResult         *result,
+                                                         GError              **error);
+
+void               casilda_compositor_spawn_async       (CasildaCompositor    *compositor,
+                                                         const gchar * const  *argv,
+                                                         GCancellable         *cancellable,
+                                                         GAsyncReadyCallback   callback,
+                                                         gpointer              user_data);
+CasildaClient     *casilda_compositor_spawn_finish      (CasildaCompositor    *compositor,
+                                                         GAsyncResult         *result,
+                                                         GError              **error);
+
+GListModel        *casilda_compositor_get_clients       (CasildaCompositor    *compositor);
+GListModel        *casilda_compositor_get_toplevels     (CasildaCompositor    *compositor);
+CasildaStats      *casilda_compositor_get_stats         (CasildaCompositor    *compositor);
+
+gboolean           casilda_compositor_export_frames     (CasildaCompositor    *compositor,
+                                                         guint                 n_slots,
+                                                         guint                 max_width,
+                                                         guint                 max_height,
+                                                         gint                 *memfd,
+                                                         gint                 *eventfd,
+                                                         GError              **error);
@@ -0,0 +1,47 @@
+/*
+ * Casilda Frame Ring
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <pixman.h>
+
+#include "casilda-frame-ring.h"
+
+struct wlr_buffer;
+struct wlr_renderer;
+
+typedef struct _CasildaFrameRing CasildaFrameRing;
+
+CasildaFrameRing *casilda_frame_ring_new         (guint                    n_slots,
+                                                  guint                    max_width,
+                                                  guint                    max_height,
+                                                  GError                 **error);
+void              casilda_frame_ring_free        (CasildaFrameRing        *ring);
+gint              casilda_frame_ring_get_memfd   (CasildaFrameRing        *ring);
+gint              casilda_frame_ring_get_eventfd (CasildaFrameRing        *ring);
+void              casilda_frame_ring_push        (CasildaFrameRing        *ring,
+                                                  struct wlr_renderer     *renderer,
+                                                  struct wlr_buffer       *buffer,
+                                                  const pixman_region32_t *damage);
@@ -0,0 +1,318 @@
+/*
+ * Casilda Frame Ring
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define _GNU_SOURCE
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+
+#include "casilda-frame-ring-private.h"
+
+/* Linux 5.1, older headers do not have it */
+#ifndef F_SEAL_FUTURE_WRITE
+#define F_SEAL_FUTURE_WRITE 0x0010
+#endif
+
+struct _CasildaFrameRing
+{
+  gint                    memfd;
+  gint                    eventfd;
+  guint8                 *data;
+  gsize                   size;
+  CasildaFrameRingHeader *header;
+  guint64                 sequence;
+
+  /* Per slot, area that changed since the slot was last written */
+  pixman_region32_t      *stale;
+};
+
+#define ALIGN_TO(value, align) (((value) + (align) - 1) & ~((gsize) (align) - 1))
+
+CasildaFrameRing *
+casilda_frame_ring_new (guint    n_slots,
+                        guint    max_width,
+                        guint    max_height,
+                        GError **error)
+{
+  gsize page_size = sysconf (_SC_PAGESIZE);
+  gsize pixels_offset, slot_size, size;
+  CasildaFrameRing *ring;
+  guint8 *data;
+  gint memfd, efd;
+
+  g_return_val_if_fail (n_slots > 0 && max_width > 0 && max_height > 0, NULL);
+
+  pixels_offset = ALIGN_TO (sizeof (CasildaFrameRingSlot), 64);
+  slot_size = ALIGN_TO (pixels_offset + (gsize) max_width * 4 * max_height, page_size);
+  size = page_size + slot_size * n_slots;
+
+  if ((memfd = memfd_create ("casilda-frame-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "memfd_create: %s", g_strerror (errno));
+      return NULL;
+    }
+
+  /* Consumers map it once, it never changes size */
+  if (ftruncate (memfd, size) < 0 ||
+      (data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0)) == MAP_FAILED)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Could not map frame ring: %s", g_strerror (errno));
+      close (memfd);
+      return NULL;
+    }
+
+  /* Only our mapping is writable, consumers can map it read only */
+  if (fcntl (memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "Could not seal frame ring: %s", g_strerror (errno));
+      munmap (data, size);
+      close (memfd);
+      return NULL;
+    }
+
+  if ((efd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errno),
+                   "eventfd: %s", g_strerror (errno));
+      munmap (data, size);
+      close (memfd);
+      return NULL;
+    }
+
+  ring = g_new0 (CasildaFrameRing, 1);
+  ring->memfd = memfd;
+  ring->eventfd = efd;
+  ring->data = data;
+  ring->size = size;
+  ring->stale = g_new (pixman_region32_t, n_slots);
+
+  for (guint i = 0; i < n_slots; i++)
+    pixman_region32_init (&ring->stale[i]);
+
+  ring->header = (CasildaFrameRingHeader *) data;
+  ring->header->magic = CASILDA_FRAME_RING_MAGIC;
+  ring->header->version = CASILDA_FRAME_RING_VERSION;
+  ring->header->n_slots = n_slots;
+  ring->header->max_width = max_width;
+  ring->header->max_height = max_height;
+  ring->header->slots_offset = page_size;
+  ring->header->slot_size = slot_size;
+  ring->header->pixels_offset = pixels_offset;
+
+  g_debug ("%s %u slots of %ux%u, %" G_GSIZE_FORMAT " bytes",
+           __func__, n_slots, max_width, max_height, size);
+
+  return ring;
+}
+
+void
+casilda_frame_ring_free (CasildaFrameRing *ring)
+{
+  for (guint i = 0; i < ring->header->n_slots; i++)
+    pixman_region32_fini (&ring->stale[i]);
+
+  g_free (ring->stale);
+  munmap (ring->data, ring->size);
+  close (ring->memfd);
+  close (ring->eventfd);
+  g_free (ring);
+}
+
+gint
+casilda_frame_ring_get_memfd (CasildaFrameRing *ring)
+{
+  return ring->memfd;
+}
+
+gint
+casilda_frame_ring_get_eventfd (CasildaFrameRing *ring)
+{
+  return ring->eventfd;
+}
+
+static gboolean
+casilda_frame_ring_copy (CasildaFrameRingSlot    *slot,
+                         guint8                  *pixels,
+                         struct wlr_renderer     *renderer,
+                         struct wlr_buffer       *buffer,
+                         const pixman_region32_t *region)
+{
+  const pixman_box32_t *rects;
+  struct wlr_texture *texture;
+  uint32_t format;
+  gsize stride;
+  void *data;
+  int n_rects;
+
+  rects = pixman_region32_rectangles ((pixman_region32_t *) region, &n_rects);
+
+  /* Memory buffers are copied as is, anything else is read back */
+  if (wlr_buffer_begin_data_ptr_access (buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                        &data, &format, &stride))
+    {
+      for (gint i = 0; i < n_rects; i++)
+        {
+          gsize offset = rects[i].x1 * 4;
+          gsize len = (rects[i].x2 - rects[i].x1) * 4;
+
+          for (gint y = rects[i].y1; y < rects[i].y2; y++)
+            memcpy (pixels + y * slot->stride + offset, (guint8 *) data + y * stride + offset, len);
+        }
+
+      wlr_buffer_end_data_ptr_access (buffer);
+      slot->format = format;
+
+      return TRUE;
+    }
+
+  if (!(texture = wlr_texture_from_buffer (renderer, buffer)))
+    return FALSE;
+
+  for (gint i = 0; i < n_rects; i++)
+    {
+      if (!wlr_texture_read_pixels (texture, &(struct wlr_texture_read_pixels_options) {
+                                      .data = pixels,
+                                      .format = DRM_FORMAT_ARGB8888,
+                                      .stride = slot->stride,
+                                      .dst_x = rects[i].x1,
+                                      .dst_y = rects[i].y1,
+                                      .src_box = {
+                                        rects[i].x1,
+                                        rects[i].y1,
+                                        rects[i].x2 - rects[i].x1,
+                                        rects[i].y2 - rects[i].y1
+                                      },
+                                    }))
+        {
+          wlr_texture_destroy (texture);
+          return FALSE;
+        }
+    }
+
+  wlr_texture_destroy (texture);
+  slot->format = DRM_FORMAT_ARGB8888;
+
+  return TRUE;
+}
+
+/*
+ * Write a rendered frame in the next slot. Only what changed since that
+ * slot was last written is copied, damage is what changed since the
+ * previous frame.
+ */
+void
+casilda_frame_ring_push (CasildaFrameRing        *ring,
+                         struct wlr_renderer     *renderer,
+                         struct wlr_buffer       *buffer,
+                         const pixman_region32_t *damage)
+{
+  CasildaFrameRingHeader *header = ring->header;
+  guint64 sequence = ring->sequence + 1;
+  guint index = sequence % header->n_slots;
+  pixman_region32_t *stale = &ring->stale[index];
+  CasildaFrameRingSlot *slot;
+  const pixman_box32_t *rects;
+  pixman_box32_t *extents;
+  guint8 *pixels;
+  int n_rects;
+
+  /* Every other slot is one more frame behind, even if this one is skipped */
+  for (guint i = 0; i < header->n_slots; i++)
+    pixman_region32_union (&ring->stale[i], &ring->stale[i], (pixman_region32_t *) damage);
+
+  if ((guint) buffer->width > header->max_width || (guint) buffer->height > header->max_height)
+    {
+      g_debug ("%s %dx%d frame does not fit the ring", __func__, buffer->width, buffer->height);
+      return;
+    }
+
+  slot = (CasildaFrameRingSlot *) (ring->data + header->slots_offset + (gsize) index * header->slot_size);
+  pixels = (guint8 *) slot + header->pixels_offset;
+
+  if (slot->width != (guint32) buffer->width || slot->height != (guint32) buffer->height)
+    pixman_region32_union_rect (stale, stale, 0, 0, buffer->width, buffer->height);
+
+  pixman_region32_intersect_rect (stale, stale, 0, 0, buffer->width, buffer->height);
+
+  /* Readers drop the slot until it is complete */
+  atomic_store_explicit ((_Atomic guint64 *) &slot->sequence, 0, memory_order_relaxed);
+  atomic_thread_fence (memory_order_release);
+
+  slot->width = buffer->width;
+  slot->height = buffer->height;
+  slot->stride = buffer->width * 4;
+
+  if (!casilda_frame_ring_copy (slot, pixels, renderer, buffer, stale))
+    {
+      /* Copy everything next time */
+      slot->width = slot->height = 0;
+      g_debug ("%s could not read frame %" G_GUINT64_FORMAT, __func__, sequence);
+      return;
+    }
+
+  pixman_region32_clear (stale);
+
+  slot->timestamp = g_get_monotonic_time ();
+  rects = pixman_region32_rectangles ((pixman_region32_t *) damage, &n_rects);
+
+  if (n_rects > CASILDA_FRAME_RING_MAX_RECTS)
+    {
+      extents = pixman_region32_extents ((pixman_region32_t *) damage);
+      rects = extents;
+      n_rects = 1;
+    }
+
+  slot->n_rects = n_rects;
+  for (gint i = 0; i < n_rects; i++)
+    slot->rects[i] = (CasildaFrameRingRect) {
+      rects[i].x1,
+      rects[i].y1,
+      rects[i].x2 - rects[i].x1,
+      rects[i].y2 - rects[i].y1
+    };
+
+  ring->sequence = sequence;
+  atomic_store_explicit ((_Atomic guint64 *) &slot->sequence, sequence, memory_order_release);
+  atomic_store_explicit ((_Atomic guint64 *) &header->sequence, sequence, memory_order_release);
+
+  /* Never blocks, a full counter just means nobody is reading */
+  eventfd_write (ring->eventfd, 1);
+}
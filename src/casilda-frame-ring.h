@@ -0,0 +1,82 @@
+/*
+ * Casilda Frame Ring
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <glib.h>
+
+/*
+ * Shared memory layout of the frame ring, see casilda_compositor_export_frames().
+ *
+ * The memfd starts with a CasildaFrameRingHeader, followed by n_slots slots
+ * of slot_size bytes at slots_offset. Each slot is a CasildaFrameRingSlot
+ * with the frame pixels pixels_offset bytes after it. Frame N goes in slot
+ * N % n_slots.
+ *
+ * The compositor never waits for consumers, it overwrites the oldest slot.
+ * A slot sequence is 0 while it is being written. Consumers load it with
+ * acquire semantics before copying the slot. After copying they need an
+ * atomic_thread_fence (memory_order_acquire), so the copy can not be
+ * reordered past it, before loading it again, a relaxed load is enough there.
+ * The copy is dropped if the sequence changed or was 0. The eventfd is
+ * incremented for every frame.
+ */
+
+#define CASILDA_FRAME_RING_MAGIC 0x474e5243 /* "CRNG" little endian */
+#define CASILDA_FRAME_RING_VERSION 1
+
+/* Damage with more rectangles is reported as its bounding box */
+#define CASILDA_FRAME_RING_MAX_RECTS 32
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint32 n_slots;
+  guint32 max_width;
+  guint32 max_height;
+  guint32 slots_offset;
+  guint32 slot_size;
+  guint32 pixels_offset;
+  guint64 sequence;      /* Last frame written, 0 if none */
+} CasildaFrameRingHeader;
+
+typedef struct
+{
+  gint32 x, y, width, height;
+} CasildaFrameRingRect;
+
+typedef struct
+{
+  guint64              sequence;  /* Frame number, 0 while writing */
+  gint64               timestamp; /* Monotonic time in microseconds */
+  guint32              width;
+  guint32              height;
+  guint32              stride;
+  guint32              format;    /* DRM fourcc */
+  guint32              n_rects;
+  guint32              padding;
+  CasildaFrameRingRect rects[CASILDA_FRAME_RING_MAX_RECTS]; /* Changed since the previous frame */
+} CasildaFrameRingSlot;
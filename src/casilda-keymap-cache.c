@@ -0,0 +1,279 @@
+/*
+ * Casilda Keymap Cache
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define _GNU_SOURCE
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <wlr/types/wlr_keyboard.h>
+
+#include "casilda-keymap-cache.h"
+
+/*
+ * Compiled keymaps are shared by every compositor in the process. The cache
+ * is only accessed from the main thread, workers just compile and hand the
+ * result back.
+ */
+struct _CasildaKeymap
+{
+  gint               ref_count;
+  gchar             *key;
+  struct xkb_keymap *keymap;
+};
+
+static GHashTable *keymap_cache = NULL;
+
+/* Keys with a compilation in flight and the tasks waiting for it */
+static GHashTable *keymap_pending = NULL;
+
+static CasildaKeymap *
+casilda_keymap_new (const gchar       *key,
+                    struct xkb_keymap *keymap)
+{
+  CasildaKeymap *retval = g_new0 (CasildaKeymap, 1);
+
+  retval->ref_count = 1;
+  retval->key = g_strdup (key);
+  retval->keymap = xkb_keymap_ref (keymap);
+
+  return retval;
+}
+
+CasildaKeymap *
+casilda_keymap_ref (CasildaKeymap *keymap)
+{
+  keymap->ref_count++;
+  return keymap;
+}
+
+void
+casilda_keymap_unref (CasildaKeymap *keymap)
+{
+  if (--keymap->ref_count)
+    return;
+
+  xkb_keymap_unref (keymap->keymap);
+  g_free (keymap->key);
+  g_free (keymap);
+}
+
+/*
+ * Set the shared keymap in keyboard, wlroots still serializes it into a
+ * memfd of its own for the clients.
+ */
+void
+casilda_keymap_apply (CasildaKeymap       *keymap,
+                      struct wlr_keyboard *keyboard)
+{
+  wlr_keyboard_set_keymap (keyboard, keymap->keymap);
+}
+
+static void
+casilda_keymap_cache_ensure (void)
+{
+  if (keymap_cache)
+    return;
+
+  keymap_cache = g_hash_table_new_full (g_str_hash,
+                                        g_str_equal,
+                                        NULL,
+                                        (GDestroyNotify) casilda_keymap_unref);
+  keymap_pending = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+CasildaKeymap *
+casilda_keymap_cache_lookup (const gchar *key)
+{
+  CasildaKeymap *keymap;
+
+  casilda_keymap_cache_ensure ();
+
+  if ((keymap = g_hash_table_lookup (keymap_cache, key)))
+    return casilda_keymap_ref (keymap);
+
+  return NULL;
+}
+
+static CasildaKeymap *
+casilda_keymap_cache_add (CasildaKeymap *keymap)
+{
+  CasildaKeymap *cached;
+
+  casilda_keymap_cache_ensure ();
+
+  /* Someone else got there first */
+  if ((cached = g_hash_table_lookup (keymap_cache, keymap->key)))
+    {
+      casilda_keymap_unref (keymap);
+      return casilda_keymap_ref (cached);
+    }
+
+  g_debug ("%s %s", __func__, keymap->key);
+
+  g_hash_table_insert (keymap_cache, keymap->key, keymap);
+
+  return casilda_keymap_ref (keymap);
+}
+
+CasildaKeymap *
+casilda_keymap_cache_insert (const gchar       *key,
+                             struct xkb_keymap *keymap)
+{
+  return casilda_keymap_cache_add (casilda_keymap_new (key, keymap));
+}
+
+/*
+ * Drop keymaps no keyboard is using anymore, returns how many were dropped.
+ */
+guint
+casilda_keymap_cache_trim (void)
+{
+  GHashTableIter iter;
+  CasildaKeymap *keymap;
+  guint retval = 0;
+
+  if (!keymap_cache)
+    return 0;
+
+  g_hash_table_iter_init (&iter, keymap_cache);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &keymap))
+    {
+      if (keymap->ref_count > 1)
+        continue;
+
+      g_hash_table_iter_remove (&iter);
+      retval++;
+    }
+
+  return retval;
+}
+
+static void
+casilda_keymap_compile_thread (GTask                 *task,
+                               G_GNUC_UNUSED gpointer source_object,
+                               gpointer               task_data,
+                               G_GNUC_UNUSED GCancellable *cancellable)
+{
+  struct xkb_context *context = xkb_context_new (XKB_CONTEXT_NO_FLAGS);
+  struct xkb_keymap *keymap;
+  CasildaKeymap *retval;
+
+  keymap = xkb_keymap_new_from_names (context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+  xkb_context_unref (context);
+
+  if (!keymap)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not compile keymap");
+      return;
+    }
+
+  retval = casilda_keymap_new (task_data, keymap);
+  xkb_keymap_unref (keymap);
+
+  g_task_return_pointer (task, retval, (GDestroyNotify) casilda_keymap_unref);
+}
+
+static void
+on_keymap_compiled (G_GNUC_UNUSED GObject *source_object,
+                    GAsyncResult          *result,
+                    gpointer               user_data)
+{
+  g_autofree gchar *key = user_data;
+  g_autoptr(CasildaKeymap) keymap = NULL;
+  g_autoptr(GError) error = NULL;
+  GList *tasks = NULL;
+  gpointer orig_key;
+
+  keymap = g_task_propagate_pointer (G_TASK (result), &error);
+
+  if (g_hash_table_steal_extended (keymap_pending, key, &orig_key, (gpointer *) &tasks))
+    g_free (orig_key);
+
+  if (keymap)
+    {
+      CasildaKeymap *cached = casilda_keymap_cache_add (g_steal_pointer (&keymap));
+
+      for (GList *l = tasks; l; l = g_list_next (l))
+        g_task_return_pointer (l->data,
+                               casilda_keymap_ref (cached),
+                               (GDestroyNotify) casilda_keymap_unref);
+
+      casilda_keymap_unref (cached);
+    }
+  else
+    {
+      for (GList *l = tasks; l; l = g_list_next (l))
+        g_task_return_error (l->data, g_error_copy (error));
+    }
+
+  g_list_free_full (tasks, g_object_unref);
+}
+
+/*
+ * Compile the default keymap in a worker thread, concurrent requests for the
+ * same key share a single compilation.
+ */
+void
+casilda_keymap_cache_compile_async (const gchar         *key,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  g_autoptr(CasildaKeymap) keymap = NULL;
+  GTask *task = g_task_new (NULL, cancellable, callback, user_data);
+  GList *tasks;
+
+  g_task_set_source_tag (task, casilda_keymap_cache_compile_async);
+
+  if ((keymap = casilda_keymap_cache_lookup (key)))
+    {
+      g_task_return_pointer (task,
+                             g_steal_pointer (&keymap),
+                             (GDestroyNotify) casilda_keymap_unref);
+      g_object_unref (task);
+      return;
+    }
+
+  if (g_hash_table_lookup_extended (keymap_pending, key, NULL, (gpointer *) &tasks))
+    {
+      g_hash_table_insert (keymap_pending, g_strdup (key), g_list_append (tasks, task));
+      return;
+    }
+
+  g_hash_table_insert (keymap_pending, g_strdup (key), g_list_append (NULL, task));
+
+  /* The worker task is not cancellable, it completes every waiting task */
+  task = g_task_new (NULL, NULL, on_keymap_compiled, g_strdup (key));
+  g_task_set_task_data (task, g_strdup (key), g_free);
+  g_task_run_in_thread (task, casilda_keymap_compile_thread);
+  g_object_unref (task);
+}
+
+CasildaKeymap *
+casilda_keymap_cache_compile_finish (GAsyncResult  *result,
+                                     GError       **error)
+{
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
@@ -0,0 +1,51 @@
+/*
+ * Casilda Keymap Cache
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <xkbcommon/xkbcommon.h>
+
+struct wlr_keyboard;
+
+typedef struct _CasildaKeymap CasildaKeymap;
+
+CasildaKeymap *casilda_keymap_ref                 (CasildaKeymap       *keymap);
+void           casilda_keymap_unref               (CasildaKeymap       *keymap);
+void           casilda_keymap_apply               (CasildaKeymap       *keymap,
+                                                   struct wlr_keyboard *keyboard);
+
+CasildaKeymap *casilda_keymap_cache_lookup        (const gchar         *key);
+CasildaKeymap *casilda_keymap_cache_insert        (const gchar         *key,
+                                                   struct xkb_keymap   *keymap);
+void           casilda_keymap_cache_compile_async (const gchar         *key,
+                                                   GCancellable        *cancellable,
+                                                   GAsyncReadyCallback  callback,
+                                                   gpointer             user_data);
+guint          casilda_keymap_cache_trim          (void);
+CasildaKeymap *casilda_keymap_cache_compile_finish (GAsyncResult       *result,
+                                                    GError            **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (CasildaKeymap, casilda_keymap_unref);
@@ -0,0 +1,43 @@
+/*
+ * Casilda Performance Statistics
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <pixman.h>
+
+#include "casilda-stats.h"
+
+CasildaStats *casilda_stats_new               (void);
+void          casilda_stats_add_frame         (CasildaStats          *stats,
+                                               gboolean               rendered);
+void          casilda_stats_add_time          (CasildaStats          *stats,
+                                               CasildaStatsHistogram  histogram,
+                                               gint64                 time);
+void          casilda_stats_add_damage        (CasildaStats          *stats,
+                                               pixman_region32_t     *damage);
+void          casilda_stats_add_dispatch_time (CasildaStats          *stats,
+                                               gint64                 time);
+void          casilda_stats_set_n_clients     (CasildaStats          *stats,
+                                               guint                  n_clients);
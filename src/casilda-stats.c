@@ -0,0 +1,395 @@
+/*
+ * Casilda Performance Statistics
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define G_LOG_DOMAIN "Casilda"
+
+#include <stdatomic.h>
+
+#include "casilda-stats-private.h"
+
+/* Default milliseconds between property notifications */
+#define CASILDA_STATS_NOTIFY_INTERVAL 1000
+
+/*
+ * Counters are only written from the main thread, they are atomic so any
+ * thread can poll them without taking a lock.
+ */
+struct _CasildaStats
+{
+  GObject parent;
+
+  atomic_uint_least64_t frames_rendered;
+  atomic_uint_least64_t frames_skipped;
+  atomic_uint_least64_t damaged_pixels;
+  atomic_uint_least64_t dispatch_time;
+  atomic_uint           n_clients;
+  atomic_uint_least64_t histograms[CASILDA_STATS_N_HISTOGRAMS][CASILDA_STATS_BUCKETS];
+
+  /* Notifications are throttled to one batch every notify_interval ms */
+  guint                 notify_interval;
+  guint                 notify_source;
+};
+
+enum {
+  PROP_0,
+  PROP_FRAMES_RENDERED,
+  PROP_FRAMES_SKIPPED,
+  PROP_DAMAGED_PIXELS,
+  PROP_N_CLIENTS,
+  PROP_DISPATCH_TIME,
+  PROP_NOTIFY_INTERVAL,
+
+  N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES];
+
+G_DEFINE_TYPE (CasildaStats, casilda_stats, G_TYPE_OBJECT);
+
+
+static gboolean
+on_stats_notify (gpointer user_data)
+{
+  GObject *object = user_data;
+  CasildaStats *stats = user_data;
+
+  stats->notify_source = 0;
+
+  g_object_freeze_notify (object);
+  for (guint i = PROP_FRAMES_RENDERED; i <= PROP_DISPATCH_TIME; i++)
+    g_object_notify_by_pspec (object, properties[i]);
+  g_object_thaw_notify (object);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Something changed, notify on the next interval unless already scheduled */
+static void
+casilda_stats_changed (CasildaStats *stats)
+{
+  if (stats->notify_source || !stats->notify_interval)
+    return;
+
+  stats->notify_source = g_timeout_add (stats->notify_interval, on_stats_notify, stats);
+}
+
+static void
+casilda_stats_init (CasildaStats *stats)
+{
+  stats->notify_interval = CASILDA_STATS_NOTIFY_INTERVAL;
+}
+
+static void
+casilda_stats_finalize (GObject *object)
+{
+  CasildaStats *stats = CASILDA_STATS (object);
+
+  g_clear_handle_id (&stats->notify_source, g_source_remove);
+
+  G_OBJECT_CLASS (casilda_stats_parent_class)->finalize (object);
+}
+
+static void
+casilda_stats_get_property (GObject    *object,
+                            guint       prop_id,
+                            GValue     *value,
+                            GParamSpec *pspec)
+{
+  CasildaStats *stats = CASILDA_STATS (object);
+
+  switch (prop_id)
+    {
+    case PROP_FRAMES_RENDERED:
+      g_value_set_uint64 (value, casilda_stats_get_frames_rendered (stats));
+      break;
+
+    case PROP_FRAMES_SKIPPED:
+      g_value_set_uint64 (value, casilda_stats_get_frames_skipped (stats));
+      break;
+
+    case PROP_DAMAGED_PIXELS:
+      g_value_set_uint64 (value, casilda_stats_get_damaged_pixels (stats));
+      break;
+
+    case PROP_N_CLIENTS:
+      g_value_set_uint (value, casilda_stats_get_n_clients (stats));
+      break;
+
+    case PROP_DISPATCH_TIME:
+      g_value_set_uint64 (value, casilda_stats_get_dispatch_time (stats));
+      break;
+
+    case PROP_NOTIFY_INTERVAL:
+      g_value_set_uint (value, stats->notify_interval);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+casilda_stats_set_property (GObject      *object,
+                            guint         prop_id,
+                            const GValue *value,
+                            GParamSpec   *pspec)
+{
+  CasildaStats *stats = CASILDA_STATS (object);
+
+  switch (prop_id)
+    {
+    case PROP_NOTIFY_INTERVAL:
+      casilda_stats_set_notify_interval (stats, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+casilda_stats_class_init (CasildaStatsClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = casilda_stats_finalize;
+  object_class->get_property = casilda_stats_get_property;
+  object_class->set_property = casilda_stats_set_property;
+
+  properties[PROP_FRAMES_RENDERED] =
+    g_param_spec_uint64 ("frames-rendered", "Frames rendered",
+                         "Frames the scene was rendered for",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_READABLE);
+
+  properties[PROP_FRAMES_SKIPPED] =
+    g_param_spec_uint64 ("frames-skipped", "Frames skipped",
+                         "Damaged frames that could not be rendered",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_READABLE);
+
+  properties[PROP_DAMAGED_PIXELS] =
+    g_param_spec_uint64 ("damaged-pixels", "Damaged pixels",
+                         "Output pixels rendered again because of damage",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_READABLE);
+
+  properties[PROP_N_CLIENTS] =
+    g_param_spec_uint ("n-clients", "Number of clients",
+                       "Number of connected clients",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE);
+
+  properties[PROP_DISPATCH_TIME] =
+    g_param_spec_uint64 ("dispatch-time", "Dispatch time",
+                         "Microseconds spent dispatching client requests",
+                         0, G_MAXUINT64, 0,
+                         G_PARAM_READABLE);
+
+  properties[PROP_NOTIFY_INTERVAL] =
+    g_param_spec_uint ("notify-interval", "Notify interval",
+                       "Minimum milliseconds between change notifications, 0 to disable them",
+                       0, G_MAXUINT, CASILDA_STATS_NOTIFY_INTERVAL,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+}
+
+/* Private API */
+
+CasildaStats *
+casilda_stats_new (void)
+{
+  return g_object_new (CASILDA_STATS_TYPE, NULL);
+}
+
+void
+casilda_stats_add_frame (CasildaStats *stats, gboolean rendered)
+{
+  if (rendered)
+    atomic_fetch_add_explicit (&stats->frames_rendered, 1, memory_order_relaxed);
+  else
+    atomic_fetch_add_explicit (&stats->frames_skipped, 1, memory_order_relaxed);
+
+  casilda_stats_changed (stats);
+}
+
+void
+casilda_stats_add_time (CasildaStats          *stats,
+                        CasildaStatsHistogram  histogram,
+                        gint64                 time)
+{
+  guint bucket = 0;
+
+  while (time > 0 && bucket < CASILDA_STATS_BUCKETS - 1)
+    {
+      time >>= 1;
+      bucket++;
+    }
+
+  atomic_fetch_add_explicit (&stats->histograms[histogram][bucket], 1, memory_order_relaxed);
+}
+
+void
+casilda_stats_add_damage (CasildaStats *stats, pixman_region32_t *damage)
+{
+  pixman_box32_t *rects;
+  guint64 pixels = 0;
+  int n_rects;
+
+  rects = pixman_region32_rectangles (damage, &n_rects);
+  for (int i = 0; i < n_rects; i++)
+    pixels += (guint64) (rects[i].x2 - rects[i].x1) * (rects[i].y2 - rects[i].y1);
+
+  if (!pixels)
+    return;
+
+  atomic_fetch_add_explicit (&stats->damaged_pixels, pixels, memory_order_relaxed);
+  casilda_stats_changed (stats);
+}
+
+void
+casilda_stats_add_dispatch_time (CasildaStats *stats, gint64 time)
+{
+  if (time <= 0)
+    return;
+
+  atomic_fetch_add_explicit (&stats->dispatch_time, time, memory_order_relaxed);
+  casilda_stats_changed (stats);
+}
+
+void
+casilda_stats_set_n_clients (CasildaStats *stats, guint n_clients)
+{
+  atomic_store_explicit (&stats->n_clients, n_clients, memory_order_relaxed);
+  casilda_stats_changed (stats);
+}
+
+/* Public API */
+
+guint64
+casilda_stats_get_frames_rendered (CasildaStats *stats)
+{
+  g_return_val_if_fail (CASILDA_IS_STATS (stats), 0);
+
+  return atomic_load_explicit (&stats->frames_rendered, memory_order_relaxed);
+}
+
+guint64
+casilda_stats_get_frames_skipped (CasildaStats *stats)
+{
+  g_return_val_if_fail (CASILDA_IS_STATS (stats), 0);
+
+  return atomic_load_explicit (&stats->frames_skipped, memory_order_relaxed);
+}
+
+guint64
+casilda_stats_get_damaged_pixels (CasildaStats *stats)
+{
+  g_return_val_if_fail (CASILDA_IS_STATS (stats), 0);
+
+  return atomic_load_explicit (&stats->damaged_pixels, memory_order_relaxed);
+}
+
+guint
+casilda_stats_get_n_clients (CasildaStats *stats)
+{
+  g_return_val_if_fail (CASILDA_IS_STATS (stats), 0);
+
+  return atomic_load_explicit (&stats->n_clients, memory_order_relaxed);
+}
+
+guint64
+casilda_stats_get_dispatch_time (CasildaStats *stats)
+{
+  g_return_val_if_fail (CASILDA_IS_STATS (stats), 0);
+
+  return atomic_load_explicit (&stats->dispatch_time, memory_order_relaxed);
+}
+
+/*
+ * Copy CASILDA_STATS_BUCKETS counters of histogram into buckets, see
+ * CASILDA_STATS_BUCKETS for the bucket ranges. Safe to call from any thread.
+ */
+void
+casilda_stats_get_histogram (CasildaStats          *stats,
+                             CasildaStatsHistogram  histogram,
+                             guint64               *buckets)
+{
+  g_return_if_fail (CASILDA_IS_STATS (stats));
+  g_return_if_fail (histogram < CASILDA_STATS_N_HISTOGRAMS);
+  g_return_if_fail (buckets != NULL);
+
+  for (guint i = 0; i < CASILDA_STATS_BUCKETS; i++)
+    buckets[i] = atomic_load_explicit (&stats->histograms[histogram][i], memory_order_relaxed);
+}
+
+/* Zero every counter, the number of clients is not a counter */
+void
+casilda_stats_reset (CasildaStats *stats)
+{
+  g_return_if_fail (CASILDA_IS_STATS (stats));
+
+  atomic_store_explicit (&stats->frames_rendered, 0, memory_order_relaxed);
+  atomic_store_explicit (&stats->frames_skipped, 0, memory_order_relaxed);
+  atomic_store_explicit (&stats->damaged_pixels, 0, memory_order_relaxed);
+  atomic_store_explicit (&stats->dispatch_time, 0, memory_order_relaxed);
+
+  for (guint h = 0; h < CASILDA_STATS_N_HISTOGRAMS; h++)
+    for (guint i = 0; i < CASILDA_STATS_BUCKETS; i++)
+      atomic_store_explicit (&stats->histograms[h][i], 0, memory_order_relaxed);
+
+  casilda_stats_changed (stats);
+}
+
+guint
+casilda_stats_get_notify_interval (CasildaStats *stats)
+{
+  g_return_val_if_fail (CASILDA_IS_STATS (stats), 0);
+
+  return stats->notify_interval;
+}
+
+void
+casilda_stats_set_notify_interval (CasildaStats *stats, guint interval)
+{
+  g_return_if_fail (CASILDA_IS_STATS (stats));
+
+  if (stats->notify_interval == interval)
+    return;
+
+  stats->notify_interval = interval;
+
+  /* Pending notifications use the new interval */
+  if (stats->notify_source)
+    {
+      g_clear_handle_id (&stats->notify_source, g_source_remove);
+      casilda_stats_changed (stats);
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (stats), properties[PROP_NOTIFY_INTERVAL]);
+}
@@ -0,0 +1,60 @@
+/*
+ * Casilda Performance Statistics
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+typedef enum
+{
+  CASILDA_STATS_BUILD_TIME,             /* Damage checks and offload decisions per frame */
+  CASILDA_STATS_RENDER_TIME,            /* Rendering the scene into the output buffer */
+  CASILDA_STATS_BLIT_TIME,              /* Importing the output buffer as a GdkTexture */
+  CASILDA_STATS_FRAME_CALLBACK_LATENCY, /* From painting a frame to each frame callback sent */
+
+  CASILDA_STATS_N_HISTOGRAMS
+} CasildaStatsHistogram;
+
+/* Bucket 0 counts times under 1µs, bucket N from 2^(N-1) to 2^N µs and the
+ * last one everything longer.
+ */
+#define CASILDA_STATS_BUCKETS 20
+
+#define CASILDA_STATS_TYPE (casilda_stats_get_type ())
+G_DECLARE_FINAL_TYPE (CasildaStats, casilda_stats, CASILDA, STATS, GObject)
+
+guint64 casilda_stats_get_frames_rendered (CasildaStats          *stats);
+guint64 casilda_stats_get_frames_skipped  (CasildaStats          *stats);
+guint64 casilda_stats_get_damaged_pixels  (CasildaStats          *stats);
+guint   casilda_stats_get_n_clients       (CasildaStats          *stats);
+guint64 casilda_stats_get_dispatch_time   (CasildaStats          *stats);
+void    casilda_stats_get_histogram       (CasildaStats          *stats,
+                                           CasildaStatsHistogram  histogram,
+                                           guint64               *buckets);
+void    casilda_stats_reset               (CasildaStats          *stats);
+
+guint   casilda_stats_get_notify_interval (CasildaStats          *stats);
+void    casilda_stats_set_notify_interval (CasildaStats          *stats,
+                                           guint                  interval);
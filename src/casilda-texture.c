@@ -0,0 +1,495 @@
+/*
+ * Casilda Texture Import
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <drm_fourcc.h>
+#include <epoxy/egl.h>
+#include <epoxy/gl.h>
+#include <wlr/render/pixman.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+
+#include "casilda-texture.h"
+
+/*
+ * Client buffers as GdkTextures. The wlr_buffer is locked for as long as GTK
+ * uses the texture, which also keeps wlroots from updating a client buffer
+ * in place, so the pixels never change under GTK.
+ */
+
+static void
+on_texture_destroy (gpointer data)
+{
+  wlr_buffer_unlock (data);
+}
+
+/* Whether damage can be set as the update region of previous */
+static gboolean
+casilda_texture_can_update (GdkTexture              *previous,
+                            const pixman_region32_t *damage,
+                            gint                     width,
+                            gint                     height)
+{
+  return previous && damage &&
+         gdk_texture_get_width (previous) == width &&
+         gdk_texture_get_height (previous) == height;
+}
+
+static cairo_region_t *
+casilda_texture_region_new (const pixman_region32_t *damage)
+{
+  cairo_region_t *region = cairo_region_create ();
+  const pixman_box32_t *rects;
+  int n_rects;
+
+  rects = pixman_region32_rectangles ((pixman_region32_t *) damage, &n_rects);
+  for (gint i = 0; i < n_rects; i++)
+    cairo_region_union_rectangle (region, &(cairo_rectangle_int_t) {
+                                    rects[i].x1,
+                                    rects[i].y1,
+                                    rects[i].x2 - rects[i].x1,
+                                    rects[i].y2 - rects[i].y1
+                                  });
+
+  return region;
+}
+
+/*
+ * Import a dmabuf as is. If previous is set, damage is what changed since
+ * then and GTK only redraws that.
+ */
+GdkTexture *
+casilda_texture_import_dmabuf (GdkDisplay               *display,
+                               struct wlr_buffer        *buffer,
+                               GdkTexture               *previous,
+                               const pixman_region32_t  *damage,
+                               GError                  **error)
+{
+  g_autoptr(GdkDmabufTextureBuilder) builder = NULL;
+  struct wlr_dmabuf_attributes attribs;
+  GdkTexture *texture;
+
+  if (!wlr_buffer_get_dmabuf (buffer, &attribs))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not a dmabuf");
+      return NULL;
+    }
+
+  builder = gdk_dmabuf_texture_builder_new ();
+  gdk_dmabuf_texture_builder_set_display (builder, display);
+  gdk_dmabuf_texture_builder_set_width (builder, attribs.width);
+  gdk_dmabuf_texture_builder_set_height (builder, attribs.height);
+  gdk_dmabuf_texture_builder_set_fourcc (builder, attribs.format);
+  gdk_dmabuf_texture_builder_set_modifier (builder, attribs.modifier);
+  gdk_dmabuf_texture_builder_set_n_planes (builder, attribs.n_planes);
+
+  for (gint i = 0; i < attribs.n_planes; i++)
+    {
+      gdk_dmabuf_texture_builder_set_fd (builder, i, attribs.fd[i]);
+      gdk_dmabuf_texture_builder_set_offset (builder, i, attribs.offset[i]);
+      gdk_dmabuf_texture_builder_set_stride (builder, i, attribs.stride[i]);
+    }
+
+  if (casilda_texture_can_update (previous, damage, attribs.width, attribs.height))
+    {
+      cairo_region_t *region = casilda_texture_region_new (damage);
+
+      gdk_dmabuf_texture_builder_set_update_texture (builder, previous);
+      gdk_dmabuf_texture_builder_set_update_region (builder, region);
+      cairo_region_destroy (region);
+    }
+
+  wlr_buffer_lock (buffer);
+
+  if (!(texture = gdk_dmabuf_texture_builder_build (builder, on_texture_destroy, buffer, error)))
+    wlr_buffer_unlock (buffer);
+
+  return texture;
+}
+
+typedef struct
+{
+  GdkGLContext      *context;
+  EGLDisplay         display;
+  EGLImageKHR        image;
+  GLuint             id;
+  GLsync             sync;
+  struct wlr_buffer *buffer;
+} CasildaTextureGL;
+
+static void
+casilda_texture_gl_free (gpointer data)
+{
+  CasildaTextureGL *gl = data;
+
+  gdk_gl_context_make_current (gl->context);
+
+  if (gl->sync)
+    glDeleteSync (gl->sync);
+
+  glDeleteTextures (1, &gl->id);
+  eglDestroyImageKHR (gl->display, gl->image);
+
+  g_object_unref (gl->context);
+  wlr_buffer_unlock (gl->buffer);
+  g_free (gl);
+}
+
+static EGLImageKHR
+casilda_texture_create_image (EGLDisplay                    display,
+                              struct wlr_dmabuf_attributes *attribs)
+{
+  static const EGLint plane_attribs[4][5] = {
+    {
+      EGL_DMA_BUF_PLANE0_FD_EXT,
+      EGL_DMA_BUF_PLANE0_OFFSET_EXT,
+      EGL_DMA_BUF_PLANE0_PITCH_EXT,
+      EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT,
+      EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT
+    },
+    {
+      EGL_DMA_BUF_PLANE1_FD_EXT,
+      EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+      EGL_DMA_BUF_PLANE1_PITCH_EXT,
+      EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+      EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT
+    },
+    {
+      EGL_DMA_BUF_PLANE2_FD_EXT,
+      EGL_DMA_BUF_PLANE2_OFFSET_EXT,
+      EGL_DMA_BUF_PLANE2_PITCH_EXT,
+      EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT,
+      EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT
+    },
+    {
+      EGL_DMA_BUF_PLANE3_FD_EXT,
+      EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+      EGL_DMA_BUF_PLANE3_PITCH_EXT,
+      EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+      EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT
+    },
+  };
+  gboolean modifiers = attribs->modifier != DRM_FORMAT_MOD_INVALID;
+  EGLint egl_attribs[6 + 4 * 10 + 1];
+  gint n = 0;
+
+  if (modifiers && !epoxy_has_egl_extension (display, "EGL_EXT_image_dma_buf_import_modifiers"))
+    return EGL_NO_IMAGE_KHR;
+
+  egl_attribs[n++] = EGL_WIDTH;
+  egl_attribs[n++] = attribs->width;
+  egl_attribs[n++] = EGL_HEIGHT;
+  egl_attribs[n++] = attribs->height;
+  egl_attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+  egl_attribs[n++] = attribs->format;
+
+  for (gint i = 0; i < attribs->n_planes; i++)
+    {
+      egl_attribs[n++] = plane_attribs[i][0];
+      egl_attribs[n++] = attribs->fd[i];
+      egl_attribs[n++] = plane_attribs[i][1];
+      egl_attribs[n++] = attribs->offset[i];
+      egl_attribs[n++] = plane_attribs[i][2];
+      egl_attribs[n++] = attribs->stride[i];
+
+      if (modifiers)
+        {
+          egl_attribs[n++] = plane_attribs[i][3];
+          egl_attribs[n++] = attribs->modifier & 0xFFFFFFFF;
+          egl_attribs[n++] = plane_attribs[i][4];
+          egl_attribs[n++] = attribs->modifier >> 32;
+        }
+    }
+
+  egl_attribs[n++] = EGL_NONE;
+
+  return eglCreateImageKHR (display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, egl_attribs);
+}
+
+/*
+ * Bind a dmabuf rendered by the compositor to a texture in context, so GTK
+ * renders it without leaving the GPU. damage is what changed since previous,
+ * GTK only has to redraw that.
+ */
+GdkTexture *
+casilda_texture_import_gl (GdkGLContext             *context,
+                           struct wlr_buffer        *buffer,
+                           GdkTexture               *previous,
+                           const pixman_region32_t  *damage,
+                           GError                  **error)
+{
+  g_autoptr(GdkGLTextureBuilder) builder = NULL;
+  struct wlr_dmabuf_attributes attribs;
+  CasildaTextureGL *gl;
+  EGLDisplay display;
+  gboolean has_sync;
+
+  if (!wlr_buffer_get_dmabuf (buffer, &attribs))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not a dmabuf");
+      return NULL;
+    }
+
+  gdk_gl_context_make_current (context);
+
+  /* GLX contexts can not import dmabufs */
+  if ((display = eglGetCurrentDisplay ()) == EGL_NO_DISPLAY ||
+      !epoxy_has_egl_extension (display, "EGL_EXT_image_dma_buf_import"))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "No EGL dmabuf import");
+      return NULL;
+    }
+
+  gl = g_new0 (CasildaTextureGL, 1);
+  gl->display = display;
+
+  if ((gl->image = casilda_texture_create_image (display, &attribs)) == EGL_NO_IMAGE_KHR)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "Could not create EGLImage: 0x%x", eglGetError ());
+      g_free (gl);
+      return NULL;
+    }
+
+  glGenTextures (1, &gl->id);
+  glBindTexture (GL_TEXTURE_2D, gl->id);
+  glEGLImageTargetTexture2DOES (GL_TEXTURE_2D, gl->image);
+  glBindTexture (GL_TEXTURE_2D, 0);
+
+  /* Fence the binding, GTK waits on it instead of a glFinish () here */
+  has_sync = epoxy_has_gl_extension ("GL_ARB_sync") ||
+             epoxy_gl_version () >= (epoxy_is_desktop_gl () ? 32 : 30);
+  if (has_sync)
+    gl->sync = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  glFlush ();
+
+  gl->context = g_object_ref (context);
+  gl->buffer = wlr_buffer_lock (buffer);
+
+  builder = gdk_gl_texture_builder_new ();
+  gdk_gl_texture_builder_set_context (builder, context);
+  gdk_gl_texture_builder_set_id (builder, gl->id);
+  gdk_gl_texture_builder_set_width (builder, attribs.width);
+  gdk_gl_texture_builder_set_height (builder, attribs.height);
+  gdk_gl_texture_builder_set_sync (builder, gl->sync);
+
+  /* GL samples every format as RGBA */
+  if (attribs.format == DRM_FORMAT_XRGB8888 || attribs.format == DRM_FORMAT_XBGR8888)
+    gdk_gl_texture_builder_set_format (builder, GDK_MEMORY_R8G8B8X8);
+  else
+    gdk_gl_texture_builder_set_format (builder, GDK_MEMORY_R8G8B8A8_PREMULTIPLIED);
+
+  if (casilda_texture_can_update (previous, damage, attribs.width, attribs.height))
+    {
+      cairo_region_t *region = casilda_texture_region_new (damage);
+
+      gdk_gl_texture_builder_set_update_texture (builder, previous);
+      gdk_gl_texture_builder_set_update_region (builder, region);
+      cairo_region_destroy (region);
+    }
+
+  return gdk_gl_texture_builder_build (builder, casilda_texture_gl_free, gl);
+}
+
+/*
+ * GTK memory format with the same layout as a DRM format, GTK uploads them
+ * as is.
+ */
+gboolean
+casilda_texture_get_memory_format (guint32 format, GdkMemoryFormat *retval)
+{
+  /* DRM formats are little endian */
+  switch (format)
+    {
+    case DRM_FORMAT_ARGB8888:
+      *retval = GDK_MEMORY_B8G8R8A8_PREMULTIPLIED;
+      return TRUE;
+
+    case DRM_FORMAT_XRGB8888:
+      *retval = GDK_MEMORY_B8G8R8X8;
+      return TRUE;
+
+    case DRM_FORMAT_ABGR8888:
+      *retval = GDK_MEMORY_R8G8B8A8_PREMULTIPLIED;
+      return TRUE;
+
+    case DRM_FORMAT_XBGR8888:
+      *retval = GDK_MEMORY_R8G8B8X8;
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+}
+
+/*
+ * Wrap a buffer rendered by the compositor, dmabufs are imported with damage
+ * as their update region and buffers in memory are handed to GTK as is.
+ * Dmabufs GTK can not import are read from memory if they can be mapped.
+ */
+GdkTexture *
+casilda_texture_import_buffer (GdkDisplay               *display,
+                               struct wlr_buffer        *buffer,
+                               GdkTexture               *previous,
+                               const pixman_region32_t  *damage,
+                               GError                  **error)
+{
+  struct wlr_dmabuf_attributes attribs;
+  g_autoptr(GError) dmabuf_error = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  GdkMemoryFormat memory_format;
+  GdkTexture *texture;
+  uint32_t format;
+  gsize stride;
+  void *data;
+
+  if (wlr_buffer_get_dmabuf (buffer, &attribs))
+    {
+      if ((texture = casilda_texture_import_dmabuf (display, buffer, previous, damage, &dmabuf_error)))
+        return texture;
+
+      g_debug ("%s could not import dmabuf: %s", __func__, dmabuf_error->message);
+    }
+
+  if (!wlr_buffer_begin_data_ptr_access (buffer, WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                         &data, &format, &stride))
+    {
+      if (dmabuf_error)
+        g_propagate_error (error, g_steal_pointer (&dmabuf_error));
+      else
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Buffer has no data pointer");
+      return NULL;
+    }
+
+  /* The pointer stays valid for as long as the buffer is alive */
+  wlr_buffer_end_data_ptr_access (buffer);
+
+  if (!casilda_texture_get_memory_format (format, &memory_format))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Unsupported buffer format 0x%08x", format);
+      return NULL;
+    }
+
+  bytes = g_bytes_new_with_free_func (data,
+                                      stride * buffer->height,
+                                      on_texture_destroy,
+                                      wlr_buffer_lock (buffer));
+
+  return gdk_memory_texture_new (buffer->width, buffer->height, memory_format, bytes, stride);
+}
+
+static gboolean
+casilda_texture_memory_format (pixman_format_code_t format, GdkMemoryFormat *retval)
+{
+  switch (format)
+    {
+    case PIXMAN_a8r8g8b8:
+      *retval = G_BYTE_ORDER == G_LITTLE_ENDIAN ?
+                GDK_MEMORY_B8G8R8A8_PREMULTIPLIED : GDK_MEMORY_A8R8G8B8_PREMULTIPLIED;
+      return TRUE;
+
+    case PIXMAN_x8r8g8b8:
+      *retval = G_BYTE_ORDER == G_LITTLE_ENDIAN ? GDK_MEMORY_B8G8R8X8 : GDK_MEMORY_X8R8G8B8;
+      return TRUE;
+
+    case PIXMAN_a8b8g8r8:
+      *retval = G_BYTE_ORDER == G_LITTLE_ENDIAN ?
+                GDK_MEMORY_R8G8B8A8_PREMULTIPLIED : GDK_MEMORY_A8B8G8R8_PREMULTIPLIED;
+      return TRUE;
+
+    case PIXMAN_x8b8g8r8:
+      *retval = G_BYTE_ORDER == G_LITTLE_ENDIAN ? GDK_MEMORY_R8G8B8X8 : GDK_MEMORY_X8B8G8R8;
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+}
+
+/*
+ * Wrap the client buffer without copying: dmabufs are imported as is and
+ * pixman textures are handed to GTK as memory textures pointing to their
+ * pixels. Anything else is read back.
+ */
+GdkTexture *
+casilda_texture_import_client_buffer (GdkDisplay                *display,
+                                      struct wlr_client_buffer  *buffer,
+                                      GError                   **error)
+{
+  struct wlr_texture *texture = buffer->texture;
+  struct wlr_dmabuf_attributes attribs;
+  g_autoptr(GBytes) bytes = NULL;
+  GdkMemoryFormat format;
+  pixman_image_t *image;
+  gsize stride, size;
+  guint8 *data;
+
+  if (buffer->source && wlr_buffer_get_dmabuf (buffer->source, &attribs))
+    return casilda_texture_import_dmabuf (display, buffer->source, NULL, NULL, error);
+
+  if (wlr_texture_is_pixman (texture) &&
+      (image = wlr_pixman_texture_get_image (texture)) &&
+      casilda_texture_memory_format (pixman_image_get_format (image), &format))
+    {
+      stride = pixman_image_get_stride (image);
+      size = stride * pixman_image_get_height (image);
+
+      /* The client buffer owns the texture that owns the pixels */
+      bytes = g_bytes_new_with_free_func (pixman_image_get_data (image),
+                                          size,
+                                          on_texture_destroy,
+                                          wlr_buffer_lock (&buffer->base));
+
+      return gdk_memory_texture_new (texture->width, texture->height, format, bytes, stride);
+    }
+
+  /* Renderer textures we can not share */
+  stride = (gsize) texture->width * 4;
+  size = stride * texture->height;
+  data = g_malloc (size);
+
+  if (!wlr_texture_read_pixels (texture, &(struct wlr_texture_read_pixels_options) {
+                                  .data = data,
+                                  .format = DRM_FORMAT_ARGB8888,
+                                  .stride = stride,
+                                }))
+    {
+      g_free (data);
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Could not read texture pixels");
+      return NULL;
+    }
+
+  bytes = g_bytes_new_take (data, size);
+
+  /* DRM_FORMAT_ARGB8888 is B, G, R, A in memory */
+  return gdk_memory_texture_new (texture->width,
+                                 texture->height,
+                                 GDK_MEMORY_B8G8R8A8_PREMULTIPLIED,
+                                 bytes,
+                                 stride);
+}
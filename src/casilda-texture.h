@@ -0,0 +1,53 @@
+/*
+ * Casilda Texture Import
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <gtk/gtk.h>
+#include <pixman.h>
+
+struct wlr_buffer;
+struct wlr_client_buffer;
+
+GdkTexture *casilda_texture_import_dmabuf        (GdkDisplay               *display,
+                                                  struct wlr_buffer        *buffer,
+                                                  GdkTexture               *previous,
+                                                  const pixman_region32_t  *damage,
+                                                  GError                  **error);
+GdkTexture *casilda_texture_import_gl            (GdkGLContext             *context,
+                                                  struct wlr_buffer        *buffer,
+                                                  GdkTexture               *previous,
+                                                  const pixman_region32_t  *damage,
+                                                  GError                  **error);
+GdkTexture *casilda_texture_import_buffer        (GdkDisplay               *display,
+                                                  struct wlr_buffer        *buffer,
+                                                  GdkTexture               *previous,
+                                                  const pixman_region32_t  *damage,
+                                                  GError                  **error);
+GdkTexture *casilda_texture_import_client_buffer (GdkDisplay               *display,
+                                                  struct wlr_client_buffer *buffer,
+                                                  GError                  **error);
+gboolean    casilda_texture_get_memory_format    (guint32                   format,
+                                                  GdkMemoryFormat          *retval);
@@ -0,0 +1,191 @@
+/*
+ * Casilda Thumbnail Scaler
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define G_LOG_DOMAIN "Casilda"
+
+#include <string.h>
+
+#include "casilda-thumbnail.h"
+
+/*
+ * Box filter downscaler for 32 bit premultiplied pixels.
+ *
+ * Destination pixel dx covers source columns [dx * sw / dw, (dx + 1) * sw / dw)
+ * and the same for rows, so the ranges partition the source exactly and any
+ * destination rectangle can be updated on its own from the matching source
+ * rectangle.
+ *
+ * Four pixels are loaded at once and their channels accumulated in 16 bit
+ * lanes, folded into 32 bit per channel sums before they can overflow. With
+ * the compiler vector extensions this turns into SSE2 or NEON code without
+ * any special build flags.
+ */
+
+#if defined(__GNUC__) && (defined(__clang__) || __GNUC__ >= 9)
+
+typedef guint8  CasildaPixel     __attribute__ ((vector_size (4)));
+typedef guint16 CasildaPixel16   __attribute__ ((vector_size (8)));
+typedef guint32 CasildaPixelSum  __attribute__ ((vector_size (16)));
+typedef guint8  CasildaPixels    __attribute__ ((vector_size (16)));
+typedef guint16 CasildaPixelsSum __attribute__ ((vector_size (32)));
+
+/* 16 bit lanes hold this many additions of 255 */
+#define CASILDA_THUMBNAIL_MAX_RUN 256
+
+/* Add up the four pixels of the 16 bit lanes into one per channel sum */
+static inline CasildaPixelSum
+casilda_thumbnail_fold (const CasildaPixelsSum *sums)
+{
+  CasildaPixelSum retval = { 0, 0, 0, 0 };
+  CasildaPixel16 pixels[4];
+
+  memcpy (pixels, sums, sizeof (pixels));
+
+  for (gint i = 0; i < 4; i++)
+    retval += __builtin_convertvector (pixels[i], CasildaPixelSum);
+
+  return retval;
+}
+
+static inline void
+casilda_thumbnail_box (const guint8 *src,
+                       gsize         src_stride,
+                       gint          width,
+                       gint          height,
+                       guint8       *dst)
+{
+  CasildaPixelSum sum = { 0, 0, 0, 0 };
+  guint32 n = width * height;
+  gint width4 = width & ~3;
+  CasildaPixels pixels;
+  CasildaPixel pixel;
+
+  for (gint y = 0; y < height; y++, src += src_stride)
+    {
+      const guint8 *p = src;
+      gint x = 0;
+
+      while (x < width4)
+        {
+          CasildaPixelsSum row = { 0, };
+          gint end = MIN (width4, x + 4 * CASILDA_THUMBNAIL_MAX_RUN);
+
+          for (; x < end; x += 4, p += 16)
+            {
+              memcpy (&pixels, p, sizeof (pixels));
+              row += __builtin_convertvector (pixels, CasildaPixelsSum);
+            }
+
+          sum += casilda_thumbnail_fold (&row);
+        }
+
+      for (; x < width; x++, p += 4)
+        {
+          memcpy (&pixel, p, sizeof (pixel));
+          sum += __builtin_convertvector (pixel, CasildaPixelSum);
+        }
+    }
+
+  /* Round to nearest */
+  sum = (sum + n / 2) / n;
+  pixel = __builtin_convertvector (sum, CasildaPixel);
+  memcpy (dst, &pixel, sizeof (pixel));
+}
+
+#else
+
+static inline void
+casilda_thumbnail_box (const guint8 *src,
+                       gsize         src_stride,
+                       gint          width,
+                       gint          height,
+                       guint8       *dst)
+{
+  guint32 sum[4] = { 0, 0, 0, 0 };
+  guint32 n = width * height;
+
+  for (gint y = 0; y < height; y++, src += src_stride)
+    {
+      const guint8 *p = src;
+
+      for (gint x = 0; x < width; x++, p += 4)
+        {
+          sum[0] += p[0];
+          sum[1] += p[1];
+          sum[2] += p[2];
+          sum[3] += p[3];
+        }
+    }
+
+  for (gint c = 0; c < 4; c++)
+    dst[c] = (sum[c] + n / 2) / n;
+}
+
+#endif
+
+/*
+ * Update the x, y, width, height rectangle of dst, a dst_width x dst_height
+ * thumbnail of a src_width x src_height image.
+ * src only has to cover the source rectangle of the updated pixels and
+ * starts at src_x, src_y in source coordinates.
+ */
+void
+casilda_thumbnail_scale (const guint8 *src,
+                         gsize         src_stride,
+                         gint          src_x,
+                         gint          src_y,
+                         gint          src_width,
+                         gint          src_height,
+                         guint8       *dst,
+                         gsize         dst_stride,
+                         gint          dst_width,
+                         gint          dst_height,
+                         gint          x,
+                         gint          y,
+                         gint          width,
+                         gint          height)
+{
+  g_return_if_fail (dst_width <= src_width && dst_height <= src_height);
+
+  for (gint dy = y; dy < y + height; dy++)
+    {
+      gint sy0 = (gint64) dy * src_height / dst_height;
+      gint sy1 = (gint64) (dy + 1) * src_height / dst_height;
+      const guint8 *row = src + (gsize) (sy0 - src_y) * src_stride;
+      guint8 *out = dst + (gsize) dy * dst_stride + (gsize) x * 4;
+
+      for (gint dx = x; dx < x + width; dx++, out += 4)
+        {
+          gint sx0 = (gint64) dx * src_width / dst_width;
+          gint sx1 = (gint64) (dx + 1) * src_width / dst_width;
+
+          casilda_thumbnail_box (row + (gsize) (sx0 - src_x) * 4,
+                                 src_stride,
+                                 sx1 - sx0,
+                                 sy1 - sy0,
+                                 out);
+        }
+    }
+}
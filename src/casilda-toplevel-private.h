@@ -0,0 +1,37 @@
+/*
+ * Casilda Wayland Compositor Widget
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include "casilda-toplevel.h"
+
+struct wlr_xdg_toplevel;
+
+CasildaToplevel *casilda_toplevel_new       (struct wlr_xdg_toplevel *xdg_toplevel,
+                                             GdkDisplay              *display);
+void             casilda_toplevel_commit    (CasildaToplevel         *toplevel);
+void             casilda_toplevel_unmapped  (CasildaToplevel         *toplevel);
+void             casilda_toplevel_destroyed (CasildaToplevel         *toplevel);
+guint            casilda_toplevel_trim      (CasildaToplevel         *toplevel);
@@ -0,0 +1,697 @@
+/*
+ * Casilda Wayland Compositor Widget
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <drm_fourcc.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_xdg_shell.h>
+
+#include "casilda-client-private.h"
+#include "casilda-texture.h"
+#include "casilda-thumbnail.h"
+#include "casilda-toplevel-private.h"
+
+/* Longest side of the thumbnail */
+#define CASILDA_TOPLEVEL_THUMBNAIL_SIZE 128
+
+/* Thumbnails are refreshed at most this often */
+#define CASILDA_TOPLEVEL_THUMBNAIL_INTERVAL_MS 500
+
+/* A surface of the toplevel tree and the texture of its current buffer */
+typedef struct
+{
+  CasildaToplevel          *toplevel;
+  struct wlr_surface       *surface;
+  struct wlr_client_buffer *buffer;
+  GdkTexture               *texture;
+  gboolean                  seen;
+
+  struct wl_listener        commit;
+  struct wl_listener        destroy;
+} CasildaToplevelSurface;
+
+struct _CasildaToplevel
+{
+  GObject parent;
+
+  struct wlr_xdg_toplevel *xdg_toplevel;
+  GdkDisplay              *display;
+
+  /* Paintable, surfaces seen in the last snapshot */
+  GHashTable              *surfaces;
+  gint                     width, height;
+
+  /* Thumbnail, only kept up to date once requested */
+  gboolean                 thumbnail_wanted;
+  GdkTexture              *thumbnail;
+  guint8                  *thumbnail_data;
+  gint                     thumbnail_width, thumbnail_height;
+  gint                     source_width, source_height;
+  pixman_region32_t        thumbnail_damage;
+  gint64                   thumbnail_time;
+  guint                    thumbnail_source;
+
+  /* Frame callbacks per second, 0 for no limit */
+  guint                    max_frame_rate;
+};
+
+enum {
+  PROP_0,
+  PROP_APP_ID,
+  PROP_TITLE,
+  PROP_CLIENT,
+  PROP_THUMBNAIL,
+  PROP_MAX_FRAME_RATE,
+
+  N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES];
+
+static void casilda_toplevel_paintable_init (GdkPaintableInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (CasildaToplevel, casilda_toplevel, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (GDK_TYPE_PAINTABLE,
+                                                casilda_toplevel_paintable_init));
+
+
+static void
+casilda_toplevel_surface_free (CasildaToplevelSurface *entry)
+{
+  wl_list_remove (&entry->commit.link);
+  wl_list_remove (&entry->destroy.link);
+  g_clear_object (&entry->texture);
+  g_free (entry);
+}
+
+static void
+on_surface_commit (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaToplevelSurface *entry = wl_container_of (listener, entry, commit);
+
+  /* Buffers read back are not locked and can be updated in place */
+  if (entry->surface->current.committed & WLR_SURFACE_STATE_BUFFER)
+    entry->buffer = NULL;
+
+  gdk_paintable_invalidate_contents (GDK_PAINTABLE (entry->toplevel));
+}
+
+static void
+on_surface_destroy (struct wl_listener *listener, G_GNUC_UNUSED void *data)
+{
+  CasildaToplevelSurface *entry = wl_container_of (listener, entry, destroy);
+  CasildaToplevel *toplevel = entry->toplevel;
+
+  g_hash_table_remove (toplevel->surfaces, entry->surface);
+  gdk_paintable_invalidate_contents (GDK_PAINTABLE (toplevel));
+}
+
+static CasildaToplevelSurface *
+casilda_toplevel_surface_get (CasildaToplevel *toplevel, struct wlr_surface *surface)
+{
+  CasildaToplevelSurface *entry;
+
+  if ((entry = g_hash_table_lookup (toplevel->surfaces, surface)))
+    return entry;
+
+  entry = g_new0 (CasildaToplevelSurface, 1);
+  entry->toplevel = toplevel;
+  entry->surface = surface;
+
+  entry->commit.notify = on_surface_commit;
+  wl_signal_add (&surface->events.commit, &entry->commit);
+  entry->destroy.notify = on_surface_destroy;
+  wl_signal_add (&surface->events.destroy, &entry->destroy);
+
+  g_hash_table_insert (toplevel->surfaces, surface, entry);
+
+  return entry;
+}
+
+static void
+casilda_toplevel_init (CasildaToplevel *toplevel)
+{
+  toplevel->surfaces = g_hash_table_new_full (NULL,
+                                              NULL,
+                                              NULL,
+                                              (GDestroyNotify) casilda_toplevel_surface_free);
+  pixman_region32_init (&toplevel->thumbnail_damage);
+}
+
+static void
+casilda_toplevel_finalize (GObject *object)
+{
+  CasildaToplevel *toplevel = CASILDA_TOPLEVEL (object);
+
+  g_clear_pointer (&toplevel->surfaces, g_hash_table_destroy);
+  g_clear_object (&toplevel->display);
+  g_clear_handle_id (&toplevel->thumbnail_source, g_source_remove);
+  g_clear_object (&toplevel->thumbnail);
+  g_clear_pointer (&toplevel->thumbnail_data, g_free);
+  pixman_region32_fini (&toplevel->thumbnail_damage);
+
+  G_OBJECT_CLASS (casilda_toplevel_parent_class)->finalize (object);
+}
+
+static void
+casilda_toplevel_get_property (GObject    *object,
+                               guint       prop_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+  CasildaToplevel *toplevel = CASILDA_TOPLEVEL (object);
+
+  switch (prop_id)
+    {
+    case PROP_APP_ID:
+      g_value_set_string (value, casilda_toplevel_get_app_id (toplevel));
+      break;
+
+    case PROP_TITLE:
+      g_value_set_string (value, casilda_toplevel_get_title (toplevel));
+      break;
+
+    case PROP_CLIENT:
+      g_value_set_object (value, casilda_toplevel_get_client (toplevel));
+      break;
+
+    case PROP_THUMBNAIL:
+      g_value_set_object (value, casilda_toplevel_get_thumbnail (toplevel));
+      break;
+
+    case PROP_MAX_FRAME_RATE:
+      g_value_set_uint (value, toplevel->max_frame_rate);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+casilda_toplevel_set_property (GObject      *object,
+                               guint         prop_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  CasildaToplevel *toplevel = CASILDA_TOPLEVEL (object);
+
+  switch (prop_id)
+    {
+    case PROP_MAX_FRAME_RATE:
+      toplevel->max_frame_rate = g_value_get_uint (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+    }
+}
+
+static void
+casilda_toplevel_class_init (CasildaToplevelClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = casilda_toplevel_finalize;
+  object_class->get_property = casilda_toplevel_get_property;
+  object_class->set_property = casilda_toplevel_set_property;
+
+  properties[PROP_APP_ID] =
+    g_param_spec_string ("app-id", "Application ID",
+                         "The toplevel application id",
+                         NULL,
+                         G_PARAM_READABLE);
+
+  properties[PROP_TITLE] =
+    g_param_spec_string ("title", "Title",
+                         "The toplevel title",
+                         NULL,
+                         G_PARAM_READABLE);
+
+  properties[PROP_CLIENT] =
+    g_param_spec_object ("client", "Client",
+                         "The client this toplevel belongs to",
+                         CASILDA_CLIENT_TYPE,
+                         G_PARAM_READABLE);
+
+  properties[PROP_THUMBNAIL] =
+    g_param_spec_object ("thumbnail", "Thumbnail",
+                         "A small snapshot of the toplevel contents",
+                         GDK_TYPE_TEXTURE,
+                         G_PARAM_READABLE);
+
+  properties[PROP_MAX_FRAME_RATE] =
+    g_param_spec_uint ("max-frame-rate", "Max frame rate",
+                       "Frame callbacks per second for this toplevel, 0 for no limit",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READABLE|G_PARAM_WRITABLE);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+}
+
+/* Paintable */
+
+typedef struct
+{
+  CasildaToplevel *toplevel;
+  GtkSnapshot     *snapshot;
+} CasildaToplevelSnapshot;
+
+static void
+casilda_toplevel_snapshot_surface (struct wlr_surface *surface,
+                                   int                 sx,
+                                   int                 sy,
+                                   void               *user_data)
+{
+  CasildaToplevelSnapshot *data = user_data;
+  CasildaToplevelSurface *entry = casilda_toplevel_surface_get (data->toplevel, surface);
+  g_autoptr(GError) error = NULL;
+
+  entry->seen = TRUE;
+
+  if (!surface->buffer)
+    return;
+
+  /* Import each client buffer once, straight from its memory */
+  if (entry->buffer != surface->buffer)
+    {
+      g_clear_object (&entry->texture);
+      entry->buffer = NULL;
+
+      if (!(entry->texture = casilda_texture_import_client_buffer (data->toplevel->display,
+                                                                   surface->buffer,
+                                                                   &error)))
+        {
+          g_debug ("%s could not import buffer: %s", __func__, error->message);
+          return;
+        }
+
+      entry->buffer = surface->buffer;
+    }
+
+  gtk_snapshot_append_texture (data->snapshot,
+                               entry->texture,
+                               &GRAPHENE_RECT_INIT (sx, sy,
+                                                    surface->current.width,
+                                                    surface->current.height));
+}
+
+static gboolean
+casilda_toplevel_surface_unseen (G_GNUC_UNUSED gpointer key,
+                                 gpointer               value,
+                                 G_GNUC_UNUSED gpointer user_data)
+{
+  CasildaToplevelSurface *entry = value;
+  gboolean retval = !entry->seen;
+
+  entry->seen = FALSE;
+
+  return retval;
+}
+
+static void
+casilda_toplevel_snapshot (GdkPaintable *paintable,
+                           GdkSnapshot  *snapshot,
+                           double        width,
+                           double        height)
+{
+  CasildaToplevel *toplevel = CASILDA_TOPLEVEL (paintable);
+  CasildaToplevelSnapshot data = { toplevel, GTK_SNAPSHOT (snapshot) };
+  struct wlr_xdg_surface *xdg_surface;
+  struct wlr_box box;
+
+  if (!toplevel->xdg_toplevel || !toplevel->xdg_toplevel->base->surface->mapped)
+    return;
+
+  xdg_surface = toplevel->xdg_toplevel->base;
+  wlr_xdg_surface_get_geometry (xdg_surface, &box);
+
+  if (wlr_box_empty (&box))
+    return;
+
+  gtk_snapshot_save (data.snapshot);
+  gtk_snapshot_scale (data.snapshot, width / box.width, height / box.height);
+  gtk_snapshot_translate (data.snapshot, &GRAPHENE_POINT_INIT (-box.x, -box.y));
+
+  wlr_xdg_surface_for_each_surface (xdg_surface, casilda_toplevel_snapshot_surface, &data);
+
+  gtk_snapshot_restore (data.snapshot);
+
+  /* Forget surfaces no longer part of the tree and their buffers */
+  g_hash_table_foreach_remove (toplevel->surfaces, casilda_toplevel_surface_unseen, NULL);
+}
+
+static GdkPaintable *
+casilda_toplevel_get_current_image (GdkPaintable *paintable)
+{
+  CasildaToplevel *toplevel = CASILDA_TOPLEVEL (paintable);
+  GtkSnapshot *snapshot = gtk_snapshot_new ();
+
+  casilda_toplevel_snapshot (paintable, snapshot, toplevel->width, toplevel->height);
+
+  return gtk_snapshot_free_to_paintable (snapshot,
+                                         &GRAPHENE_SIZE_INIT (toplevel->width, toplevel->height));
+}
+
+static int
+casilda_toplevel_get_intrinsic_width (GdkPaintable *paintable)
+{
+  return CASILDA_TOPLEVEL (paintable)->width;
+}
+
+static int
+casilda_toplevel_get_intrinsic_height (GdkPaintable *paintable)
+{
+  return CASILDA_TOPLEVEL (paintable)->height;
+}
+
+static void
+casilda_toplevel_paintable_init (GdkPaintableInterface *iface)
+{
+  iface->snapshot = casilda_toplevel_snapshot;
+  iface->get_current_image = casilda_toplevel_get_current_image;
+  iface->get_intrinsic_width = casilda_toplevel_get_intrinsic_width;
+  iface->get_intrinsic_height = casilda_toplevel_get_intrinsic_height;
+}
+
+static void
+casilda_toplevel_update_size (CasildaToplevel *toplevel)
+{
+  struct wlr_box box = { 0, };
+
+  if (toplevel->xdg_toplevel && toplevel->xdg_toplevel->base->surface->mapped)
+    wlr_xdg_surface_get_geometry (toplevel->xdg_toplevel->base, &box);
+
+  if (toplevel->width == box.width && toplevel->height == box.height)
+    return;
+
+  toplevel->width = box.width;
+  toplevel->height = box.height;
+  gdk_paintable_invalidate_size (GDK_PAINTABLE (toplevel));
+}
+
+/* Thumbnail */
+
+static struct wlr_texture *
+casilda_toplevel_get_texture (CasildaToplevel *toplevel)
+{
+  if (!toplevel->xdg_toplevel || !toplevel->xdg_toplevel->base->surface->mapped)
+    return NULL;
+
+  return wlr_surface_get_texture (toplevel->xdg_toplevel->base->surface);
+}
+
+/*
+ * Scale the damaged part of the surface into the thumbnail, only the source
+ * pixels under the affected thumbnail pixels are read back.
+ */
+static gboolean
+casilda_toplevel_thumbnail_render (CasildaToplevel *toplevel)
+{
+  struct wlr_texture *texture = casilda_toplevel_get_texture (toplevel);
+  g_autofree guint8 *pixels = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  pixman_box32_t *extents;
+  gint sw, sh, dw, dh;
+  gint dx0, dy0, dx1, dy1, sx0, sy0, sx1, sy1;
+  gsize stride;
+
+  if (!texture)
+    return FALSE;
+
+  sw = texture->width;
+  sh = texture->height;
+
+  /* Start over if the surface size changed */
+  if (sw != toplevel->source_width || sh != toplevel->source_height)
+    {
+      gint size = MIN (CASILDA_TOPLEVEL_THUMBNAIL_SIZE, MAX (sw, sh));
+
+      toplevel->source_width = sw;
+      toplevel->source_height = sh;
+      toplevel->thumbnail_width = MAX (1, (gint64) sw * size / MAX (sw, sh));
+      toplevel->thumbnail_height = MAX (1, (gint64) sh * size / MAX (sw, sh));
+
+      g_free (toplevel->thumbnail_data);
+      toplevel->thumbnail_data = g_malloc0 (toplevel->thumbnail_width * toplevel->thumbnail_height * 4);
+
+      pixman_region32_fini (&toplevel->thumbnail_damage);
+      pixman_region32_init_rect (&toplevel->thumbnail_damage, 0, 0, sw, sh);
+    }
+
+  pixman_region32_intersect_rect (&toplevel->thumbnail_damage,
+                                  &toplevel->thumbnail_damage,
+                                  0, 0, sw, sh);
+
+  if (!pixman_region32_not_empty (&toplevel->thumbnail_damage))
+    return FALSE;
+
+  dw = toplevel->thumbnail_width;
+  dh = toplevel->thumbnail_height;
+  extents = pixman_region32_extents (&toplevel->thumbnail_damage);
+
+  /* Thumbnail pixels touched by the damage and the source they cover */
+  dx0 = (gint64) extents->x1 * dw / sw;
+  dy0 = (gint64) extents->y1 * dh / sh;
+  dx1 = MIN (dw, ((gint64) extents->x2 * dw + sw - 1) / sw);
+  dy1 = MIN (dh, ((gint64) extents->y2 * dh + sh - 1) / sh);
+  sx0 = (gint64) dx0 * sw / dw;
+  sy0 = (gint64) dy0 * sh / dh;
+  sx1 = (gint64) dx1 * sw / dw;
+  sy1 = (gint64) dy1 * sh / dh;
+
+  pixman_region32_clear (&toplevel->thumbnail_damage);
+
+  stride = (gsize) (sx1 - sx0) * 4;
+  pixels = g_malloc (stride * (sy1 - sy0));
+
+  if (!wlr_texture_read_pixels (texture, &(struct wlr_texture_read_pixels_options) {
+                                  .data = pixels,
+                                  .format = DRM_FORMAT_ARGB8888,
+                                  .stride = stride,
+                                  .src_box = { sx0, sy0, sx1 - sx0, sy1 - sy0 },
+                                }))
+    return FALSE;
+
+  casilda_thumbnail_scale (pixels, stride, sx0, sy0, sw, sh,
+                           toplevel->thumbnail_data, dw * 4, dw, dh,
+                           dx0, dy0, dx1 - dx0, dy1 - dy0);
+
+  /* DRM_FORMAT_ARGB8888 is B, G, R, A in memory */
+  bytes = g_bytes_new (toplevel->thumbnail_data, dw * dh * 4);
+  g_clear_object (&toplevel->thumbnail);
+  toplevel->thumbnail = gdk_memory_texture_new (dw, dh,
+                                                GDK_MEMORY_B8G8R8A8_PREMULTIPLIED,
+                                                bytes,
+                                                dw * 4);
+  toplevel->thumbnail_time = g_get_monotonic_time ();
+
+  return TRUE;
+}
+
+static gboolean
+on_thumbnail_timeout (gpointer user_data)
+{
+  CasildaToplevel *toplevel = user_data;
+
+  toplevel->thumbnail_source = 0;
+
+  if (casilda_toplevel_thumbnail_render (toplevel))
+    g_object_notify_by_pspec (G_OBJECT (toplevel), properties[PROP_THUMBNAIL]);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Private API */
+
+CasildaToplevel *
+casilda_toplevel_new (struct wlr_xdg_toplevel *xdg_toplevel,
+                      GdkDisplay              *display)
+{
+  CasildaToplevel *toplevel = g_object_new (CASILDA_TOPLEVEL_TYPE, NULL);
+
+  toplevel->xdg_toplevel = xdg_toplevel;
+  toplevel->display = g_object_ref (display);
+
+  return toplevel;
+}
+
+void
+casilda_toplevel_commit (CasildaToplevel *toplevel)
+{
+  struct wlr_surface *surface = toplevel->xdg_toplevel->base->surface;
+  gint64 delay;
+
+  casilda_toplevel_update_size (toplevel);
+
+  /* Not painted yet, surfaces are tracked from the first snapshot on */
+  if (!g_hash_table_size (toplevel->surfaces))
+    gdk_paintable_invalidate_contents (GDK_PAINTABLE (toplevel));
+
+  /* Nobody asked for a thumbnail, nothing to keep up to date */
+  if (!toplevel->thumbnail_wanted ||
+      !pixman_region32_not_empty (&surface->buffer_damage))
+    return;
+
+  pixman_region32_union (&toplevel->thumbnail_damage,
+                         &toplevel->thumbnail_damage,
+                         &surface->buffer_damage);
+
+  if (toplevel->thumbnail_source)
+    return;
+
+  delay = CASILDA_TOPLEVEL_THUMBNAIL_INTERVAL_MS -
+          (g_get_monotonic_time () - toplevel->thumbnail_time) / 1000;
+
+  toplevel->thumbnail_source = g_timeout_add (CLAMP (delay, 0, CASILDA_TOPLEVEL_THUMBNAIL_INTERVAL_MS),
+                                              on_thumbnail_timeout,
+                                              toplevel);
+}
+
+void
+casilda_toplevel_unmapped (CasildaToplevel *toplevel)
+{
+  g_hash_table_remove_all (toplevel->surfaces);
+  casilda_toplevel_update_size (toplevel);
+  gdk_paintable_invalidate_contents (GDK_PAINTABLE (toplevel));
+}
+
+void
+casilda_toplevel_destroyed (CasildaToplevel *toplevel)
+{
+  g_hash_table_remove_all (toplevel->surfaces);
+  toplevel->xdg_toplevel = NULL;
+  g_clear_handle_id (&toplevel->thumbnail_source, g_source_remove);
+}
+
+/*
+ * Drop the textures imported for the paintable and the thumbnail, surfaces
+ * are imported again on the next snapshot and the thumbnail the next time it
+ * is requested. Returns the number of textures dropped.
+ */
+guint
+casilda_toplevel_trim (CasildaToplevel *toplevel)
+{
+  CasildaToplevelSurface *entry;
+  GHashTableIter iter;
+  guint retval = 0;
+
+  g_hash_table_iter_init (&iter, toplevel->surfaces);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &entry))
+    {
+      if (!entry->texture)
+        continue;
+
+      g_clear_object (&entry->texture);
+      entry->buffer = NULL;
+      retval++;
+    }
+
+  if (!toplevel->thumbnail)
+    return retval;
+
+  g_clear_handle_id (&toplevel->thumbnail_source, g_source_remove);
+  g_clear_object (&toplevel->thumbnail);
+  g_clear_pointer (&toplevel->thumbnail_data, g_free);
+  pixman_region32_clear (&toplevel->thumbnail_damage);
+  toplevel->source_width = toplevel->source_height = 0;
+  toplevel->thumbnail_wanted = FALSE;
+  g_object_notify_by_pspec (G_OBJECT (toplevel), properties[PROP_THUMBNAIL]);
+
+  return retval + 1;
+}
+
+/* Public API */
+
+const gchar *
+casilda_toplevel_get_app_id (CasildaToplevel *toplevel)
+{
+  g_return_val_if_fail (CASILDA_IS_TOPLEVEL (toplevel), NULL);
+
+  return toplevel->xdg_toplevel ? toplevel->xdg_toplevel->app_id : NULL;
+}
+
+const gchar *
+casilda_toplevel_get_title (CasildaToplevel *toplevel)
+{
+  g_return_val_if_fail (CASILDA_IS_TOPLEVEL (toplevel), NULL);
+
+  return toplevel->xdg_toplevel ? toplevel->xdg_toplevel->title : NULL;
+}
+
+CasildaClient *
+casilda_toplevel_get_client (CasildaToplevel *toplevel)
+{
+  g_return_val_if_fail (CASILDA_IS_TOPLEVEL (toplevel), NULL);
+
+  if (!toplevel->xdg_toplevel)
+    return NULL;
+
+  return casilda_client_from_wl_client (wl_resource_get_client (toplevel->xdg_toplevel->resource));
+}
+
+/*
+ * Returns a small snapshot of the toplevel, it is kept up to date from then
+ * on, connect to notify::thumbnail to get the new ones.
+ */
+GdkTexture *
+casilda_toplevel_get_thumbnail (CasildaToplevel *toplevel)
+{
+  g_return_val_if_fail (CASILDA_IS_TOPLEVEL (toplevel), NULL);
+
+  if (!toplevel->thumbnail_wanted)
+    {
+      toplevel->thumbnail_wanted = TRUE;
+      casilda_toplevel_thumbnail_render (toplevel);
+    }
+
+  return toplevel->thumbnail;
+}
+
+guint
+casilda_toplevel_get_max_frame_rate (CasildaToplevel *toplevel)
+{
+  g_return_val_if_fail (CASILDA_IS_TOPLEVEL (toplevel), 0);
+
+  return toplevel->max_frame_rate;
+}
+
+/*
+ * Cap the frame callbacks of this toplevel on top of the compositor policy,
+ * use 0 for no limit.
+ */
+void
+casilda_toplevel_set_max_frame_rate (CasildaToplevel *toplevel,
+                                     guint            frame_rate)
+{
+  g_return_if_fail (CASILDA_IS_TOPLEVEL (toplevel));
+
+  g_object_set (toplevel, "max-frame-rate", frame_rate, NULL);
+}
@@ -0,0 +1,360 @@
+/*
+ * Casilda Protocol Trace
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define WLR_USE_UNSTABLE 1
+#define G_LOG_DOMAIN "Casilda"
+
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+
+#include "casilda-trace.h"
+
+typedef struct
+{
+  CasildaTrace       *trace;
+  guint32             index;
+  struct wl_listener  destroy;
+} CasildaTraceClient;
+
+struct _CasildaTrace
+{
+  struct wl_display         *display;
+  struct wl_protocol_logger *logger;
+  struct wl_listener         client_created;
+
+  GDataOutputStream         *out;
+  gint64                     start;
+
+  /* wl_client -> CasildaTraceClient */
+  GHashTable                *clients;
+  guint32                    n_clients;
+
+  /* wl_surface resource -> id of the wl_buffer attached to it */
+  GHashTable                *attached;
+};
+
+static gboolean
+casilda_trace_check (CasildaTrace *trace, GError *error)
+{
+  if (!error)
+    return TRUE;
+
+  /* Stop recording on the first error, the rest of the trace is useless */
+  g_warning ("Error writing protocol trace: %s", error->message);
+  g_error_free (error);
+  g_clear_object (&trace->out);
+
+  return FALSE;
+}
+
+static gboolean
+casilda_trace_record (CasildaTrace       *trace,
+                      CasildaTraceRecord  type,
+                      guint32             client)
+{
+  GError *error = NULL;
+
+  if (!trace->out)
+    return FALSE;
+
+  if (g_data_output_stream_put_byte (trace->out, type, NULL, &error) &&
+      g_data_output_stream_put_uint32 (trace->out, client, NULL, &error))
+    g_data_output_stream_put_uint64 (trace->out,
+                                     g_get_monotonic_time () - trace->start,
+                                     NULL,
+                                     &error);
+
+  return casilda_trace_check (trace, error);
+}
+
+static void
+casilda_trace_put_data (CasildaTrace  *trace,
+                        gconstpointer  data,
+                        guint32        size,
+                        GError       **error)
+{
+  if (!g_data_output_stream_put_uint32 (trace->out, size, NULL, error))
+    return;
+
+  if (size)
+    g_output_stream_write_all (G_OUTPUT_STREAM (trace->out), data, size, NULL, NULL, error);
+}
+
+static void
+casilda_trace_put_string (CasildaTrace *trace, const gchar *string, GError **error)
+{
+  if (string)
+    casilda_trace_put_data (trace, string, strlen (string) + 1, error);
+  else
+    casilda_trace_put_data (trace, NULL, 0, error);
+}
+
+static void
+casilda_trace_client_free (CasildaTraceClient *client)
+{
+  wl_list_remove (&client->destroy.link);
+  g_free (client);
+}
+
+static void
+on_client_destroy (struct wl_listener *listener, void *data)
+{
+  CasildaTraceClient *client = wl_container_of (listener, client, destroy);
+  CasildaTrace *trace = client->trace;
+
+  casilda_trace_record (trace, CASILDA_TRACE_CLIENT_DESTROY, client->index);
+  g_hash_table_remove (trace->clients, data);
+}
+
+static void
+on_client_created (struct wl_listener *listener, void *data)
+{
+  CasildaTrace *trace = wl_container_of (listener, trace, client_created);
+  CasildaTraceClient *client = g_new0 (CasildaTraceClient, 1);
+
+  client->trace = trace;
+  client->index = trace->n_clients++;
+  client->destroy.notify = on_client_destroy;
+  wl_client_add_destroy_listener (data, &client->destroy);
+  g_hash_table_insert (trace->clients, data, client);
+
+  casilda_trace_record (trace, CASILDA_TRACE_CLIENT_NEW, client->index);
+}
+
+static void
+casilda_trace_buffer (CasildaTrace       *trace,
+                      CasildaTraceClient *client,
+                      struct wl_resource *surface_resource)
+{
+  struct wlr_surface *surface = wlr_surface_from_resource (surface_resource);
+  GError *error = NULL;
+  gpointer buffer_id;
+  uint32_t format;
+  size_t stride;
+  void *data;
+
+  if (!(surface->pending.committed & WLR_SURFACE_STATE_BUFFER) || !surface->pending.buffer)
+    return;
+
+  if (!g_hash_table_lookup_extended (trace->attached, surface_resource, NULL, &buffer_id))
+    return;
+
+  /* Only shm buffers have contents we can replay */
+  if (!wlr_buffer_begin_data_ptr_access (surface->pending.buffer,
+                                         WLR_BUFFER_DATA_PTR_ACCESS_READ,
+                                         &data,
+                                         &format,
+                                         &stride))
+    return;
+
+  if (casilda_trace_record (trace, CASILDA_TRACE_BUFFER, client->index))
+    {
+      if (g_data_output_stream_put_uint32 (trace->out, GPOINTER_TO_UINT (buffer_id), NULL, &error))
+        casilda_trace_put_data (trace, data, stride * surface->pending.buffer->height, &error);
+
+      casilda_trace_check (trace, error);
+    }
+
+  wlr_buffer_end_data_ptr_access (surface->pending.buffer);
+}
+
+static void
+casilda_trace_put_argument (CasildaTrace             *trace,
+                            gchar                     type,
+                            const union wl_argument  *arg,
+                            GError                  **error)
+{
+  if (!g_data_output_stream_put_byte (trace->out, type, NULL, error))
+    return;
+
+  switch (type)
+    {
+    case 'i':
+      g_data_output_stream_put_int32 (trace->out, arg->i, NULL, error);
+      break;
+    case 'u':
+    case 'n':
+      g_data_output_stream_put_uint32 (trace->out, arg->u, NULL, error);
+      break;
+    case 'f':
+      g_data_output_stream_put_int32 (trace->out, arg->f, NULL, error);
+      break;
+    case 'o':
+      g_data_output_stream_put_uint32 (trace->out,
+                                       arg->o ? wl_resource_get_id ((struct wl_resource *) arg->o) : 0,
+                                       NULL,
+                                       error);
+      break;
+    case 's':
+      casilda_trace_put_string (trace, arg->s, error);
+      break;
+    case 'a':
+      if (arg->a)
+        casilda_trace_put_data (trace, arg->a->data, arg->a->size, error);
+      else
+        casilda_trace_put_data (trace, NULL, 0, error);
+      break;
+    case 'h':
+      break;
+    }
+}
+
+static void
+casilda_trace_request (CasildaTrace                            *trace,
+                       CasildaTraceClient                      *client,
+                       const struct wl_protocol_logger_message *message)
+{
+  const gchar *interface = wl_resource_get_class (message->resource);
+  const gchar *signature = message->message->signature;
+  GError *error = NULL;
+  gint i = 0;
+
+  if (g_str_equal (interface, "wl_surface"))
+    {
+      if (g_str_equal (message->message->name, "attach"))
+        {
+          const union wl_argument *buffer = &message->arguments[0];
+
+          g_hash_table_insert (trace->attached,
+                               message->resource,
+                               GUINT_TO_POINTER (buffer->o ? wl_resource_get_id ((struct wl_resource *) buffer->o) : 0));
+        }
+      else if (g_str_equal (message->message->name, "commit"))
+        casilda_trace_buffer (trace, client, message->resource);
+      else if (g_str_equal (message->message->name, "destroy"))
+        g_hash_table_remove (trace->attached, message->resource);
+    }
+
+  if (!casilda_trace_record (trace, CASILDA_TRACE_REQUEST, client->index))
+    return;
+
+  casilda_trace_put_string (trace, interface, &error);
+
+  if (!error &&
+      g_data_output_stream_put_uint32 (trace->out, wl_resource_get_id (message->resource), NULL, &error) &&
+      g_data_output_stream_put_uint16 (trace->out, message->message_opcode, NULL, &error))
+    g_data_output_stream_put_uint16 (trace->out, message->arguments_count, NULL, &error);
+
+  for (const gchar *c = signature; *c && !error && i < message->arguments_count; c++)
+    {
+      /* Skip since version and nullable markers */
+      if (g_ascii_isdigit (*c) || *c == '?')
+        continue;
+
+      casilda_trace_put_argument (trace, *c, &message->arguments[i++], &error);
+    }
+
+  casilda_trace_check (trace, error);
+}
+
+static void
+casilda_trace_logger (void                                    *user_data,
+                      enum wl_protocol_logger_type             direction,
+                      const struct wl_protocol_logger_message *message)
+{
+  CasildaTrace *trace = user_data;
+  CasildaTraceClient *client;
+
+  /* Events are the compositor's answer, replaying requests recreates them */
+  if (direction != WL_PROTOCOL_LOGGER_REQUEST || !trace->out)
+    return;
+
+  client = g_hash_table_lookup (trace->clients, wl_resource_get_client (message->resource));
+  if (client)
+    casilda_trace_request (trace, client, message);
+}
+
+/*
+ * Record every request clients make to display and the contents of the shm
+ * buffers they commit in filename, so the session can be replayed later with
+ * casilda-replay. Clients already connected are not recorded.
+ */
+CasildaTrace *
+casilda_trace_new (struct wl_display  *display,
+                   const gchar        *filename,
+                   GError            **error)
+{
+  g_autoptr(GFile) file = g_file_new_for_path (filename);
+  g_autoptr(GFileOutputStream) stream = NULL;
+  g_autoptr(GZlibCompressor) compressor = NULL;
+  g_autoptr(GOutputStream) out = NULL;
+  CasildaTrace *trace;
+
+  if (!(stream = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error)))
+    return NULL;
+
+  /* Favor speed, recording happens while clients are rendering */
+  compressor = g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP, 1);
+  out = g_converter_output_stream_new (G_OUTPUT_STREAM (stream), G_CONVERTER (compressor));
+
+  trace = g_new0 (CasildaTrace, 1);
+  trace->display = display;
+  trace->out = g_data_output_stream_new (out);
+  g_data_output_stream_set_byte_order (trace->out, G_DATA_STREAM_BYTE_ORDER_LITTLE_ENDIAN);
+  trace->start = g_get_monotonic_time ();
+  trace->clients = g_hash_table_new_full (NULL, NULL, NULL,
+                                          (GDestroyNotify) casilda_trace_client_free);
+  trace->attached = g_hash_table_new (NULL, NULL);
+
+  if (!g_output_stream_write_all (G_OUTPUT_STREAM (trace->out),
+                                  CASILDA_TRACE_MAGIC,
+                                  strlen (CASILDA_TRACE_MAGIC),
+                                  NULL, NULL, error) ||
+      !g_data_output_stream_put_uint32 (trace->out, CASILDA_TRACE_VERSION, NULL, error))
+    {
+      casilda_trace_free (trace);
+      return NULL;
+    }
+
+  trace->client_created.notify = on_client_created;
+  wl_display_add_client_created_listener (display, &trace->client_created);
+  trace->logger = wl_display_add_protocol_logger (display, casilda_trace_logger, trace);
+
+  g_debug ("%s recording protocol trace in %s", __func__, filename);
+
+  return trace;
+}
+
+void
+casilda_trace_free (CasildaTrace *trace)
+{
+  g_autoptr(GError) error = NULL;
+
+  if (trace->logger)
+    {
+      wl_protocol_logger_destroy (trace->logger);
+      wl_list_remove (&trace->client_created.link);
+    }
+
+  g_hash_table_destroy (trace->clients);
+  g_hash_table_destroy (trace->attached);
+
+  if (trace->out && !g_output_stream_close (G_OUTPUT_STREAM (trace->out), NULL, &error))
+    g_warning ("Error closing protocol trace: %s", error->message);
+
+  g_clear_object (&trace->out);
+  g_free (trace);
+}
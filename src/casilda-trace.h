@@ -0,0 +1,70 @@
+/*
+ * Casilda Protocol Trace
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+
+struct wl_display;
+
+/*
+ * Traces are a gzip stream of little endian records, after a header with
+ * CASILDA_TRACE_MAGIC and a uint32 version. Every record starts with
+ *
+ *   uint8  type
+ *   uint32 client, index in the trace
+ *   uint64 time, microseconds since recording started
+ *
+ * followed by:
+ *
+ *   CLIENT_NEW, CLIENT_DESTROY: nothing
+ *   REQUEST: string interface, uint32 object id, uint16 opcode, uint16 n_args
+ *            and for each argument its uint8 signature type and value
+ *   BUFFER:  uint32 wl_buffer id, uint32 size and the buffer contents
+ *
+ * Strings and arrays are a uint32 size and the bytes, a string size of 0 is
+ * NULL and counts the terminating NUL otherwise. Integers, fixed, objects
+ * and new ids are a uint32, file descriptors have no value.
+ *
+ * BUFFER records hold the contents of the shm buffer attached to a surface
+ * right before the commit that uses it.
+ */
+#define CASILDA_TRACE_MAGIC   "CASILDA-TRACE"
+#define CASILDA_TRACE_VERSION 1
+
+typedef enum
+{
+  CASILDA_TRACE_CLIENT_NEW,
+  CASILDA_TRACE_CLIENT_DESTROY,
+  CASILDA_TRACE_REQUEST,
+  CASILDA_TRACE_BUFFER,
+} CasildaTraceRecord;
+
+typedef struct _CasildaTrace CasildaTrace;
+
+CasildaTrace *casilda_trace_new  (struct wl_display  *display,
+                                  const gchar        *filename,
+                                  GError            **error);
+void          casilda_trace_free (CasildaTrace       *trace);
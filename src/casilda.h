@@ -29,6 +29,10 @@ G_BEGIN_DECLS
 # include "casilda-version.h"
 #undef CASILDA_INSIDE
 
+#include "casilda-client.h"
 #include "casilda-compositor.h"
+#include "casilda-frame-ring.h"
+#include "casilda-stats.h"
+#include "casilda-toplevel.h"
 
 G_END_DECLS
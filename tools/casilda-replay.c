@@ -0,0 +1,875 @@
+/*
+ * Casilda Protocol Trace Replay
+ *
+ * Copyright (C) 2024  Juan Pablo Ugarte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation;
+ * version 2.1 of the License.
+ *
+ * library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Authors:
+ *   Juan Pablo Ugarte <juanpablougarte@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "xdg-shell-client-protocol.h"
+
+#include <gtk/gtk.h>
+
+#include "casilda-compositor.h"
+#include "casilda-trace.h"
+
+/* libwayland does not export its own limit */
+#define REPLAY_MAX_ARGS 20
+
+/*
+ * Replays a trace recorded with the compositor trace-file property. Every
+ * recorded client gets its own connection and its requests are sent again
+ * with the recorded object ids mapped to the new proxies. Requests on
+ * interfaces we do not know about are skipped.
+ */
+
+typedef struct
+{
+  gint     fd;
+  guint8  *data;
+  gsize    size;
+} ReplayPool;
+
+typedef struct
+{
+  ReplayPool *pool;
+  gsize       offset;
+} ReplayBuffer;
+
+typedef struct
+{
+  struct wl_display *display;
+
+  /* Recorded id -> wl_proxy */
+  GHashTable        *objects;
+
+  /* Interface name -> global name in this compositor */
+  GHashTable        *globals;
+
+  /* Recorded wl_shm_pool id -> ReplayPool and wl_buffer id -> ReplayBuffer,
+   * pools outlive their wl_shm_pool so they are owned by the array
+   */
+  GHashTable        *pools;
+  GHashTable        *buffers;
+  GPtrArray         *all_pools;
+} ReplayClient;
+
+typedef struct
+{
+  gchar      *filename;
+  gchar      *socket;
+  gboolean    max_speed;
+
+  /* Recorded client index -> ReplayClient */
+  GHashTable *clients;
+
+  /* Stats */
+  guint       n_records;
+  guint       n_skipped;
+  gint64      duration;
+  gint64      elapsed;
+} Replay;
+
+static const struct wl_interface *interfaces[] = {
+  &wl_display_interface,
+  &wl_registry_interface,
+  &wl_callback_interface,
+  &wl_compositor_interface,
+  &wl_shm_pool_interface,
+  &wl_shm_interface,
+  &wl_buffer_interface,
+  &wl_data_offer_interface,
+  &wl_data_source_interface,
+  &wl_data_device_interface,
+  &wl_data_device_manager_interface,
+  &wl_seat_interface,
+  &wl_pointer_interface,
+  &wl_keyboard_interface,
+  &wl_touch_interface,
+  &wl_output_interface,
+  &wl_region_interface,
+  &wl_subcompositor_interface,
+  &wl_subsurface_interface,
+  &wl_surface_interface,
+  &xdg_wm_base_interface,
+  &xdg_positioner_interface,
+  &xdg_surface_interface,
+  &xdg_toplevel_interface,
+  &xdg_popup_interface,
+};
+
+static const struct wl_interface *
+replay_find_interface (const gchar *name)
+{
+  for (guint i = 0; name && i < G_N_ELEMENTS (interfaces); i++)
+    {
+      if (g_str_equal (interfaces[i]->name, name))
+        return interfaces[i];
+    }
+
+  return NULL;
+}
+
+static void
+replay_pool_free (ReplayPool *pool)
+{
+  if (pool->data)
+    munmap (pool->data, pool->size);
+  close (pool->fd);
+  g_free (pool);
+}
+
+static ReplayPool *
+replay_pool_new (gsize size)
+{
+  ReplayPool *pool;
+  gint fd;
+
+  if ((fd = memfd_create ("casilda-replay", MFD_CLOEXEC)) < 0)
+    return NULL;
+
+  pool = g_new0 (ReplayPool, 1);
+  pool->fd = fd;
+
+  if (ftruncate (fd, size) < 0 ||
+      (pool->data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+      pool->data = NULL;
+      replay_pool_free (pool);
+      return NULL;
+    }
+
+  pool->size = size;
+
+  return pool;
+}
+
+static void
+replay_pool_resize (ReplayPool *pool, gsize size)
+{
+  guint8 *data;
+
+  if (size <= pool->size || ftruncate (pool->fd, size) < 0)
+    return;
+
+  if ((data = mremap (pool->data, pool->size, size, MREMAP_MAYMOVE)) == MAP_FAILED)
+    return;
+
+  pool->data = data;
+  pool->size = size;
+}
+
+static void
+registry_handle_global (void               *data,
+                        G_GNUC_UNUSED struct wl_registry *registry,
+                        uint32_t            name,
+                        const char         *interface,
+                        G_GNUC_UNUSED uint32_t version)
+{
+  ReplayClient *client = data;
+
+  if (!g_hash_table_contains (client->globals, interface))
+    g_hash_table_insert (client->globals, g_strdup (interface), GUINT_TO_POINTER (name));
+}
+
+static void
+registry_handle_global_remove (G_GNUC_UNUSED void *data,
+                               G_GNUC_UNUSED struct wl_registry *registry,
+                               G_GNUC_UNUSED uint32_t name)
+{
+}
+
+static const struct wl_registry_listener registry_listener = {
+  registry_handle_global,
+  registry_handle_global_remove,
+};
+
+static ReplayClient *
+replay_client_new (const gchar *socket)
+{
+  struct wl_display *display;
+  ReplayClient *client;
+
+  if (!(display = wl_display_connect (socket)))
+    {
+      g_warning ("Could not connect to %s: %s", socket, g_strerror (errno));
+      return NULL;
+    }
+
+  client = g_new0 (ReplayClient, 1);
+  client->display = display;
+  client->objects = g_hash_table_new_full (NULL, NULL, NULL,
+                                           (GDestroyNotify) wl_proxy_destroy);
+  client->globals = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  client->pools = g_hash_table_new (NULL, NULL);
+  client->buffers = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  client->all_pools = g_ptr_array_new_with_free_func ((GDestroyNotify) replay_pool_free);
+
+  return client;
+}
+
+static void
+replay_client_free (ReplayClient *client)
+{
+  /* Let the compositor process everything before we go away */
+  wl_display_roundtrip (client->display);
+
+  g_hash_table_destroy (client->objects);
+  g_hash_table_destroy (client->globals);
+  g_hash_table_destroy (client->pools);
+  g_hash_table_destroy (client->buffers);
+  g_ptr_array_unref (client->all_pools);
+  wl_display_disconnect (client->display);
+  g_free (client);
+}
+
+/*
+ * Send pending requests and handle events without blocking, unless the
+ * socket is full in which case we wait for the compositor to catch up.
+ */
+static gboolean
+replay_client_dispatch (ReplayClient *client)
+{
+  struct wl_display *display = client->display;
+  struct pollfd pfd = { wl_display_get_fd (display), POLLIN, 0 };
+
+  while (wl_display_prepare_read (display) != 0)
+    wl_display_dispatch_pending (display);
+
+  while (wl_display_flush (display) < 0)
+    {
+      if (errno != EAGAIN)
+        {
+          wl_display_cancel_read (display);
+          return FALSE;
+        }
+
+      pfd.events = POLLIN | POLLOUT;
+      poll (&pfd, 1, -1);
+
+      if (pfd.revents & POLLIN)
+        {
+          wl_display_read_events (display);
+          wl_display_dispatch_pending (display);
+
+          while (wl_display_prepare_read (display) != 0)
+            wl_display_dispatch_pending (display);
+        }
+    }
+
+  pfd.events = POLLIN;
+  if (poll (&pfd, 1, 0) > 0)
+    wl_display_read_events (display);
+  else
+    wl_display_cancel_read (display);
+
+  wl_display_dispatch_pending (display);
+
+  return wl_display_get_error (display) == 0;
+}
+
+static struct wl_proxy *
+replay_client_lookup (ReplayClient *client, guint32 id)
+{
+  if (id == 1)
+    return (struct wl_proxy *) client->display;
+
+  return g_hash_table_lookup (client->objects, GUINT_TO_POINTER (id));
+}
+
+static gboolean
+replay_read_data (GDataInputStream  *in,
+                  gpointer          *data,
+                  guint32           *size,
+                  GError           **error)
+{
+  *data = NULL;
+
+  if (!(*size = g_data_input_stream_read_uint32 (in, NULL, error)) && *error)
+    return FALSE;
+
+  if (!*size)
+    return TRUE;
+
+  *data = g_malloc (*size);
+
+  return g_input_stream_read_all (G_INPUT_STREAM (in), *data, *size, NULL, NULL, error);
+}
+
+static gchar *
+replay_read_string (GDataInputStream *in, GError **error)
+{
+  gpointer data;
+  guint32 size;
+
+  if (!replay_read_data (in, &data, &size, error))
+    {
+      g_free (data);
+      return NULL;
+    }
+
+  /* Make sure it is terminated no matter what the trace says */
+  if (data)
+    ((gchar *) data)[size - 1] = '\0';
+
+  return data;
+}
+
+static void
+replay_buffer (Replay            *replay,
+               ReplayClient      *client,
+               GDataInputStream  *in,
+               GError           **error)
+{
+  g_autofree gpointer data = NULL;
+  ReplayBuffer *buffer;
+  guint32 id, size;
+
+  id = g_data_input_stream_read_uint32 (in, NULL, error);
+  if (*error || !replay_read_data (in, &data, &size, error))
+    return;
+
+  if (!client || !(buffer = g_hash_table_lookup (client->buffers, GUINT_TO_POINTER (id))) ||
+      buffer->offset >= buffer->pool->size)
+    {
+      replay->n_skipped++;
+      return;
+    }
+
+  memcpy (buffer->pool->data + buffer->offset,
+          data,
+          MIN (size, buffer->pool->size - buffer->offset));
+}
+
+static void
+replay_request (Replay            *replay,
+                ReplayClient      *client,
+                GDataInputStream  *in,
+                GError           **error)
+{
+  g_autoptr(GPtrArray) data = g_ptr_array_new_with_free_func (g_free);
+  g_autofree gchar *interface_name = NULL;
+  const struct wl_interface *interface, *new_interface = NULL;
+  const struct wl_message *method;
+  union wl_argument args[REPLAY_MAX_ARGS] = { 0, };
+  gchar types[REPLAY_MAX_ARGS];
+  struct wl_array arrays[REPLAY_MAX_ARGS];
+  struct wl_proxy *proxy, *new_proxy;
+  guint32 id, new_id = 0, version = 0, flags = 0;
+  ReplayPool *pool = NULL;
+  gboolean skip = FALSE;
+  const gchar *c;
+  guint16 opcode, n_args;
+  gint fd = -1;
+
+  if (!(interface_name = replay_read_string (in, error)) && *error)
+    return;
+
+  id = g_data_input_stream_read_uint32 (in, NULL, error);
+  if (*error)
+    return;
+  opcode = g_data_input_stream_read_uint16 (in, NULL, error);
+  if (*error)
+    return;
+  n_args = g_data_input_stream_read_uint16 (in, NULL, error);
+  if (*error)
+    return;
+
+  if (n_args > REPLAY_MAX_ARGS)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Too many arguments");
+      return;
+    }
+
+  /* Read every argument even if we end up skipping the request */
+  for (guint i = 0; i < n_args; i++)
+    {
+      gpointer bytes;
+      guint32 size;
+
+      types[i] = g_data_input_stream_read_byte (in, NULL, error);
+      if (*error)
+        return;
+
+      switch (types[i])
+        {
+        case 'i':
+        case 'f':
+          args[i].i = g_data_input_stream_read_int32 (in, NULL, error);
+          break;
+        case 'u':
+        case 'n':
+        case 'o':
+          args[i].u = g_data_input_stream_read_uint32 (in, NULL, error);
+          break;
+        case 's':
+        case 'a':
+          if (!replay_read_data (in, &bytes, &size, error))
+            {
+              g_free (bytes);
+              return;
+            }
+
+          g_ptr_array_add (data, bytes);
+
+          if (types[i] == 's')
+            {
+              if (bytes)
+                ((gchar *) bytes)[size - 1] = '\0';
+              args[i].s = bytes;
+            }
+          else
+            {
+              arrays[i] = (struct wl_array) { size, size, bytes };
+              args[i].a = &arrays[i];
+            }
+          break;
+        case 'h':
+          break;
+        default:
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Unknown argument type %c", types[i]);
+          return;
+        }
+
+      if (*error)
+        return;
+    }
+
+  if (!client ||
+      !(proxy = replay_client_lookup (client, id)) ||
+      !(interface = replay_find_interface (interface_name)) ||
+      opcode >= interface->method_count)
+    {
+      replay->n_skipped++;
+      return;
+    }
+
+  method = &interface->methods[opcode];
+  version = wl_proxy_get_version (proxy);
+
+  /* Map recorded arguments to this connection */
+  c = method->signature;
+  for (guint i = 0; i < n_args && !skip; i++, c++)
+    {
+      while (*c && (g_ascii_isdigit (*c) || *c == '?'))
+        c++;
+
+      if (*c != types[i])
+        {
+          skip = TRUE;
+          break;
+        }
+
+      switch (types[i])
+        {
+        case 'o':
+          if (args[i].u && !(args[i].o = (struct wl_object *) replay_client_lookup (client, args[i].u)))
+            skip = TRUE;
+          break;
+        case 'n':
+          new_id = args[i].u;
+          args[i].n = 0;
+
+          /* wl_registry.bind is the only untyped new id, interface name and
+           * version come right before it
+           */
+          if (!(new_interface = method->types[i]) && i >= 2)
+            {
+              new_interface = replay_find_interface (args[i - 2].s);
+              version = args[i - 1].u;
+            }
+
+          if (!new_interface)
+            skip = TRUE;
+          break;
+        case 'u':
+          /* Global names are different in this compositor */
+          if (interface == &wl_registry_interface && i == 0 && n_args > 1 && types[1] == 's')
+            {
+              gpointer name;
+
+              if (g_hash_table_lookup_extended (client->globals, args[1].s, NULL, &name))
+                args[i].u = GPOINTER_TO_UINT (name);
+              else
+                skip = TRUE;
+            }
+          break;
+        }
+    }
+
+  if (skip)
+    {
+      replay->n_skipped++;
+      return;
+    }
+
+  /* File descriptors are not recorded, shm pools get fresh memory and the
+   * rest is pointed to /dev/null
+   */
+  for (guint i = 0; i < n_args; i++)
+    {
+      if (types[i] != 'h')
+        continue;
+
+      if (interface == &wl_shm_interface && n_args == 3)
+        {
+          if (!(pool = replay_pool_new (MAX (args[2].i, 1))))
+            {
+              replay->n_skipped++;
+              return;
+            }
+
+          args[i].h = pool->fd;
+        }
+      else
+        {
+          fd = open ("/dev/null", O_RDWR | O_CLOEXEC);
+          args[i].h = fd;
+        }
+    }
+
+  if (g_str_equal (method->name, "destroy") || g_str_equal (method->name, "release"))
+    flags |= WL_MARSHAL_FLAG_DESTROY;
+
+  new_proxy = wl_proxy_marshal_array_flags (proxy, opcode, new_interface, version, flags, args);
+
+  if (fd >= 0)
+    close (fd);
+
+  if (flags & WL_MARSHAL_FLAG_DESTROY)
+    {
+      /* The proxy is gone already */
+      g_hash_table_steal (client->objects, GUINT_TO_POINTER (id));
+      g_hash_table_remove (client->pools, GUINT_TO_POINTER (id));
+      g_hash_table_remove (client->buffers, GUINT_TO_POINTER (id));
+    }
+
+  if (interface == &wl_shm_pool_interface)
+    {
+      ReplayPool *shm_pool = g_hash_table_lookup (client->pools, GUINT_TO_POINTER (id));
+
+      if (shm_pool && g_str_equal (method->name, "resize"))
+        replay_pool_resize (shm_pool, args[0].i);
+      else if (shm_pool && g_str_equal (method->name, "create_buffer"))
+        {
+          ReplayBuffer *buffer = g_new0 (ReplayBuffer, 1);
+
+          buffer->pool = shm_pool;
+          buffer->offset = args[1].i;
+          g_hash_table_insert (client->buffers, GUINT_TO_POINTER (new_id), buffer);
+        }
+    }
+
+  if (pool)
+    {
+      g_ptr_array_add (client->all_pools, pool);
+      g_hash_table_insert (client->pools, GUINT_TO_POINTER (new_id), pool);
+    }
+
+  if (new_proxy)
+    {
+      g_hash_table_insert (client->objects, GUINT_TO_POINTER (new_id), new_proxy);
+
+      /* We need the globals to map wl_registry.bind names */
+      if (new_interface == &wl_registry_interface)
+        {
+          wl_registry_add_listener ((struct wl_registry *) new_proxy, &registry_listener, client);
+          wl_display_roundtrip (client->display);
+        }
+    }
+}
+
+static void
+replay_dispatch_all (Replay *replay)
+{
+  GHashTableIter iter;
+  ReplayClient *client;
+
+  g_hash_table_iter_init (&iter, replay->clients);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &client))
+    {
+      if (replay_client_dispatch (client))
+        continue;
+
+      g_warning ("Replayed client got disconnected: %s",
+                 g_strerror (wl_display_get_error (client->display)));
+      g_hash_table_iter_remove (&iter);
+    }
+}
+
+static gboolean
+replay_run (Replay *replay, GError **error)
+{
+  g_autoptr(GFile) file = g_file_new_for_commandline_arg (replay->filename);
+  g_autoptr(GFileInputStream) stream = NULL;
+  g_autoptr(GZlibDecompressor) decompressor = NULL;
+  g_autoptr(GInputStream) converter = NULL;
+  g_autoptr(GDataInputStream) in = NULL;
+  gchar magic[sizeof (CASILDA_TRACE_MAGIC) - 1];
+  gint64 start;
+
+  if (!(stream = g_file_read (file, NULL, error)))
+    return FALSE;
+
+  decompressor = g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+  converter = g_converter_input_stream_new (G_INPUT_STREAM (stream), G_CONVERTER (decompressor));
+  in = g_data_input_stream_new (converter);
+  g_data_input_stream_set_byte_order (in, G_DATA_STREAM_BYTE_ORDER_LITTLE_ENDIAN);
+
+  if (!g_input_stream_read_all (G_INPUT_STREAM (in), magic, sizeof (magic), NULL, NULL, error))
+    return FALSE;
+
+  if (memcmp (magic, CASILDA_TRACE_MAGIC, sizeof (magic)) ||
+      g_data_input_stream_read_uint32 (in, NULL, NULL) != CASILDA_TRACE_VERSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Not a Casilda trace");
+      return FALSE;
+    }
+
+  replay->clients = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) replay_client_free);
+  start = g_get_monotonic_time ();
+
+  while (TRUE)
+    {
+      GError *read_error = NULL;
+      ReplayClient *client;
+      guint32 index;
+      gint64 time;
+      guint8 type;
+
+      type = g_data_input_stream_read_byte (in, NULL, &read_error);
+
+      /* End of the trace */
+      if (read_error)
+        {
+          g_error_free (read_error);
+          break;
+        }
+
+      index = g_data_input_stream_read_uint32 (in, NULL, error);
+      if (*error)
+        break;
+      time = g_data_input_stream_read_uint64 (in, NULL, error);
+      if (*error)
+        break;
+
+      /* Keep the original pace, handling events while we wait */
+      while (!replay->max_speed && g_get_monotonic_time () - start < time)
+        {
+          replay_dispatch_all (replay);
+          g_usleep (MIN (time - (g_get_monotonic_time () - start), 5 * G_TIME_SPAN_MILLISECOND));
+        }
+
+      client = g_hash_table_lookup (replay->clients, GUINT_TO_POINTER (index));
+
+      switch (type)
+        {
+        case CASILDA_TRACE_CLIENT_NEW:
+          if ((client = replay_client_new (replay->socket)))
+            g_hash_table_insert (replay->clients, GUINT_TO_POINTER (index), client);
+          break;
+        case CASILDA_TRACE_CLIENT_DESTROY:
+          g_hash_table_remove (replay->clients, GUINT_TO_POINTER (index));
+          client = NULL;
+          break;
+        case CASILDA_TRACE_REQUEST:
+          replay_request (replay, client, in, error);
+          break;
+        case CASILDA_TRACE_BUFFER:
+          replay_buffer (replay, client, in, error);
+          break;
+        default:
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Unknown record type %d", type);
+          break;
+        }
+
+      if (*error)
+        break;
+
+      if (client && !replay_client_dispatch (client))
+        {
+          g_warning ("Replayed client %u got disconnected: %s",
+                     index,
+                     g_strerror (wl_display_get_error (client->display)));
+          g_hash_table_remove (replay->clients, GUINT_TO_POINTER (index));
+        }
+
+      replay->n_records++;
+      replay->duration = time;
+    }
+
+  g_clear_pointer (&replay->clients, g_hash_table_destroy);
+  replay->elapsed = g_get_monotonic_time () - start;
+
+  return *error == NULL;
+}
+
+static void
+replay_report (Replay *replay)
+{
+  g_print ("Replayed %u records in %.3fs, %.3fs recorded, %u skipped\n",
+           replay->n_records,
+           replay->elapsed / (gdouble) G_USEC_PER_SEC,
+           replay->duration / (gdouble) G_USEC_PER_SEC,
+           replay->n_skipped);
+}
+
+static void
+replay_thread (GTask                 *task,
+               G_GNUC_UNUSED gpointer source_object,
+               gpointer               task_data,
+               G_GNUC_UNUSED GCancellable *cancellable)
+{
+  GError *error = NULL;
+
+  if (replay_run (task_data, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+}
+
+static void
+on_replay_done (G_GNUC_UNUSED GObject *source_object,
+                GAsyncResult          *result,
+                gpointer               user_data)
+{
+  GApplication *app = user_data;
+  g_autoptr(GError) error = NULL;
+
+  if (g_task_propagate_boolean (G_TASK (result), &error))
+    replay_report (g_task_get_task_data (G_TASK (result)));
+  else
+    g_printerr ("Error replaying trace: %s\n", error->message);
+
+  g_application_quit (app);
+}
+
+static void
+on_compositor_ready (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  GApplication *app = user_data;
+  Replay *replay = g_object_get_data (G_OBJECT (app), "replay");
+  g_autoptr(GError) error = NULL;
+  GTask *task;
+
+  if (!casilda_compositor_wait_ready_finish (CASILDA_COMPOSITOR (source_object), result, &error))
+    {
+      g_printerr ("Error starting compositor: %s\n", error->message);
+      g_application_quit (app);
+      return;
+    }
+
+  g_object_get (source_object, "socket", &replay->socket, NULL);
+
+  /* Clients block on the compositor, they can not share its thread */
+  task = g_task_new (NULL, NULL, on_replay_done, app);
+  g_task_set_task_data (task, replay, NULL);
+  g_task_run_in_thread (task, replay_thread);
+  g_object_unref (task);
+}
+
+static void
+activate (GtkApplication *app,
+          Replay         *replay)
+{
+  CasildaCompositor *compositor;
+  GtkWidget *window;
+
+  window = gtk_application_window_new (app);
+  gtk_window_set_title (GTK_WINDOW (window), "Replay");
+  gtk_window_set_default_size (GTK_WINDOW (window), 800, 600);
+
+  compositor = casilda_compositor_new (NULL);
+  gtk_window_set_child (GTK_WINDOW (window), GTK_WIDGET (compositor));
+  gtk_window_present (GTK_WINDOW (window));
+
+  g_object_set_data (G_OBJECT (app), "replay", replay);
+  casilda_compositor_wait_ready_async (compositor, NULL, on_compositor_ready, app);
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GtkApplication) app = NULL;
+  g_autoptr(GError) error = NULL;
+  g_auto(GStrv) files = NULL;
+  Replay replay = { 0, };
+  GOptionEntry entries[] = {
+    { "max-speed", 'm', 0, G_OPTION_ARG_NONE, &replay.max_speed,
+      "Replay as fast as possible instead of at the recorded pace", NULL },
+    { "socket", 's', 0, G_OPTION_ARG_FILENAME, &replay.socket,
+      "Replay into the compositor at this socket instead of a new one", "SOCKET" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, "TRACE" },
+    { NULL }
+  };
+  gint retval;
+
+  context = g_option_context_new ("TRACE - replay a Casilda protocol trace");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  if (!files || g_strv_length (files) != 1)
+    {
+      g_printerr ("%s", g_option_context_get_help (context, TRUE, NULL));
+      return 1;
+    }
+
+  replay.filename = files[0];
+
+  if (replay.socket)
+    {
+      retval = replay_run (&replay, &error) ? 0 : 1;
+
+      if (retval)
+        g_printerr ("Error replaying trace: %s\n", error->message);
+      else
+        replay_report (&replay);
+
+      g_free (replay.socket);
+      return retval;
+    }
+
+  app = gtk_application_new ("org.gnome.casilda.replay", G_APPLICATION_NON_UNIQUE);
+  g_signal_connect (app, "activate", G_CALLBACK (activate), &replay);
+
+  retval = g_application_run (G_APPLICATION (app), 1, argv);
+  g_free (replay.socket);
+
+  return retval;
+}